@@ -1,8 +1,35 @@
 // This is setup for the Pololu QTR-8RC Reflectance Sensor Array
 // Library is available from https://github.com/pololu/qtr-sensors-arduino
 
-unsigned int sensorValues[qtr8RCSensorCount]; //<! Where the sensor values are stored
-bool calibrating = false; //<! Flag to indicate if we are currently calibrating
+// A complete reading of the sensor
+typedef struct qtr8RCSample {
+  unsigned int counter; //<! Incremented for each new sample
+  unsigned int values[qtr8RCSensorCount]; //<! The sensor values
+  unsigned int position; //<! The position of the line
+};
+
+// Samples are taken in the main loop into one buffer, while the other
+// holds the latest complete sample ready to be sent over i2c. The i2c
+// interrupt can't run part way through swapping them, so always sees a
+// whole sample.
+qtr8RCSample qtr8RCSamples[2]; //<! The double buffer of samples
+volatile uint8_t qtr8RCLatest = 0; //<! Index of the latest complete sample
+unsigned int qtr8RCCounter = 0; //<! Number of samples taken
+
+volatile bool calibrating = false; //<! Flag to indicate if we are currently calibrating
+
+// The calibration is sent over i2c in chunks, each holding either the
+// minimum or maximum reading of every sensor as 16 bit values
+enum {
+  QTR8RC_CALIBRATION_MINIMUM = 0,
+  QTR8RC_CALIBRATION_MAXIMUM = 1,
+  QTR8RC_CALIBRATION_CHUNKS = 2
+};
+
+// A calibration written over i2c is gathered here, then applied by the
+// main loop once every chunk has arrived
+unsigned int qtr8RCPendingCalibration[QTR8RC_CALIBRATION_CHUNKS][qtr8RCSensorCount];
+volatile uint8_t qtr8RCPendingChunks = 0; //<! Bitmask of the chunks written so far
 
 // The class for accessing the sensor
 QTRSensorsRC qtrrc((unsigned char[]) {qtr8RCSensorOne, qtr8RCSensorTwo, qtr8RCSensorThree, qtr8RCSensorFour, qtr8RCSensorFive, qtr8RCSensorSix,qtr8RCSensorSeven, qtr8RCSensorEight}, qtr8RCSensorCount, qtr8RCTimeout, qtr8RCEmitter);
@@ -12,7 +39,8 @@ QTRSensorsRC qtrrc((unsigned char[]) {qtr8RCSensorOne, qtr8RCSensorTwo, qtr8RCSe
  * Configures the QTR8 Sensor
  */
 void qtr8RCSetup() {
-  // No additional setup currently required
+  // Start with an empty sample, so there is always something to send
+  memset(qtr8RCSamples, 0, sizeof(qtr8RCSamples));
 }
 
 /**
@@ -20,10 +48,46 @@ void qtr8RCSetup() {
  * in progress operations
  */
 void qtr8RCLoop() {
+  // Use any calibration that's been written
+  if(qtr8RCPendingChunks == ((1 << QTR8RC_CALIBRATION_CHUNKS) - 1)) {
+    qtr8RCApplyCalibration();
+  }
+
   // If we are calibrating then update the sensors
   if(calibrating) {
     qtrrc.calibrate();
   }
+  // otherwise keep sampling, so the latest sample is always ready to send
+  else {
+    uint8_t next = qtr8RCLatest ^ 1;
+    qtr8RCSample *sample = &qtr8RCSamples[next];
+
+    sample->position = qtrrc.readLine(sample->values);
+    sample->counter = ++qtr8RCCounter;
+
+    // Publish it
+    qtr8RCLatest = next;
+  }
+}
+
+/**
+ * Replaces the calibration with the one written over i2c
+ */
+void qtr8RCApplyCalibration() {
+  // The library only allocates the calibration once it's been calibrated
+  if(!qtrrc.calibratedMinimumOn) {
+    qtrrc.calibratedMinimumOn = (unsigned int *)malloc(sizeof(unsigned int) * qtr8RCSensorCount);
+  }
+  if(!qtrrc.calibratedMaximumOn) {
+    qtrrc.calibratedMaximumOn = (unsigned int *)malloc(sizeof(unsigned int) * qtr8RCSensorCount);
+  }
+
+  // Don't let another write change it part way through
+  noInterrupts();
+  memcpy(qtrrc.calibratedMinimumOn, qtr8RCPendingCalibration[QTR8RC_CALIBRATION_MINIMUM], sizeof(unsigned int) * qtr8RCSensorCount);
+  memcpy(qtrrc.calibratedMaximumOn, qtr8RCPendingCalibration[QTR8RC_CALIBRATION_MAXIMUM], sizeof(unsigned int) * qtr8RCSensorCount);
+  qtr8RCPendingChunks = 0;
+  interrupts();
 }
 
 /**
@@ -38,6 +102,7 @@ void qtr8RCLoop() {
 int qtr8RCCalibrateStart(byte *i2cArgs, uint8_t *pi2cResponse) {
   // reset the calibration information
   qtrrc.resetCalibration();
+  qtr8RCPendingChunks = 0;
 
   calibrating = true;
   return 0;
@@ -76,8 +141,10 @@ int qtr8RCCalibrateStop(byte *i2cArgs, uint8_t *pi2cResponse) {
 
 /**
  * Process the i2c read sensor command.
- * Stops any calibration currently in progress and reads in the
- * current results from the sensor array
+ * Stops any calibration currently in progress and returns the
+ * latest complete sample, along with its counter so the master
+ * can tell if it's a new one. This is run from the i2c interrupt,
+ * so must not take long.
  *
  * @param i2cArgs Any arguments passed on i2c
  * @param pi2cResponse Filled in with the I2C response, if any
@@ -85,24 +152,92 @@ int qtr8RCCalibrateStop(byte *i2cArgs, uint8_t *pi2cResponse) {
  * @returns the number of items added to the response
  */
 int qtr8RCReadSensor(byte *i2cArgs, uint8_t *pi2cResponse) {
-  unsigned int position = qtrrc.readLine(sensorValues);
+  const qtr8RCSample *sample = &qtr8RCSamples[qtr8RCLatest];
   uint8_t i2cResponseArg = 0;
 
-  if(calibrating) {
-    qtr8RCCalibrateStop(i2cArgs, pi2cResponse);
+  // Sampling starts again on the next loop
+  calibrating = false;
 
-  }
+  // Store the counter as a 16 bit value
+  pi2cResponse[i2cResponseArg++] = highByte(sample->counter);
+  pi2cResponse[i2cResponseArg++] = lowByte(sample->counter);
 
   // Convert results to the i2c format
   for (unsigned char i = 0; i < qtr8RCSensorCount; i++) {
     // Each result is stored as a 16 bit value
-    pi2cResponse[i2cResponseArg++] = highByte(sensorValues[i]);
-    pi2cResponse[i2cResponseArg++] = lowByte(sensorValues[i]);
+    pi2cResponse[i2cResponseArg++] = highByte(sample->values[i]);
+    pi2cResponse[i2cResponseArg++] = lowByte(sample->values[i]);
   }
 
   // Store the position as a 16 bit value
-  pi2cResponse[i2cResponseArg++] = highByte(position);
-  pi2cResponse[i2cResponseArg++] = lowByte(position);
+  pi2cResponse[i2cResponseArg++] = highByte(sample->position);
+  pi2cResponse[i2cResponseArg++] = lowByte(sample->position);
 
   return i2cResponseArg;
 }
+
+/**
+ * Process the i2c read calibration command.
+ * Returns one chunk of the calibration, so it can be stored by the
+ * master and written back later. This is run from the i2c interrupt,
+ * so must not take long.
+ *
+ * @param i2cArgs The chunk to read
+ * @param pi2cResponse Filled in with the chunk, whether there is a
+ *                     calibration, and the readings if so
+ *
+ * @returns the number of items added to the response
+ */
+int qtr8RCReadCalibration(byte *i2cArgs, uint8_t *pi2cResponse) {
+  uint8_t chunk = i2cArgs[0];
+  const unsigned int *readings = NULL;
+  uint8_t i2cResponseArg = 0;
+
+  // There's nothing to send while calibrating
+  if(!calibrating) {
+    if(QTR8RC_CALIBRATION_MINIMUM == chunk) {
+      readings = qtrrc.calibratedMinimumOn;
+    }
+    else if(QTR8RC_CALIBRATION_MAXIMUM == chunk) {
+      readings = qtrrc.calibratedMaximumOn;
+    }
+  }
+
+  pi2cResponse[i2cResponseArg++] = chunk;
+  pi2cResponse[i2cResponseArg++] = (readings != NULL);
+
+  // Each reading is stored as a 16 bit value
+  for (unsigned char i = 0; i < qtr8RCSensorCount; i++) {
+    pi2cResponse[i2cResponseArg++] = readings ? highByte(readings[i]) : 0;
+    pi2cResponse[i2cResponseArg++] = readings ? lowByte(readings[i]) : 0;
+  }
+
+  return i2cResponseArg;
+}
+
+/**
+ * Process the i2c write calibration command.
+ * Stores one chunk of the calibration, which is used once every
+ * chunk has been written. This is run from the i2c interrupt,
+ * so must not take long.
+ *
+ * @param i2cArgs The chunk, followed by its 16 bit readings
+ * @param pi2cResponse Filled in with the chunk
+ *
+ * @returns the number of items added to the response
+ */
+int qtr8RCWriteCalibration(byte *i2cArgs, uint8_t *pi2cResponse) {
+  uint8_t chunk = i2cArgs[0];
+
+  if(chunk < QTR8RC_CALIBRATION_CHUNKS) {
+    for (unsigned char i = 0; i < qtr8RCSensorCount; i++) {
+      qtr8RCPendingCalibration[chunk][i] = word(i2cArgs[1 + (i * 2)], i2cArgs[2 + (i * 2)]);
+    }
+
+    qtr8RCPendingChunks |= (1 << chunk);
+  }
+
+  pi2cResponse[0] = chunk;
+
+  return 1;
+}
@@ -0,0 +1,114 @@
+
+// The encoders are read with pin change interrupts, decoding every edge of
+// both channels. The left encoder is on port C and the right on port D.
+
+// How the count changes for each transition of the two channels, indexed
+// by the previous state in the top two bits and the new state in the
+// bottom two. Transitions that skip a state are ignored.
+static const int8_t encoderSteps[16] = {
+  0, -1, 1, 0,
+  1, 0, 0, -1,
+  -1, 0, 0, 1,
+  0, 1, -1, 0
+};
+
+volatile uint8_t encoderState[2]; //<! Last state of each encoder's channels
+
+/**
+ * Reads the current state of the left encoder's channels
+ *
+ * @returns channel A in bit 0 and channel B in bit 1
+ */
+static inline uint8_t encoderLeftState() {
+  // A2 and A3 are bits 2 and 3 of port C
+  return (PINC >> 2) & 0x03;
+}
+
+/**
+ * Reads the current state of the right encoder's channels
+ *
+ * @returns channel A in bit 0 and channel B in bit 1
+ */
+static inline uint8_t encoderRightState() {
+  // Pins 3 and 5 are bits 3 and 5 of port D
+  return ((PIND >> 3) & 0x01) | ((PIND >> 4) & 0x02);
+}
+
+/**
+ * Configures the encoder pins and enables their interrupts
+ */
+void encodersSetup() {
+  pinMode(encoder1apin, INPUT_PULLUP);
+  pinMode(encoder1bpin, INPUT_PULLUP);
+  pinMode(encoder2apin, INPUT_PULLUP);
+  pinMode(encoder2bpin, INPUT_PULLUP);
+
+  encoderState[LEFT_MOTOR] = encoderLeftState();
+  encoderState[RIGHT_MOTOR] = encoderRightState();
+
+  // Interrupt on any change of the encoder pins
+  PCMSK1 |= _BV(PCINT10) | _BV(PCINT11);
+  PCMSK2 |= _BV(PCINT19) | _BV(PCINT21);
+  PCIFR = _BV(PCIF1) | _BV(PCIF2);
+  PCICR |= _BV(PCIE1) | _BV(PCIE2);
+}
+
+/**
+ * Left encoder interrupt
+ */
+ISR(PCINT1_vect) {
+  uint8_t state = encoderLeftState();
+
+  // The left motor is mounted the other way round, so
+  // turns backwards when driving forwards
+  motors[LEFT_MOTOR].encoderCount -= encoderSteps[(encoderState[LEFT_MOTOR] << 2) | state];
+  encoderState[LEFT_MOTOR] = state;
+}
+
+/**
+ * Right encoder interrupt
+ */
+ISR(PCINT2_vect) {
+  uint8_t state = encoderRightState();
+
+  motors[RIGHT_MOTOR].encoderCount += encoderSteps[(encoderState[RIGHT_MOTOR] << 2) | state];
+  encoderState[RIGHT_MOTOR] = state;
+}
+
+/**
+ * Stores a 32 bit value in the i2c response
+ *
+ * @param pi2cResponse Where to store it
+ * @param value The value
+ *
+ * @returns the number of items added to the response
+ */
+static int encodersStoreLong(uint8_t *pi2cResponse, unsigned long value) {
+  pi2cResponse[0] = (value >> 24) & 0xFF;
+  pi2cResponse[1] = (value >> 16) & 0xFF;
+  pi2cResponse[2] = (value >> 8) & 0xFF;
+  pi2cResponse[3] = value & 0xFF;
+
+  return 4;
+}
+
+/**
+ * Process the i2c read encoders command.
+ * Returns the count of both encoders and the time they were read, in
+ * microseconds. This is run from the i2c interrupt, so the encoder
+ * interrupts can't change the counts part way through.
+ *
+ * @param i2cArgs Any arguments passed on i2c
+ * @param pi2cResponse Filled in with the I2C response, if any
+ *
+ * @returns the number of items added to the response
+ */
+int encodersI2CRead(byte *i2cArgs, uint8_t *pi2cResponse) {
+  uint8_t i2cResponseArg = 0;
+
+  i2cResponseArg += encodersStoreLong(&pi2cResponse[i2cResponseArg], motors[LEFT_MOTOR].encoderCount);
+  i2cResponseArg += encodersStoreLong(&pi2cResponse[i2cResponseArg], motors[RIGHT_MOTOR].encoderCount);
+  i2cResponseArg += encodersStoreLong(&pi2cResponse[i2cResponseArg], micros());
+
+  return i2cResponseArg;
+}
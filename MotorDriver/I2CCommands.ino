@@ -2,9 +2,11 @@
 
 // List of the supported I2C commands
 enum {
+  I2C_CMD_PING = 0x10, // Ignored, so the master can check we're here
   I2C_CMD_STOP = 0x11,
-  I2C_CMD_SET_MOTORS = 0x12
-
+  I2C_CMD_SET_MOTORS = 0x12,
+  I2C_CMD_READ_ENCODERS = 0x13,
+  I2C_CMD_SET_VELOCITY = 0x14
 };
 
 // Max values for the I2C buffers
@@ -27,15 +29,19 @@ typedef struct i2cCommand {
   byte command;
   byte numberOfArgs;
   i2cCallback fnCallback;
+  bool immediate; // Run from the i2c interrupt, so the response is ready straight away
 };
 
 
 // Lookup table of all the supported commands.
-// Detailing the command number, number of arguments
-// and the function to call to proess it
+// Detailing the command number, number of arguments,
+// the function to call to proess it and whether it
+// can be run immediately
 extern const i2cCommand supportedI2Ccmd[] = {
-  { I2C_CMD_STOP, 0, motorsI2CStop},
-  { I2C_CMD_SET_MOTORS, 4, motorsI2CSet}
+  { I2C_CMD_STOP, 0, motorsI2CStop, false},
+  { I2C_CMD_SET_MOTORS, 4, motorsI2CSet, false},
+  { I2C_CMD_READ_ENCODERS, 0, encodersI2CRead, true},
+  { I2C_CMD_SET_VELOCITY, 4, velocityI2CSet, false}
 };
 
 // The i2c address we will be using
@@ -66,21 +72,30 @@ void I2CSetup() {
   Wire.onRequest(sendData);
 }
 
+/**
+ * Runs a command, preparing its response
+ *
+ * @param cmd The command to run
+ */
+void I2C_RunCommand(const i2cCommand *cmd) {
+  int extraArgs = 0;
+
+  // The first argument is always the command number
+  // so the callee can confirm its been executed
+  i2cResponseLen = 0;
+  i2cResponse[i2cResponseLen++] = cmd->command;
+
+  // Trigger the callback function
+  extraArgs = cmd->fnCallback(i2cArgs, &i2cResponse[1]);
+  i2cResponseLen += extraArgs;
+}
+
 /**
  * Checks if there is a pending i2c command to process.
  */
 void I2C_CheckCommands() {
   if(requestedCmd) {
-    int extraArgs = 0;
-
-    // The first argument is always the command number
-    // so the callee can confirm its been executed
-    i2cResponseLen = 0;
-    i2cResponse[i2cResponseLen++] = requestedCmd->command;
-
-    // Trigger the callback function
-    extraArgs = requestedCmd->fnCallback(i2cArgs, &i2cResponse[1]);
-    i2cResponseLen += extraArgs;
+    I2C_RunCommand(requestedCmd);
 
     // Clear pointer so we don't trigger it twice
     requestedCmd = NULL;
@@ -99,36 +114,36 @@ void receiveData(int howMany) {
   int availableBytes = 0;
   argsCnt = 0;
 
-  if(requestedCmd) {
-    Serial.println("Command lost!");
+  if (0 == howMany) {
+    return;
   }
 
-  if (howMany) {
-    // receive first byte - command assumed
-    cmdRcvd = Wire.read();
-
-    // Skip the 'command' byte
-    howMany--;
-
-    // Anything left to process?
-    if(howMany) {
-      while(howMany--){
-        // receive rest of transmission from master assuming arguments to the command
-        if (argIndex < I2C_MSG_ARGS_MAX){
-          argIndex++;
-          i2cArgs[argIndex] = Wire.read();
-        }
-        else{
-          ; // implement logging error: "too many arguments"
-        }
-        argsCnt = argIndex+1;
+  // receive first byte - command assumed
+  cmdRcvd = Wire.read();
+
+  // A ping is just the master checking we're still here (its heartbeat),
+  // so there's nothing to run, and any response is left to be read
+  if (I2C_CMD_PING == cmdRcvd && 1 == howMany) {
+    return;
+  }
+
+  // Skip the 'command' byte
+  howMany--;
+
+  // Anything left to process?
+  if(howMany) {
+    while(howMany--){
+      // receive rest of transmission from master assuming arguments to the command
+      if (argIndex < I2C_MSG_ARGS_MAX){
+        argIndex++;
+        i2cArgs[argIndex] = Wire.read();
+      }
+      else{
+        ; // implement logging error: "too many arguments"
       }
+      argsCnt = argIndex+1;
     }
   }
-  else{
-    // TODO: implement logging error: "empty request"
-    return;
-  }
 
   // validating command is supported by slave
   int fcnt = -1;
@@ -148,6 +163,19 @@ void receiveData(int howMany) {
     return;
   }
 
+  // Commands that just return what's already been gathered are run
+  // straight away, so the master can read the response in the same
+  // transaction (via a repeated start) without waiting
+  if(supportedI2Ccmd[fcnt].immediate) {
+    I2C_RunCommand(&supportedI2Ccmd[fcnt]);
+    return;
+  }
+
+  // Immediate commands leave any pending command alone, so it's only
+  // lost if it's replaced here before the main loop has run it
+  if(requestedCmd) {
+    Serial.println("Command lost!");
+  }
 
   // Note the selected command
   requestedCmd = &supportedI2Ccmd[fcnt];
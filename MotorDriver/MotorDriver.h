@@ -17,12 +17,28 @@
 #define inb2pin   9
 #define cs2pin    3  // Current sense
 
+// Quadrature encoders, on the pins left free by the motor shield. The
+// shield library drives it on its default pins (2, 4, 6, 7, 8, 9, 10, 12,
+// A0 and A1) rather than those above, and i2c and the serial port take
+// A4, A5, 0 and 1. 11 and 13 are kept clear as they're the ICSP header
+// and the on-board LED. Each encoder has both its channels on the same
+// port, so a single pin change interrupt sees every edge
+#define encoder1apin A2
+#define encoder1bpin A3
+
+#define encoder2apin 3
+#define encoder2bpin 5
+
 // Define a structure to hold information about the motors
 typedef struct Motor {
   int power; // Current power level of the motor from -100 to 100
   bool brake; // If true then enable the electric brake
   int current;   // Current being pulled by the motor in milli-amps
-  volatile int encoderCount; // How far this motor has turned since the count was last reset
+  volatile long encoderCount; // How far this motor has turned forwards, in encoder edges. Never reset, so wraps around
+  bool velocityControl; // If true then the power is set by the velocity control loop
+  int targetVelocity; // Velocity the control loop holds the motor at, in encoder edges per second
+  long lastCount; // Encoder count when the velocity was last measured
+  float integral; // Accumulated velocity error, in encoder edges
 };
 
-
+
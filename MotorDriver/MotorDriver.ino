@@ -23,8 +23,7 @@ void setup() {
   motorsSetup();
 
   // Configure motor encoders
-  // TODO: Currently no encoders supported
-  //encodersSetup();
+  encodersSetup();
 
   // initialize i2c
   I2CSetup();
@@ -51,6 +50,9 @@ void loop() {
     Motors(0, 0);
   }
 
+  // Keep the motors at the velocity asked for
+  velocityUpdate();
+
   // Check if there are any pending i2c commands to process
   I2C_CheckCommands();
 
@@ -64,11 +64,6 @@ void Motors(int left, int right)
     md.setM2Speed(-lmspeed);
   }
 
-  if(motors[LEFT_MOTOR].brake>0 && motors[LEFT_MOTOR].power==0) {
-    // if left brake is enabled and left speed=0 then reset left encoder counter
-    motors[LEFT_MOTOR].encoderCount=0;
-  }
-
   // Are we braking?
   if(motors[RIGHT_MOTOR].brake) {
     md.setM1Brake(200);
@@ -77,11 +72,6 @@ void Motors(int left, int right)
     md.setM1Speed(rmspeed);
   }
 
-  if(motors[RIGHT_MOTOR].brake>0 && motors[RIGHT_MOTOR].power==0) {
-    // if left brake is enabled and left speed=0 then reset left encoder counter
-    motors[RIGHT_MOTOR].encoderCount=0;
-  }
-
   Serial.print("Motors =");
   Serial.print(lmspeed);
   Serial.print(":");
@@ -92,6 +82,10 @@ void Motors(int left, int right)
  * Stops the motors and enables the brakes
  */
 void MotorsStop() {
+  // The velocity control loop would only start them again
+  motors[LEFT_MOTOR].velocityControl=false;
+  motors[RIGHT_MOTOR].velocityControl=false;
+
   // Enable brakes
   motors[LEFT_MOTOR].brake=true;
   motors[RIGHT_MOTOR].brake=true;
@@ -144,6 +138,10 @@ int motorsI2CSet(byte *i2cArgs, uint8_t *pi2cResponse) {
   }
 
   if(gotLeft && gotRight) {
+    // The power is being set directly from now on
+    motors[LEFT_MOTOR].velocityControl=false;
+    motors[RIGHT_MOTOR].velocityControl=false;
+
     Motors(left, right);
   }
 
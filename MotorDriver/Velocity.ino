@@ -0,0 +1,141 @@
+
+// Each motor's velocity is held by a control loop run at a fixed rate,
+// measuring how far its encoder has turned since the last run. The power
+// is estimated from the velocity asked for, then corrected by how far
+// off the measured velocity is, so the motors hold their speed whatever
+// the battery level, load or floor.
+
+// How often the control loop runs
+#define VELOCITY_PERIOD_MS 20
+
+// Velocity of the motors at full power, in encoder edges per second
+#define VELOCITY_FULL_SPEED 11200.0
+
+// Power added for each encoder edge per second the motor is too slow
+#define VELOCITY_KP 0.01
+
+// Power added for each encoder edge the motor has fallen behind
+#define VELOCITY_KI 0.05
+
+unsigned long lastVelocityMS = 0; //<! Time the control loop last ran
+
+/**
+ * Works out the power needed to hold a motor at its velocity
+ *
+ * @param motor The motor
+ * @param velocity How fast the motor is turning, in encoder edges per second
+ * @param elapsed How long since the velocity was last measured, in seconds
+ *
+ * @returns the power from -100 to 100
+ */
+static int velocityPower(Motor *motor, float velocity, float elapsed) {
+  float error, output;
+
+  // Nothing to hold, and nothing to carry over to the next time
+  if(0 == motor->targetVelocity || motor->brake) {
+    motor->integral = 0;
+    return 0;
+  }
+
+  error = motor->targetVelocity - velocity;
+
+  output = (motor->targetVelocity * 100.0) / VELOCITY_FULL_SPEED;
+  output += VELOCITY_KP * error;
+  output += VELOCITY_KI * (motor->integral + (error * elapsed));
+
+  // Only accumulate the error while it can still be corrected, so it
+  // doesn't build up while the motor is at full power
+  if(output > -100 && output < 100) {
+    motor->integral += error * elapsed;
+  }
+
+  return constrain((int)output, -100, 100);
+}
+
+/**
+ * Runs the velocity control loop, if it's due
+ */
+void velocityUpdate() {
+  unsigned long now = millis();
+  unsigned long elapsedMS = now - lastVelocityMS;
+  int power[2];
+  bool changed = false;
+
+  if(elapsedMS < VELOCITY_PERIOD_MS) {
+    return;
+  }
+  lastVelocityMS = now;
+
+  for(int i = 0; i < 2; i++) {
+    long count, moved;
+
+    // The count is updated by the encoder interrupts
+    noInterrupts();
+    count = motors[i].encoderCount;
+    interrupts();
+
+    // Always keep track of the count, so the first velocity measured
+    // once the loop is in control is right
+    moved = count - motors[i].lastCount;
+    motors[i].lastCount = count;
+
+    if(motors[i].velocityControl) {
+      // An overload brakes the motors until they're told what to do
+      // again, but the loop is still in control so takes them back once
+      // they've cooled down, starting afresh
+      if(motors[i].brake && (now - lastOverloadMS) >= OVERLOAD_COOLDOWN_MS) {
+        motors[i].brake = false;
+        motors[i].integral = 0;
+      }
+
+      power[i] = velocityPower(&motors[i], (moved * 1000.0) / elapsedMS, elapsedMS / 1000.0);
+
+      // Only update the motors if the power has changed
+      if(power[i] != motors[i].power) {
+        changed = true;
+      }
+    }
+    else {
+      power[i] = motors[i].power;
+    }
+  }
+
+  if(changed) {
+    Motors(power[LEFT_MOTOR], power[RIGHT_MOTOR]);
+  }
+}
+
+/**
+ * Process the i2c set velocity command
+ *
+ * Takes in the two integers that contain the velocity of the left and
+ * right motors, in encoder edges per second, which the control loop
+ * then holds them at
+ *
+ * @param i2cArgs Any arguments passed on i2c
+ * @param pi2cResponse Filled in with the I2C response, if any
+ *
+ * @returns the number of items added to the response
+ */
+int velocityI2CSet(byte *i2cArgs, uint8_t *pi2cResponse) {
+  int velocity[2];
+
+  // read integers from I2C buffer
+  velocity[LEFT_MOTOR]=(i2cArgs[0] * 256) + i2cArgs[1];
+  velocity[RIGHT_MOTOR]=(i2cArgs[2] * 256) + i2cArgs[3];
+
+  for(int i = 0; i < 2; i++) {
+    // Start afresh if the loop wasn't in control, or the motor is
+    // changing direction
+    if(!motors[i].velocityControl ||
+       (velocity[i] < 0) != (motors[i].targetVelocity < 0)) {
+      motors[i].integral = 0;
+    }
+
+    motors[i].targetVelocity = velocity[i];
+    motors[i].velocityControl = true;
+    motors[i].brake = false;
+  }
+
+  return 0;
+}
@@ -0,0 +1,174 @@
+// Tests the i2c-dev transport against a fake in-process device, checking
+// the I2C_RDWR messages it builds, and that messages joined by repeated
+// starts are sent together as a single combined transfer.
+//
+// Build using 'g++ -std=c++11 -I../src/PiWars -o I2CTransportDevTest I2CTransportDevTest.cpp ../src/PiWars/I2CTransportDev.cpp ../src/PiWars/I2CTransaction.cpp'
+// Run using './I2CTransportDevTest'
+// Note: No I2C hardware is needed
+//
+#include <iostream>
+#include <vector>
+#include <linux/i2c.h>
+
+#include "I2CTransportDev.h"
+
+using namespace PiWars;
+
+#define FAKE_ADDRESS (0x29) // Address of the fake device
+
+// A register based device, where the first byte written selects the
+// register, any further bytes are written from there, and reads carry
+// on from the selected register
+class FakeDevice : public I2CTransportDev {
+  public:
+    // A copy of a single message, as passed to I2C_RDWR
+    struct Message {
+      uint16_t addr;
+      uint16_t flags;
+      std::vector<uint8_t> bytes;
+    };
+
+    FakeDevice() : I2CTransportDev(), _register(0) {
+      for(int i = 0; i < 256; i++) {
+        _registers[i] = i;
+      }
+    }
+
+    std::vector<std::vector<Message> > transfers; // Every transfer, in the order they were sent
+
+  protected:
+    bool transfer(struct i2c_msg *messages, size_t count) {
+      std::vector<Message> sent;
+
+      for(size_t i = 0; i < count; i++) {
+        Message message;
+
+        message.addr = messages[i].addr;
+        message.flags = messages[i].flags;
+
+        // Nothing else is on the bus, so the transfer is NAKed
+        if(FAKE_ADDRESS != messages[i].addr) {
+          return false;
+        }
+
+        if(messages[i].flags & I2C_M_RD) {
+          for(size_t j = 0; j < messages[i].len; j++) {
+            messages[i].buf[j] = _registers[_register++];
+          }
+        }
+        else {
+          for(size_t j = 0; j < messages[i].len; j++) {
+            if(0 == j) {
+              _register = messages[i].buf[j];
+            }
+            else {
+              _registers[_register++] = messages[i].buf[j];
+            }
+          }
+        }
+
+        message.bytes.assign(messages[i].buf, messages[i].buf + messages[i].len);
+        sent.push_back(message);
+      }
+
+      transfers.push_back(sent);
+
+      return true;
+    }
+
+  private:
+    uint8_t _registers[256];
+    uint8_t _register;
+};
+
+static int failures = 0;
+
+static void check(bool passed, const char *test) {
+  std::cout << (passed ? "PASS: " : "FAIL: ") << test << std::endl;
+
+  if(!passed) {
+    failures++;
+  }
+}
+
+// A write and read joined by a repeated start are one transfer
+static void testWriteRead() {
+  FakeDevice device;
+  I2CTransaction transaction;
+  const char reg = 0x10;
+  char buffer[3];
+
+  transaction.writeRead(&reg, 1, buffer, sizeof(buffer));
+
+  check(device.execute(FAKE_ADDRESS, transaction), "writeRead executes");
+  check(1 == device.transfers.size(), "writeRead is a single transfer");
+  check(2 == device.transfers[0].size(), "writeRead transfer has both messages");
+  check(0 == device.transfers[0][0].flags && 1 == device.transfers[0][0].bytes.size() &&
+        0x10 == device.transfers[0][0].bytes[0], "writeRead writes the register first");
+  check(I2C_M_RD == device.transfers[0][1].flags && 3 == device.transfers[0][1].bytes.size(), "writeRead then reads");
+  check(FAKE_ADDRESS == device.transfers[0][0].addr && FAKE_ADDRESS == device.transfers[0][1].addr, "writeRead messages are addressed");
+  check(0x10 == buffer[0] && 0x11 == buffer[1] && 0x12 == buffer[2], "writeRead reads the registers back");
+}
+
+// Messages separated by a stop are separate transfers
+static void testStops() {
+  FakeDevice device;
+  I2CTransaction transaction;
+  const char data[] = { 0x20, 0x01, 0x02, 0x03 };
+  const char reg = 0x20;
+  char buffer[3];
+
+  transaction.write(data, sizeof(data));
+  transaction.write(&reg, 1);
+  transaction.read(buffer, sizeof(buffer));
+
+  check(device.execute(FAKE_ADDRESS, transaction), "stopped messages execute");
+  check(3 == device.transfers.size(), "each stopped message is its own transfer");
+  check(1 == device.transfers[0].size() && 1 == device.transfers[1].size() && 1 == device.transfers[2].size(),
+        "each stopped transfer has a single message");
+  check(0x01 == buffer[0] && 0x02 == buffer[1] && 0x03 == buffer[2], "stopped messages read back what was written");
+}
+
+// Groups are kept together, whatever comes before or after them
+static void testGroups() {
+  FakeDevice device;
+  I2CTransaction transaction;
+  const char data[] = { 0x30, 0x0A, 0x0B };
+  const char first = 0x30, second = 0x31;
+  char buffer1[1], buffer2[2];
+
+  transaction.write(data, sizeof(data));
+  transaction.writeRead(&first, 1, buffer1, sizeof(buffer1));
+  transaction.writeRead(&second, 1, buffer2, sizeof(buffer2));
+
+  check(device.execute(FAKE_ADDRESS, transaction), "grouped messages execute");
+  check(3 == device.transfers.size(), "each group is its own transfer");
+  check(1 == device.transfers[0].size() && 2 == device.transfers[1].size() && 2 == device.transfers[2].size(),
+        "groups aren't split or merged");
+  check(0x0A == buffer1[0] && 0x0B == buffer2[0] && 0x32 == buffer2[1], "grouped messages read back the right registers");
+}
+
+// A failed transfer stops the rest of the transaction being sent
+static void testFailure() {
+  FakeDevice device;
+  I2CTransaction transaction;
+  const char reg = 0x10;
+  char buffer[1];
+
+  transaction.writeRead(&reg, 1, buffer, sizeof(buffer));
+  transaction.writeRead(&reg, 1, buffer, sizeof(buffer));
+
+  check(!device.execute(FAKE_ADDRESS + 1, transaction), "missing device fails");
+  check(device.transfers.empty(), "nothing more is sent after a failure");
+}
+
+int main(int argc, char **argv) {
+  testWriteRead();
+  testStops();
+  testGroups();
+  testFailure();
+
+  std::cout << (failures ? "Failed" : "Passed") << std::endl;
+
+  return failures ? 1 : 0;
+}
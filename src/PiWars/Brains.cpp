@@ -130,12 +130,14 @@ bool Brains::enableThoughtProcess(ThoughtProcess::ptr process) {
 
 void Brains::stopCurrentThoughtProcess() {
   if(_currentProcess) {
-    // Tell it to stop
+    // Tell it to stop, waking it if it's waiting on its sensors
     _currentProcessRunning = false;
+    _currentProcess->stop();
 
     // Wait for the running thread to stop
     _currentProcessThread->join();
     _currentProcessThread = nullptr;
+    _currentProcess->clearStop();
         
     // and then clear it
     _currentProcess.reset();
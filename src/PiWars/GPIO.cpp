@@ -0,0 +1,109 @@
+/**
+ * The GPIO class provides access to the Raspberry Pi's GPIO pins, so
+ * sensors can be told when a reading is ready by an interrupt line rather
+ * than having to poll for it. As with the I2C buses, the pins can be
+ * driven by pigpiod or simulated.
+ *
+ * The GPIOInterrupt class turns the edges seen on a pin into an eventfd,
+ * so they can be waited for along with everything else.
+ */
+
+#include "GPIO.h"
+#include "GPIOPigpiod.h"
+#include "GPIOSimulator.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "string.h"
+
+namespace PiWars
+{
+
+// The pins shared by all the sensors
+static std::once_flag initInstanceFlag;
+static GPIO *gpioInstance = nullptr;
+static GPIOSimulator *gpioSimulator = nullptr;
+
+GPIO *GPIO::instance() {
+  std::call_once(initInstanceFlag, initInstance);
+
+  return gpioInstance;
+}
+
+GPIOSimulator *GPIO::simulator() {
+  std::call_once(initInstanceFlag, initInstance);
+
+  return gpioSimulator;
+}
+
+void GPIO::initInstance() {
+  const char *selected = getenv("PIWARS_I2C");
+
+  if(selected && 0 == strcmp(selected, "simulated")) {
+    gpioSimulator = new GPIOSimulator();
+    gpioInstance = gpioSimulator;
+  }
+  else {
+    gpioInstance = new GPIOPigpiod();
+  }
+}
+
+GPIOInterrupt::GPIOInterrupt(unsigned pin, GPIOEdge edge, GPIO *gpio)
+  : _pin(pin)
+  , _edge(edge)
+  , _gpio(gpio)
+  , _id(-1)
+  , _fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+  , _latest(0)
+{
+}
+
+GPIOInterrupt::~GPIOInterrupt() {
+  stop();
+  close(_fd);
+}
+
+bool GPIOInterrupt::start() {
+  if(-1 == _id) {
+    _id = _gpio->watch(_pin, _edge, fired, this);
+
+    if(-1 == _id) {
+      std::cerr << __func__ << ": Failed to watch GPIO " << _pin << std::endl;
+    }
+  }
+
+  return (-1 != _id);
+}
+
+void GPIOInterrupt::stop() {
+  if(-1 != _id) {
+    _gpio->cancel(_id);
+    _id = -1;
+  }
+}
+
+uint64_t GPIOInterrupt::acknowledge(clock::time_point &latest) {
+  uint64_t count = 0;
+
+  if(sizeof(count) != ::read(_fd, &count, sizeof(count))) {
+    count = 0;
+  }
+
+  latest = clock::time_point(clock::duration(_latest.load()));
+
+  return count;
+}
+
+void GPIOInterrupt::fired(void *user, bool level) {
+  GPIOInterrupt *interrupt = (GPIOInterrupt *)user;
+  uint64_t value = 1;
+
+  // Note when it fired before waking anyone, so they see the right time
+  interrupt->_latest = clock::now().time_since_epoch().count();
+  write(interrupt->_fd, &value, sizeof(value));
+}
+
+}
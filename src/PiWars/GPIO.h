@@ -0,0 +1,151 @@
+/**
+ * The GPIO class provides access to the Raspberry Pi's GPIO pins, so
+ * sensors can be told when a reading is ready by an interrupt line rather
+ * than having to poll for it. As with the I2C buses, the pins can be
+ * driven by pigpiod or simulated.
+ *
+ * The GPIOInterrupt class turns the edges seen on a pin into an eventfd,
+ * so they can be waited for along with everything else.
+ */
+
+#ifndef _PIWARS_GPIO_H
+#define _PIWARS_GPIO_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+namespace PiWars {
+
+  class GPIOSimulator;
+
+  // The edges of a signal that can be watched for
+  enum class GPIOEdge {
+    RISING, //<! Low to high
+    FALLING, //<! High to low
+    EITHER //<! Either of the above
+  };
+
+  class GPIO {
+    public:
+      // Called each time a watched for edge is seen
+      //
+      // @param user The pointer given when the pin was watched
+      // @param level The level of the pin after the edge
+      typedef void (*Callback)(void *user, bool level);
+
+      virtual ~GPIO() {}
+
+      // Reads the level of an input pin
+      //
+      // @param pin The GPIO pin (Broadcom numbering)
+      // @param level Filled in with the level
+      //
+      // @returns true if the pin was read
+      virtual bool read(unsigned pin, bool &level) = 0;
+
+      // Makes a pin an output, and drives it
+      //
+      // @param pin The GPIO pin (Broadcom numbering)
+      // @param level The level to drive the pin to
+      //
+      // @returns true if the pin was driven
+      virtual bool write(unsigned pin, bool level) = 0;
+
+      // Times how long RC circuits (e.g. the QTR-8RC's reflectance sensors)
+      // take to discharge. Each pin is driven high to charge its capacitor,
+      // then made an input, and the time taken for it to read low measured.
+      //
+      // @param pins The GPIO pins (Broadcom numbering)
+      // @param count The number of pins
+      // @param charge How long to charge the capacitors for
+      // @param timeout The longest to wait for them to discharge
+      // @param times Filled in with how long each pin took to discharge in
+      //              us, or the timeout if it didn't
+      //
+      // @returns true if the pins were timed
+      virtual bool timeDischarge(const unsigned *pins, size_t count, std::chrono::microseconds charge, std::chrono::microseconds timeout, uint32_t *times) = 0;
+
+      // Makes a pin an input, pulled up, and starts watching it for an
+      // edge. The callback is called from a thread belonging to the GPIO,
+      // so must not block.
+      //
+      // @param pin The GPIO pin (Broadcom numbering)
+      // @param edge The edge to watch for
+      // @param callback Called each time the edge is seen
+      // @param user Passed to the callback
+      //
+      // @returns An id to cancel the watch with, or -1 on failure
+      virtual int watch(unsigned pin, GPIOEdge edge, Callback callback, void *user) = 0;
+
+      // Stops watching a pin. Once this returns the callback won't be
+      // called for any new edges.
+      //
+      // @param id The id returned by watch()
+      virtual void cancel(int id) = 0;
+
+      // Returns the GPIO pins of the robot, creating them if needed. The
+      // pins are driven by pigpiod, unless the PIWARS_I2C environment
+      // variable is set to 'simulated' in which case they're simulated
+      // along with the I2C devices.
+      //
+      // @returns The GPIO pins
+      static GPIO *instance();
+
+      // Returns the simulated GPIO pins, so simulated devices can drive
+      // their interrupt lines
+      //
+      // @returns The simulated pins, or nullptr if the pins aren't simulated
+      static GPIOSimulator *simulator();
+
+    private:
+      static void initInstance(); //!< Creates the GPIO pins
+  };
+
+  class GPIOInterrupt {
+    public:
+      typedef std::chrono::steady_clock clock;
+
+      // Prepares to watch a pin for the edges signalling an interrupt
+      //
+      // @param pin The GPIO pin (Broadcom numbering)
+      // @param edge The edge that signals the interrupt
+      // @param gpio The GPIO pins the pin belongs to
+      GPIOInterrupt(unsigned pin, GPIOEdge edge, GPIO *gpio = GPIO::instance());
+      ~GPIOInterrupt();
+
+      // Starts watching for the interrupt
+      //
+      // @returns true if the pin is being watched
+      bool start();
+
+      // Stops watching for the interrupt
+      void stop();
+
+      // Returns the FD that becomes readable when the interrupt fires
+      //
+      // @returns The File descriptor a thread can block on
+      int getFD() { return _fd; }
+
+      // Clears the FD, ready for the next interrupt
+      //
+      // @param latest Filled in with when the latest interrupt fired
+      //
+      // @returns The number of interrupts since the last call
+      uint64_t acknowledge(clock::time_point &latest);
+
+    private:
+      static void fired(void *user, bool level); //<! Called by the GPIO on each edge
+
+      unsigned _pin; //<! The pin being watched
+      GPIOEdge _edge; //<! The edge being watched for
+      GPIO *_gpio; //<! The GPIO pins the pin belongs to
+      int _id; //<! Identifies the watch, or -1 when not watching
+      int _fd; //<! eventfd counting the interrupts
+      std::atomic<clock::rep> _latest; //<! When the latest interrupt fired
+  };
+
+}
+
+#endif
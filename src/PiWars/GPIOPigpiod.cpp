@@ -0,0 +1,234 @@
+/**
+ * Provides access to the GPIO pins via the pigpio daemon. Edges are
+ * reported by pigpiod's callbacks, which are called from the thread the
+ * pigpiod_if library uses to receive notifications.
+ *
+ * Discharge times are measured from the level changes pigpiod writes to
+ * a notification pipe, as these are timestamped by the daemon itself so
+ * aren't skewed by how long the reports take to reach us.
+ */
+
+#include "GPIOPigpiod.h"
+#include "I2C.h"
+
+// The pigpiod_if header file doesn't protect itself when included from
+// C++, so force it to be treated as 'C' here.
+extern "C" {
+#include "pigpiod_if.h"
+}
+
+#include <fcntl.h>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+
+namespace PiWars
+{
+
+GPIOPigpiod::GPIOPigpiod() : _notifyHandle(-1), _notifyFD(-1) {
+  // The connection is shared with the I2C buses
+  I2C::startPIGPIOD();
+}
+
+GPIOPigpiod::~GPIOPigpiod() {
+  std::unique_lock<std::mutex> lock(_mutex);
+
+  for(auto &watch : _watches) {
+    callback_cancel(watch.first);
+    delete watch.second;
+  }
+
+  for(auto watch : _cancelled) {
+    delete watch;
+  }
+
+  if(-1 != _notifyFD) {
+    close(_notifyFD);
+  }
+  if(-1 != _notifyHandle) {
+    notify_close(_notifyHandle);
+  }
+}
+
+bool GPIOPigpiod::read(unsigned pin, bool &level) {
+  int result = gpio_read(pin);
+
+  if(result < 0) {
+    return false;
+  }
+
+  level = (0 != result);
+  return true;
+}
+
+bool GPIOPigpiod::write(unsigned pin, bool level) {
+  return (0 == set_mode(pin, PI_OUTPUT) && 0 == gpio_write(pin, level ? 1 : 0));
+}
+
+bool GPIOPigpiod::timeDischarge(const unsigned *pins, size_t count, std::chrono::microseconds charge, std::chrono::microseconds timeout, uint32_t *times) {
+  std::unique_lock<std::mutex> lock(_notifyMutex);
+  std::vector<uint32_t> started(count);
+  std::vector<bool> discharged(count, false);
+  uint32_t bits = 0;
+  gpioReport_t report;
+
+  if(!openNotify()) {
+    return false;
+  }
+
+  // Throw away anything left over from last time
+  while(sizeof(report) == ::read(_notifyFD, &report, sizeof(report))) {
+  }
+
+  // Charge the capacitors
+  for(size_t i = 0; i < count; i++) {
+    write(pins[i], true);
+    bits |= (1 << pins[i]);
+    times[i] = timeout.count();
+  }
+
+  std::this_thread::sleep_for(charge);
+
+  if(0 != notify_begin(_notifyHandle, bits)) {
+    std::cerr << __func__ << ": Failed to begin notifications" << std::endl;
+    return false;
+  }
+
+  // and let them discharge. Each pin is switched by a separate request to
+  // pigpiod, so note when each one started
+  for(size_t i = 0; i < count; i++) {
+    started[i] = get_current_tick();
+    set_mode(pins[i], PI_INPUT);
+  }
+
+  std::this_thread::sleep_for(timeout);
+  notify_pause(_notifyHandle);
+
+  // Find when each pin first went low
+  while(sizeof(report) == ::read(_notifyFD, &report, sizeof(report))) {
+    // Not interested in keep alives or watchdogs
+    if(report.flags) {
+      continue;
+    }
+
+    for(size_t i = 0; i < count; i++) {
+      bool low = (0 == (report.level & (1 << pins[i])));
+      uint32_t elapsed = report.tick - started[i];
+
+      // Ignore anything from before the pin was released
+      if(elapsed > (uint32_t)timeout.count()) {
+        continue;
+      }
+
+      if(!discharged[i] && low) {
+        times[i] = elapsed;
+        discharged[i] = true;
+      }
+      // A spurious low, so wait for it to go low again
+      else if(discharged[i] && !low) {
+        times[i] = timeout.count();
+        discharged[i] = false;
+      }
+    }
+  }
+
+  return true;
+}
+
+bool GPIOPigpiod::openNotify() {
+  if(-1 != _notifyFD) {
+    return true;
+  }
+
+  _notifyHandle = notify_open();
+  if(_notifyHandle < 0) {
+    std::cerr << __func__ << ": Failed to open notification pipe" << std::endl;
+    _notifyHandle = -1;
+    return false;
+  }
+
+  std::ostringstream path;
+  path << "/dev/pigpio" << _notifyHandle;
+
+  _notifyFD = open(path.str().c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if(-1 == _notifyFD) {
+    std::cerr << __func__ << ": Failed to open " << path.str() << std::endl;
+    notify_close(_notifyHandle);
+    _notifyHandle = -1;
+    return false;
+  }
+
+  return true;
+}
+
+int GPIOPigpiod::watch(unsigned pin, GPIOEdge edge, Callback callback, void *user) {
+  unsigned pigpioEdge;
+
+  switch(edge) {
+    case GPIOEdge::RISING:
+      pigpioEdge = RISING_EDGE;
+      break;
+
+    case GPIOEdge::FALLING:
+      pigpioEdge = FALLING_EDGE;
+      break;
+
+    default:
+      pigpioEdge = EITHER_EDGE;
+      break;
+  }
+
+  // Interrupt lines are usually open drain, so need pulling up
+  if(0 != set_mode(pin, PI_INPUT) || 0 != set_pull_up_down(pin, PI_PUD_UP)) {
+    std::cerr << __func__ << ": Failed to configure GPIO " << pin << std::endl;
+    return -1;
+  }
+
+  Watch *watch = new Watch;
+
+  watch->callback = callback;
+  watch->user = user;
+  watch->active = true;
+
+  std::unique_lock<std::mutex> lock(_mutex);
+  int id = callback_ex(pin, pigpioEdge, reported, watch);
+
+  if(id < 0) {
+    std::cerr << __func__ << ": Failed to watch GPIO " << pin << std::endl;
+    delete watch;
+    return -1;
+  }
+
+  _watches[id] = watch;
+
+  return id;
+}
+
+void GPIOPigpiod::cancel(int id) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  auto found = _watches.find(id);
+
+  if(found != _watches.end()) {
+    callback_cancel(id);
+
+    // pigpiod_if may already be part way through reporting an edge, so
+    // keep the watch around but stop passing edges on
+    found->second->active = false;
+    _cancelled.push_back(found->second);
+    _watches.erase(found);
+  }
+}
+
+void GPIOPigpiod::reported(unsigned pin, unsigned level, uint32_t tick, void *user) {
+  Watch *watch = (Watch *)user;
+
+  // Ignore watchdog timeouts, only real edges are wanted
+  if(!watch->active || PI_TIMEOUT == level) {
+    return;
+  }
+
+  watch->callback(watch->user, 0 != level);
+}
+
+}
@@ -0,0 +1,62 @@
+/**
+ * Provides access to the GPIO pins via the pigpio daemon. Edges are
+ * reported by pigpiod's callbacks, which are called from the thread the
+ * pigpiod_if library uses to receive notifications.
+ *
+ * Discharge times are measured from the level changes pigpiod writes to
+ * a notification pipe, as these are timestamped by the daemon itself so
+ * aren't skewed by how long the reports take to reach us.
+ */
+
+#ifndef _PIWARS_GPIOPIGPIOD_H
+#define _PIWARS_GPIOPIGPIOD_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "GPIO.h"
+
+namespace PiWars {
+
+  class GPIOPigpiod : public GPIO {
+    public:
+      // Connects to the pigpio daemon, if not already connected
+      GPIOPigpiod();
+      ~GPIOPigpiod();
+
+      // Implementation of the GPIO APIs
+      bool read(unsigned pin, bool &level);
+      bool write(unsigned pin, bool level);
+      bool timeDischarge(const unsigned *pins, size_t count, std::chrono::microseconds charge, std::chrono::microseconds timeout, uint32_t *times);
+      int watch(unsigned pin, GPIOEdge edge, Callback callback, void *user);
+      void cancel(int id);
+
+    private:
+      // A pin being watched
+      struct Watch {
+        Callback callback; //<! Called each time the edge is seen
+        void *user; //<! Passed to the callback
+        std::atomic<bool> active; //<! Cleared once the watch is cancelled
+      };
+
+      bool openNotify(); //<! Opens the notification pipe, if not already open
+
+      // Passes the edges reported by pigpiod on to the watch
+      static void reported(unsigned pin, unsigned level, uint32_t tick, void *user);
+
+      std::map<int, Watch *> _watches; //<! The pins being watched, by pigpiod callback id
+      std::vector<Watch *> _cancelled; //<! Watches pigpiod may still be reporting to
+      std::mutex _mutex; //<! Protects the watches
+
+      int _notifyHandle; //<! pigpiod's handle for the notification pipe, or -1
+      int _notifyFD; //<! The notification pipe, or -1
+      std::mutex _notifyMutex; //<! Only one set of pins can be timed at a time
+  };
+
+}
+
+#endif
@@ -0,0 +1,96 @@
+/**
+ * The GPIOSimulator simulates the GPIO pins, so the interrupt lines of
+ * simulated devices can be driven without any hardware. Every pin is
+ * pulled up until a simulated device drives it.
+ */
+
+#include "GPIOSimulator.h"
+
+#include <algorithm>
+#include <thread>
+
+namespace PiWars
+{
+
+// How long an RC circuit takes to discharge if not told otherwise. This
+// is about what a QTR-8RC sensor over a white surface takes.
+static const std::chrono::microseconds defaultDischarge(200);
+
+GPIOSimulator::GPIOSimulator() : _nextId(0) {
+}
+
+GPIOSimulator::~GPIOSimulator() {
+}
+
+bool GPIOSimulator::read(unsigned pin, bool &level) {
+  std::unique_lock<std::recursive_mutex> lock(_mutex);
+  auto found = _levels.find(pin);
+
+  level = (found == _levels.end()) ? true : found->second;
+  return true;
+}
+
+bool GPIOSimulator::write(unsigned pin, bool level) {
+  set(pin, level);
+  return true;
+}
+
+bool GPIOSimulator::timeDischarge(const unsigned *pins, size_t count, std::chrono::microseconds charge, std::chrono::microseconds timeout, uint32_t *times) {
+  // Take as long as the real thing would
+  std::this_thread::sleep_for(charge + timeout);
+
+  std::unique_lock<std::recursive_mutex> lock(_mutex);
+
+  for(size_t i = 0; i < count; i++) {
+    auto found = _discharges.find(pins[i]);
+    std::chrono::microseconds time = (found == _discharges.end()) ? defaultDischarge : found->second;
+
+    times[i] = std::min(time, timeout).count();
+  }
+
+  return true;
+}
+
+void GPIOSimulator::setDischarge(unsigned pin, std::chrono::microseconds time) {
+  std::unique_lock<std::recursive_mutex> lock(_mutex);
+
+  _discharges[pin] = time;
+}
+
+int GPIOSimulator::watch(unsigned pin, GPIOEdge edge, Callback callback, void *user) {
+  std::unique_lock<std::recursive_mutex> lock(_mutex);
+  int id = _nextId++;
+
+  _watches[id] = Watch { pin, edge, callback, user };
+
+  return id;
+}
+
+void GPIOSimulator::cancel(int id) {
+  // Waits for any callback in progress, as the lock is held while calling back
+  std::unique_lock<std::recursive_mutex> lock(_mutex);
+
+  _watches.erase(id);
+}
+
+void GPIOSimulator::set(unsigned pin, bool level) {
+  std::unique_lock<std::recursive_mutex> lock(_mutex);
+  bool previous;
+
+  read(pin, previous);
+  _levels[pin] = level;
+
+  // Nothing to report if the level hasn't changed
+  if(previous == level) {
+    return;
+  }
+
+  for(auto &watch : _watches) {
+    if(watch.second.pin == pin &&
+       (GPIOEdge::EITHER == watch.second.edge || (level ? GPIOEdge::RISING : GPIOEdge::FALLING) == watch.second.edge)) {
+      watch.second.callback(watch.second.user, level);
+    }
+  }
+}
+
+}
@@ -0,0 +1,63 @@
+/**
+ * The GPIOSimulator simulates the GPIO pins, so the interrupt lines of
+ * simulated devices can be driven without any hardware. Every pin is
+ * pulled up until a simulated device drives it.
+ */
+
+#ifndef _PIWARS_GPIOSIMULATOR_H
+#define _PIWARS_GPIOSIMULATOR_H
+
+#include <cstdint>
+#include <cstddef>
+#include <map>
+#include <mutex>
+
+#include "GPIO.h"
+
+namespace PiWars {
+
+  class GPIOSimulator : public GPIO {
+    public:
+      GPIOSimulator();
+      ~GPIOSimulator();
+
+      // Implementation of the GPIO APIs
+      bool read(unsigned pin, bool &level);
+      bool write(unsigned pin, bool level);
+      bool timeDischarge(const unsigned *pins, size_t count, std::chrono::microseconds charge, std::chrono::microseconds timeout, uint32_t *times);
+      int watch(unsigned pin, GPIOEdge edge, Callback callback, void *user);
+      void cancel(int id);
+
+      // Drives a pin, as a device connected to it would. Any watches for
+      // the resulting edge are called before this returns.
+      //
+      // @param pin The GPIO pin (Broadcom numbering)
+      // @param level The level to drive the pin to
+      void set(unsigned pin, bool level);
+
+      // Sets how long the RC circuit on a pin takes to discharge, e.g. to
+      // simulate a QTR-8RC sensor being over a white or black surface
+      //
+      // @param pin The GPIO pin (Broadcom numbering)
+      // @param time The discharge time
+      void setDischarge(unsigned pin, std::chrono::microseconds time);
+
+    private:
+      // A pin being watched
+      struct Watch {
+        unsigned pin; //<! The pin being watched
+        GPIOEdge edge; //<! The edge to watch for
+        Callback callback; //<! Called each time the edge is seen
+        void *user; //<! Passed to the callback
+      };
+
+      std::map<unsigned, bool> _levels; //<! The levels of the pins that have been driven
+      std::map<unsigned, std::chrono::microseconds> _discharges; //<! How long each pin's RC circuit takes to discharge
+      std::map<int, Watch> _watches; //<! The pins being watched
+      int _nextId; //<! The id to give the next watch
+      std::recursive_mutex _mutex; //<! Protects the pins, held while calling back
+  };
+
+}
+
+#endif
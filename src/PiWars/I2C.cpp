@@ -6,6 +6,13 @@
  */
 
 #include "I2C.h"
+#include "I2CTransportBitBang.h"
+#include "I2CTransportPigpiod.h"
+#include "I2CTransportDev.h"
+#include "I2CTransportReplay.h"
+#include "I2CSimulator.h"
+#include "SimulatedDevices.h"
+#include <cstdlib>
 #include <mutex>
 
 // The pigpiod_if header file doesn't protect itself when included from
@@ -25,182 +32,332 @@ namespace PiWars
 const static uint32_t SDL_PIN = 5;
 const static uint32_t SDA_PIN = 6;
 
+// The GPIO pin the simulated VL6180 drives its GPIO1 interrupt line on,
+// wired as on the robot
+const static unsigned SIMULATED_VL6180_INTERRUPT_PIN = 4;
 
-std::once_flag initPIGPIODFlag;
-  
-I2C::I2C(uint8_t i2cAddress) : _i2cAddress(i2cAddress) {
-  // We need to initialise pigpiod once, regardless of how many 
-  // i2c connections we establish
-  std::call_once(initPIGPIODFlag, initPIGPIOD);
+// The clock speed the 'External' I2C bus starts at
+const static uint32_t EXTERNAL_BAUD = I2C::STANDARD_MODE_BAUD;
+
+// The simulated Arduinos can't keep up beyond this, giving the
+// adaptive clocks a limit to find
+const static uint32_t SIMULATED_ARDUINO_MAX_BAUD = 300000;
+
+// The 'Internal' I2C bus
+const static uint32_t INTERNAL_BUS = 1;
+
+// How often devices are probed if nothing else has been sent to them
+const static std::chrono::milliseconds HEARTBEAT_INTERVAL(1000);
+
+static std::once_flag initPIGPIODFlag;
+
+// The buses shared by all the devices
+static std::once_flag initInternalBusFlag;
+static std::once_flag initExternalBusFlag;
+static I2CBus *internalBus = nullptr;
+static I2CBus *externalBus = nullptr;
+
+// How the internal bus should be accessed
+static I2CInternal::Transport internalTransportType = I2CInternal::Transport::PIGPIOD;
+static bool internalTransportSelected = false;
+
+// Any transports explicitly provided for the buses
+static I2CTransport *internalTransport = nullptr;
+static I2CTransport *externalTransport = nullptr;
+
+// How the buses are identified in traces
+const static uint8_t TRACE_EXTERNAL_BUS = 0;
+const static uint8_t TRACE_INTERNAL_BUS = 1;
+
+// Records the transactions on both buses, if enabled
+static std::once_flag initTraceFlag;
+static I2CTraceRecorder *traceRecorder = nullptr;
+
+// Creates the trace recorder if the PIWARS_I2C_TRACE environment variable
+// names a file to record to
+static void initTrace() {
+  const char *path = getenv("PIWARS_I2C_TRACE");
+
+  if(path) {
+    traceRecorder = new I2CTraceRecorder();
+
+    if(!traceRecorder->spill(path)) {
+      delete traceRecorder;
+      traceRecorder = nullptr;
+    }
+  }
+}
+
+// Returns the trace file to replay, if the PIWARS_I2C_REPLAY environment
+// variable names one
+static const char *replay() {
+  return getenv("PIWARS_I2C_REPLAY");
+}
+
+// Checks if the buses should be simulated, rather than using real hardware
+static bool simulated() {
+  const char *selected = getenv("PIWARS_I2C");
+
+  return (selected && 0 == strcmp(selected, "simulated"));
+}
+
+// Stops the buses, ensuring nothing is accessing them when the program exits.
+// If the PIWARS_I2C_STATS environment variable is set the statistics and
+// clock speeds of each bus are reported first.
+static void finalizeBuses() {
+  if(getenv("PIWARS_I2C_STATS")) {
+    if(internalBus) {
+      internalBus->stats().dump(std::cerr, internalBus->name());
+      internalBus->clocks().dump(std::cerr, internalBus->name());
+    }
+    if(externalBus) {
+      externalBus->stats().dump(std::cerr, externalBus->name());
+      externalBus->clocks().dump(std::cerr, externalBus->name());
+    }
+  }
+
+  delete internalBus;
+  internalBus = nullptr;
+  delete externalBus;
+  externalBus = nullptr;
+
+  // Nothing else can be recorded now the buses have stopped
+  delete traceRecorder;
+  traceRecorder = nullptr;
+}
+
+I2C::I2C(uint8_t i2cAddress, I2CBus *bus) : _i2cAddress(i2cAddress), _bus(bus), _priority(I2CPriority::BACKGROUND) {
+  // Have the bus keep checking the device is there
+  _bus->presence().track(_i2cAddress);
 }
 
 I2C::~I2C() {
 }
 
 bool I2C::exists() {
-  return writeByte(0x00);
+  I2CTransaction transaction;
+  bool present;
+  char reply;
+
+  // The bus knows from the transactions it's sent, and its heartbeat
+  if(_bus->presence().get(address(), present)) {
+    return present;
+  }
+
+  // Nothing's been sent to the device yet, so check it answers the
+  // same probe as the heartbeat
+  _bus->probeTransaction(address(), transaction, &reply);
+
+  return _bus->execute(address(), transaction, I2CPriority::PROBE);
+}
+
+bool I2C::writeBytes(const char *bytes, size_t length) {
+  I2CTransaction transaction;
+
+  if(transaction.write(bytes, length) && execute(transaction)) {
+    return true;
+  }
+
+  std::cerr << "Failed to write I2C bytes!" << std::endl;
+  return false;
+}
+
+size_t I2C::readBytes(char *buffer, size_t length) {
+  I2CTransaction transaction;
+
+  // Return 0 for now if the read fails
+  // IMPROVE: Should we throw an error?
+  if(transaction.read(buffer, length) && execute(transaction)) {
+    return length;
+  }
+
+  std::cerr << "Failed to read I2C bytes!" << std::endl;
+  return 0;
+}
+
+bool I2C::writeByte(const uint8_t byte) {  
+  I2CTransaction transaction;
+
+  transaction.writeByte(byte);
+
+  if(execute(transaction)) {
+    return true;
+  }
+
+  std::cerr << "Failed to write I2C byte!" << std::endl;
+  return false;
+}
+
+bool I2C::readByte(uint8_t &byte) {
+  I2CTransaction transaction;
+  char buffer;
+
+  transaction.read(&buffer, 1);
+
+  if(execute(transaction)) {
+    byte = (uint8_t)buffer;
+    return true;
+  }
+
+  std::cerr << "Failed to read I2C byte!" << std::endl;
+  return false;
+}
+
+bool I2C::execute(I2CTransaction &transaction) {
+  return _bus->execute(address(), transaction, _priority);
+}
+
+I2CTraceRecorder *I2C::trace() {
+  std::call_once(initTraceFlag, initTrace);
+
+  return traceRecorder;
+}
+
+I2CCompletion I2C::submit(const I2CTransaction &transaction, std::chrono::microseconds delay, bool notify) {
+  return _bus->submit(address(), transaction, _priority, I2CBus::clock::now() + delay, notify);
+}
+
+void I2C::startPIGPIOD() {
+  std::call_once(initPIGPIODFlag, initPIGPIOD);
 }
 
 void I2C::initPIGPIOD() {
+  // Carry on if we can't connect, the transports will report the failures
+  // and other buses may still be usable
   if(0 != pigpio_start(NULL, NULL)) {
     std::cerr << "Failed to connect to pigpiod, is it running?" << std::endl;
-    exit(-1);
-  }
-
-  // Create a 'bit bang' variant
-  if(0 != bb_i2c_open(SDA_PIN, SDL_PIN, 100000)) {
-    std::cerr << "Failed to open bit bang port" << std::endl;
-    exit(-1);
+    return;
   }
 
-  
   // We want to stop the pigpio connection when the program exits
   std::atexit(finalizePIGPIOD);
 }
 
 void I2C::finalizePIGPIOD() {
-  // IMPROVE: We should also make sure that any i2c handles are closed
-  bb_i2c_close(SDA_PIN);
   pigpio_stop();
 }
 
 
-I2CInternal::I2CInternal(uint8_t i2cAddress) : I2C(i2cAddress), _i2cHandle(-1) {
-  _i2cHandle = i2c_open(1, address(), 0);
+I2CInternal::I2CInternal(uint8_t i2cAddress) : I2C(i2cAddress, bus()) {
+}
+
+I2CInternal::I2CInternal(uint8_t i2cAddress, I2CBus *bus) : I2C(i2cAddress, bus) {
 }
 
 I2CInternal::~I2CInternal() {
-  i2c_close(_i2cHandle);
 }
 
-bool I2CInternal::writeBytes(const char *bytes, size_t length) {
-  bool result = false;
-  
-  if(i2c_write_device(_i2cHandle, (char *)bytes, length) >= 0 ) {
-    result = true;
-  }  
-  else {
-    std::cerr << "Failed to write I2C bytes!" << std::endl;
-  }
-    
-  return result;
+void I2CInternal::setTransport(Transport transport) {
+  internalTransportType = transport;
+  internalTransportSelected = true;
 }
 
-size_t I2CInternal::readBytes(char *buffer, size_t length) {
-  int read;
-  
-  read = i2c_read_device(_i2cHandle, buffer, length);
-  
-  if(read < 0) {
-    // Set to 0 for now
-    // IMPROVE: Should we throw an error?
-    read = 0;
-  }
-  
-  return read;
+void I2CInternal::setTransport(I2CTransport *transport) {
+  internalTransport = transport;
 }
 
-bool I2CInternal::writeByte(const uint8_t byte) {  
-  if(i2c_write_byte(_i2cHandle, byte) >= 0) {
-    return true;
+I2CBus *I2CInternal::bus() {
+  // All internal devices share the one bus
+  std::call_once(initInternalBusFlag, initBus);
+
+  return internalBus;
+}
+
+void I2CInternal::initBus() {
+  // If no transport has been explicitly selected, check the environment
+  if(!internalTransportSelected) {
+    const char *selected = getenv("PIWARS_I2C_INTERNAL");
+
+    if(selected && 0 == strcmp(selected, "i2cdev")) {
+      internalTransportType = Transport::I2CDEV;
+    }
+  }
+
+  if(internalTransport) {
+    internalBus = new I2CBus(internalTransport, "internal");
+  }
+  else if(replay()) {
+    internalBus = new I2CBus(new I2CTransportReplay(replay(), TRACE_INTERNAL_BUS), "internal");
+  }
+  else if(simulated()) {
+    // None of the simulated devices live on the internal bus
+    internalBus = new I2CBus(new I2CSimulator(), "internal");
+  }
+  else if(Transport::I2CDEV == internalTransportType) {
+    internalBus = new I2CBus(new I2CTransportDev(INTERNAL_BUS), "internal");
   }
   else {
-    std::cerr << "Failed to write I2C byte!" << std::endl;
+    // We need to initialise pigpiod once, regardless of how many 
+    // i2c connections we establish
+    startPIGPIOD();
+
+    internalBus = new I2CBus(new I2CTransportPigpiod(INTERNAL_BUS), "internal");
   }
-  
-  return false;
-}
 
-bool I2CInternal::readByte(uint8_t &byte) {
-  int read;
-  
-  read = i2c_read_byte(_i2cHandle);
-  if(read >= 0) {
-    byte = (uint8_t)read;
-    return true;
+  internalBus->setTrace(trace(), TRACE_INTERNAL_BUS);
+
+  // Keep track of which devices are present, unless replaying as the
+  // heartbeat probes won't line up with the ones recorded
+  if(!replay()) {
+    internalBus->setHeartbeat(HEARTBEAT_INTERVAL);
   }
-  
-  return false;
+
+  // Make sure the bus is stopped before pigpiod is
+  std::atexit(finalizeBuses);
 }
 
-I2CExternal::I2CExternal(uint8_t i2cAddress) : I2C(i2cAddress) {
+I2CExternal::I2CExternal(uint8_t i2cAddress) : I2C(i2cAddress, bus()) {
 }
 
 I2CExternal::~I2CExternal() {
 }
 
-bool I2CExternal::writeByte(const uint8_t byte) {  
-  bool success = false;
-  
-  // Set Address, address, Start, Write, 1 byte, Stop, End 
-  char command[] = { 0x04, address(), 0x02, 0x07, 0x01, byte, 0x03, 0x00};
-  
-  if(0 == bb_i2c_zip(SDA_PIN, command, sizeof(command), NULL, 0)) {
-    success = true;
-  }
-
-  return success;
+void I2CExternal::setTransport(I2CTransport *transport) {
+  externalTransport = transport;
 }
 
-bool I2CExternal::readByte(uint8_t &byte) {
-  bool read = false;
-  
-  // Set Address, address, Start, Read, 1 byte, Stop, End 
-  char command[] = { 0x04, address(), 0x02, 0x06, 0x01, 0x03, 0x00};
-  
-  if(1 == bb_i2c_zip(SDA_PIN, command, sizeof(command), (char *)&byte, 1)) {
-    read = true;
-  }
-  
-  return read;
+I2CBus *I2CExternal::bus() {
+  // All external devices share the one bus
+  std::call_once(initExternalBusFlag, initBus);
+
+  return externalBus;
 }
-  
-bool I2CExternal::writeBytes(const char *bytes, size_t length) {
-  bool success = false;
-  char command[64];
-  int commandLength = 0;
-  
-  // Is the length too long?
-  if(length > 32) {
-    return false;
+
+void I2CExternal::initBus() {
+  if(externalTransport) {
+    externalBus = new I2CBus(externalTransport, "external");
   }
-  
-  command[commandLength++] = 0x04; // Set address
-  command[commandLength++] = address(); // The address
-  command[commandLength++] = 0x02; // Start
-  command[commandLength++] = 0x07; // Write
-  command[commandLength++] = length; // Number of bytes
-  
-  // Copy the bytes to send
-  memcpy(&command[commandLength], bytes,length);
-  commandLength += length;
-  
-  command[commandLength++] = 0x03; // Stop
-  command[commandLength++] = 0x00; // End
-  
-  if(0 == bb_i2c_zip(SDA_PIN, command, commandLength, NULL, 0)) {
-    success = true;
+  else if(replay()) {
+    externalBus = new I2CBus(new I2CTransportReplay(replay(), TRACE_EXTERNAL_BUS), "external");
   }
+  else if(simulated()) {
+    I2CSimulator *simulator = new I2CSimulator(EXTERNAL_BAUD);
 
-  return success;
-}
+    // Populate the bus with the robot's devices
+    simulator->addDevice(0x07, new SimulatedMotorDriver(), SIMULATED_ARDUINO_MAX_BAUD);
+    simulator->addDevice(0x08, new SimulatedLineFollower(), SIMULATED_ARDUINO_MAX_BAUD);
+    simulator->addDevice(0x29, new SimulatedVL6180(GPIO::simulator(), SIMULATED_VL6180_INTERRUPT_PIN), I2C::FAST_MODE_BAUD);
 
-size_t I2CExternal::readBytes(char *buffer, size_t length) {
-  // Set Address, address, Start, Read, length, Stop, End 
-  char command[] = { 0x04, address(), 0x02, 0x06, (char)length, 0x03, 0x00};
-  size_t read = 0;
-  
-  if(length > 0xFF) {
-    return false;
+    externalBus = new I2CBus(simulator, "external");
   }
-  
-  // Check if we read all the requested bytes
-  if(length == bb_i2c_zip(SDA_PIN, command, sizeof(command), buffer, length)) {
-    read = length;
+  else {
+    // We need to initialise pigpiod once, regardless of how many 
+    // i2c connections we establish
+    startPIGPIOD();
+
+    externalBus = new I2CBus(new I2CTransportBitBang(SDA_PIN, SDL_PIN, EXTERNAL_BAUD), "external");
   }
-  
-  return read;
-}
 
+  externalBus->setTrace(trace(), TRACE_EXTERNAL_BUS);
+
+  // Keep track of which devices are present, unless replaying as the
+  // heartbeat probes won't line up with the ones recorded
+  if(!replay()) {
+    externalBus->setHeartbeat(HEARTBEAT_INTERVAL);
+  }
+
+  // Make sure the bus is stopped before pigpiod is
+  std::atexit(finalizeBuses);
 }
 
+}
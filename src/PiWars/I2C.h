@@ -6,21 +6,35 @@
 #ifndef _PIWARS_I2C_H
 #define _PIWARS_I2C_H
 
+#include <chrono>
 #include <cstdint>
 #include <cstddef>
 
+#include "I2CBus.h"
+#include "I2CClock.h"
+#include "I2CTrace.h"
+#include "I2CStats.h"
+#include "I2CTransaction.h"
+#include "I2CTransport.h"
+
 namespace PiWars {
 
   // Represents a single I2C device
   class I2C {
     public:
+      static const uint32_t STANDARD_MODE_BAUD = 100000; //!< I2C standard mode clock speed
+      static const uint32_t FAST_MODE_BAUD = 400000; //!< I2C fast mode clock speed
+
       // Initialize the I2C class to talk to the specified device 
       //
       // @param i2cAddress The address of the I2C device to communicate with
-      I2C(uint8_t i2cAddress);
+      // @param bus The bus the device is connected to
+      I2C(uint8_t i2cAddress, I2CBus *bus);
       virtual ~I2C();
 
-      // Checks if the i2c device is present
+      // Checks if the i2c device is present. This is known from the
+      // transactions sent to it, and the bus' heartbeat, so only the
+      // first check before anything has been sent touches the bus.
       bool exists();
       
       // Write to the device
@@ -29,7 +43,7 @@ namespace PiWars {
       // @param length Number of bytes to write
       //
       // @returns true if all bytes were written
-      virtual bool writeBytes(const char *bytes, size_t length) = 0;
+      virtual bool writeBytes(const char *bytes, size_t length);
       
       // Read from the device
       //
@@ -37,50 +51,159 @@ namespace PiWars {
       // @param length Number of bytes to read
       //
       // @returns Number of bytes read
-      virtual size_t readBytes(char *buffer, size_t length) = 0;
+      virtual size_t readBytes(char *buffer, size_t length);
       
       // Writes a single byte to the device
       // 
       // @param byte The byte to write
       // @returns true if the byte was written
-      virtual bool writeByte(const uint8_t byte) = 0;
+      virtual bool writeByte(const uint8_t byte);
       
       // Reads a single byte
       //
       // @param byte Where to read the byte into
       // @returns true if the byte was successfully read
-      virtual bool readByte(uint8_t &byte) = 0;
+      virtual bool readByte(uint8_t &byte);
+
+      // Sends all the reads and writes queued up in the transaction
+      // to the device in one go.
+      //
+      // @param transaction The queued up reads and writes
+      // @returns true if all the messages were sent, and all the
+      //          requested bytes read
+      virtual bool execute(I2CTransaction &transaction);
+
+      // Queues up the reads and writes in the transaction to be sent
+      // without waiting for them, so the caller can get on with something
+      // else in the meantime.
+      // Note: Any buffers being read into must remain valid until the
+      //       transaction has completed
+      //
+      // @param transaction The queued up reads and writes
+      // @param delay How long to wait before sending the transaction
+      // @param notify true if the completion should provide an eventfd
+      //
+      // @returns A handle to wait for the transaction with
+      I2CCompletion submit(const I2CTransaction &transaction, std::chrono::microseconds delay = std::chrono::microseconds(0), bool notify = false);
+
+      // Sets the priority that requests to this device are sent with
+      //
+      // @param priority The new priority
+      void setPriority(I2CPriority priority) { _priority = priority; }
+
+      // Returns the priority that requests to this device are sent with
+      //
+      // @returns The priority
+      I2CPriority priority() { return _priority; }
+
+      // Takes a copy of the statistics recorded for requests to this device
+      //
+      // @param operation The type of operation
+      // @param stats Filled in with the statistics
+      //
+      // @returns true if any requests of that type have been sent
+      bool statistics(I2COperation operation, I2COperationStats &stats) { return _bus->stats().get(_i2cAddress, operation, stats); }
+
+      // Sends all requests to this device at a fixed clock speed, if
+      // the bus allows it
+      //
+      // @param baud The clock speed
+      void setClock(uint32_t baud) { _bus->clocks().setFixed(_i2cAddress, baud); }
+
+      // Lets the clock speed of requests to this device adapt to the
+      // error rate, if the bus allows it
+      //
+      // @param minBaud The slowest clock to use
+      // @param maxBaud The fastest clock to try
+      void setAdaptiveClock(uint32_t minBaud, uint32_t maxBaud) { _bus->clocks().setAdaptive(_i2cAddress, minBaud, maxBaud); }
+
+      // Takes a copy of this device's clock speed state
+      //
+      // @param state Filled in with the state
+      //
+      // @returns true if the device has its own clock speed
+      bool clockState(I2CClockState &state) { return _bus->clocks().get(_i2cAddress, state); }
+
+      // Returns the recorder tracing the transactions on the internal and
+      // external buses. Tracing is enabled by setting the PIWARS_I2C_TRACE
+      // environment variable to the file to record to, and the trace can be
+      // replayed by setting PIWARS_I2C_REPLAY to the file instead.
+      //
+      // @returns The recorder, or nullptr if tracing isn't enabled
+      static I2CTraceRecorder *trace();
+
+      // Connects to the PIGPIO daemon, if not already connected. The one
+      // connection is shared by everything using pigpiod (e.g. the GPIO
+      // pins as well as the I2C buses).
+      static void startPIGPIOD();
       
     protected:
       // Get the address of the I2C slave
       // @returns the devices i2c address
       uint8_t address() { return _i2cAddress; }
+
+      // Sets what the device is sent to check it's present, both by
+      // exists() and the bus's heartbeat. It must be something the device
+      // doesn't act on, as it can be sent at any time.
+      //
+      // @param bytes The bytes to write
+      // @param length Number of bytes to write
+      // @param readReply true to read back a byte after them
+      void setProbe(const char *bytes, size_t length, bool readReply = false) { _bus->setProbe(_i2cAddress, bytes, length, readReply); }
+
+      static void initPIGPIOD(); //!< Initialise a connection to the PIGPIO daemon
       
     private:
-      static void initPIGPIOD(); //!< Initialise a connection to the PIGPIO daemon
       static void finalizePIGPIOD(); //!< Finalizes the connection with the PIGPIO daemon
       
       uint8_t _i2cAddress; //!< Address of the I2CDevice as returned by pigpiod
+      I2CBus *_bus; //!< The bus the device is connected to
+      I2CPriority _priority; //!< The priority requests are sent with
   };
 
   class I2CInternal : public I2C {
     public:
+      // The ways the internal I2C bus can be accessed
+      enum class Transport {
+        PIGPIOD, //<! Via the pigpio daemon
+        I2CDEV //<! Directly via the kernel's /dev/i2c-1 device
+      };
+
       // Initialize the I2C class to talk to a device that is
       // connected on the 'Internal' I2C bus. (i.e. the standard
       // /dev/i2c-1 device)
       //
       // @param i2cAddress The address of the I2C device to communicate with
       I2CInternal(uint8_t i2cAddress);
+
+      // Initialize the I2C class to talk to a device on a specific
+      // bus (e.g. a fake device when testing)
+      //
+      // @param i2cAddress The address of the I2C device to communicate with
+      // @param bus The bus to send all requests through
+      I2CInternal(uint8_t i2cAddress, I2CBus *bus);
       ~I2CInternal();
 
-      // Implementation of the APIs for the internal I2C
-      bool writeBytes(const char *bytes, size_t length);      
-      size_t readBytes(char *buffer, size_t length);      
-      bool writeByte(const uint8_t byte);
-      bool readByte(uint8_t &byte);
+      // Selects how the internal I2C bus is accessed. This must be called
+      // before the first I2CInternal is created, otherwise the transport is
+      // selected by the PIWARS_I2C_INTERNAL environment variable
+      // ('pigpiod' or 'i2cdev'), defaulting to pigpiod. Setting the PIWARS_I2C
+      // environment variable to 'simulated' overrides this with an empty
+      // simulated bus.
+      //
+      // @param transport The transport to use
+      static void setTransport(Transport transport);
+
+      // Provides the transport the internal I2C bus will be accessed
+      // through (e.g. an I2CSimulator). This must be called before the
+      // first I2CInternal is created.
+      //
+      // @param transport The transport to use. Ownership is passed to the bus.
+      static void setTransport(I2CTransport *transport);
 
     private:      
-      int _i2cHandle; //!< Handle used by pigpiod to perform I2C communication
+      static I2CBus *bus(); //!< Returns the internal bus, creating it if needed
+      static void initBus(); //!< Creates the internal bus with the selected transport
   };
   
   class I2CExternal : public I2C {
@@ -93,14 +216,18 @@ namespace PiWars {
       I2CExternal(uint8_t i2cAddress);
       ~I2CExternal();
 
-      // Implementation of the APIs for the internal I2C
-      bool writeBytes(const char *bytes, size_t length);      
-      size_t readBytes(char *buffer, size_t length);      
-      bool writeByte(const uint8_t byte);
-      bool readByte(uint8_t &byte);
+      // Provides the transport the external I2C bus will be accessed
+      // through (e.g. an I2CSimulator). This must be called before the
+      // first I2CExternal is created, otherwise the bit banged bus is used
+      // unless the PIWARS_I2C environment variable is set to 'simulated'
+      //
+      // @param transport The transport to use. Ownership is passed to the bus.
+      static void setTransport(I2CTransport *transport);
 
     private:      
+      static I2CBus *bus(); //!< Returns the external bus, creating it if needed
+      static void initBus(); //!< Creates the bit banged external bus
   };  
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,517 @@
+/**
+ * The I2CBus owns a single I2C bus, and is the only thing that talks to it.
+ * Requests from all the devices on the bus are queued up and then
+ * sent, one at a time, from a dedicated thread. This stops devices
+ * polled from different threads from trampling over each other, and
+ * allows time critical requests (e.g. motor commands) to jump the queue.
+ * While the bus is idle any devices that have gone quiet are probed, so
+ * it's always known which devices are present.
+ *
+ * Changing the clock speed can be as slow as a transaction, so the bus
+ * runs at the slowest clock of the devices currently in use. It only
+ * slows down for a request that needs it, and only speeds up again while
+ * the bus is idle, so interleaved requests to devices with different
+ * clocks don't keep switching it.
+ */
+
+#include "I2CBus.h"
+
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+namespace PiWars
+{
+
+// How long each priority class can expect to wait, used to set the
+// deadline if one isn't given
+static const std::chrono::microseconds priorityBudget[] = {
+  std::chrono::microseconds(2000), // ACTUATOR
+  std::chrono::microseconds(10000), // CONTROL
+  std::chrono::microseconds(100000), // BACKGROUND
+  std::chrono::microseconds(1000000) // PROBE
+};
+
+// How each priority class is retried by default. Actuators retry hard but
+// briefly, as a late motor command is little better than a lost one.
+// Probes aren't retried as a failure is the answer.
+static const I2CRetryPolicy defaultRetryPolicies[] = {
+  { 2, 2, std::chrono::microseconds(100), std::chrono::microseconds(400), std::chrono::microseconds(2000) }, // ACTUATOR
+  { 1, 3, std::chrono::microseconds(200), std::chrono::microseconds(1000), std::chrono::microseconds(5000) }, // CONTROL
+  { 1, 3, std::chrono::microseconds(1000), std::chrono::microseconds(10000), std::chrono::microseconds(50000) }, // BACKGROUND
+  { 0, 0, std::chrono::microseconds(0), std::chrono::microseconds(0), std::chrono::microseconds(0) } // PROBE
+};
+
+// How long after its last request a device still counts as in use, and
+// holds the clock down to its speed
+static const std::chrono::milliseconds clockHoldTime(250);
+
+I2CBus::I2CBus(I2CTransport *transport, const std::string &name)
+  : _transport(transport)
+  , _name(name)
+  , _defaultClock(transport->clock())
+  , _retryPolicies(std::begin(defaultRetryPolicies), std::end(defaultRetryPolicies))
+  , _trace(nullptr)
+  , _traceBus(0)
+  , _sequence(0)
+  , _quit(false)
+  , _busThread(nullptr)
+{
+  _busThread = new std::thread(busThread, this);
+}
+
+I2CBus::~I2CBus() {
+  // Tell the thread to exit
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _quit = true;
+  }
+  _queued.notify_one();
+
+  // and wait for it to do so
+  _busThread->join();
+  delete _busThread;
+  _busThread = nullptr;
+
+  delete _transport;
+}
+
+bool I2CBus::execute(uint8_t address, I2CTransaction &transaction, I2CPriority priority) {
+  return execute(address, transaction, priority, clock::now() + priorityBudget[(int)priority]);
+}
+
+bool I2CBus::execute(uint8_t address, I2CTransaction &transaction, I2CPriority priority, const clock::time_point &deadline) {
+  RequestPtr request = std::make_shared<Request>();
+
+  request->address = address;
+  request->transaction = &transaction;
+  request->priority = priority;
+  request->deadline = deadline;
+
+  // Queue up the request
+  if(!queue(request)) {
+    return false;
+  }
+
+  // and wait for it to be sent
+  return I2CCompletion(request).wait();
+}
+
+I2CCompletion I2CBus::submit(uint8_t address, const I2CTransaction &transaction, I2CPriority priority, const clock::time_point &notBefore, bool notify) {
+  RequestPtr request = std::make_shared<Request>();
+  clock::time_point now = clock::now();
+
+  // Take a copy so the caller doesn't need to keep the transaction around
+  request->address = address;
+  request->copy = transaction;
+  request->transaction = &request->copy;
+  request->priority = priority;
+  request->notBefore = notBefore;
+  request->deadline = ((notBefore > now) ? notBefore : now) + priorityBudget[(int)priority];
+
+  if(notify) {
+    request->fd = eventfd(0, EFD_NONBLOCK);
+  }
+
+  if(!queue(request)) {
+    complete(request, false);
+  }
+
+  return I2CCompletion(request);
+}
+
+void I2CBus::setRetryPolicy(I2CPriority priority, const I2CRetryPolicy &policy) {
+  std::unique_lock<std::mutex> lock(_mutex);
+
+  _retryPolicies[(int)priority] = policy;
+}
+
+I2CRetryPolicy I2CBus::retryPolicy(I2CPriority priority) {
+  std::unique_lock<std::mutex> lock(_mutex);
+
+  return _retryPolicies[(int)priority];
+}
+
+void I2CBus::setProbe(uint8_t address, const char *bytes, size_t length, bool readReply) {
+  std::unique_lock<std::mutex> lock(_probeMutex);
+  Probe &probe = _probes[address];
+
+  probe.bytes.assign(bytes, bytes + length);
+  probe.readReply = readReply;
+}
+
+void I2CBus::probeTransaction(uint8_t address, I2CTransaction &transaction, char *reply) {
+  std::unique_lock<std::mutex> lock(_probeMutex);
+  auto probe = _probes.find(address);
+
+  if(probe == _probes.end() || probe->second.bytes.empty()) {
+    transaction.read(reply, 1);
+  }
+  else if(probe->second.readReply) {
+    transaction.writeRead(probe->second.bytes.data(), probe->second.bytes.size(), reply, 1);
+  }
+  else {
+    transaction.write(probe->second.bytes.data(), probe->second.bytes.size());
+  }
+}
+
+void I2CBus::setHeartbeat(std::chrono::milliseconds interval) {
+  _presence.setHeartbeat(interval);
+
+  // Let the bus thread know when the first probes are due
+  std::unique_lock<std::mutex> lock(_mutex);
+  _queued.notify_one();
+}
+
+void I2CBus::probe(uint8_t address) {
+  RequestPtr request = std::make_shared<Request>();
+
+  request->address = address;
+  probeTransaction(address, request->copy, &request->reply);
+  request->transaction = &request->copy;
+  request->priority = I2CPriority::PROBE;
+  request->queued = clock::now();
+  request->deadline = request->queued + priorityBudget[(int)I2CPriority::PROBE];
+  request->sequence = _sequence++;
+
+  _queue.push(request);
+}
+
+bool I2CBus::queue(const RequestPtr &request) {
+  std::unique_lock<std::mutex> lock(_mutex);
+
+  // Is the bus shutting down?
+  if(_quit) {
+    return false;
+  }
+
+  request->queued = clock::now();
+  request->sequence = _sequence++;
+
+  // Requests that can't be sent yet wait to one side, so they don't
+  // block anything behind them
+  if(request->notBefore > request->queued) {
+    _delayed.push(request);
+  }
+  else {
+    _queue.push(request);
+  }
+  _queued.notify_one();
+
+  return true;
+}
+
+void I2CBus::complete(const RequestPtr &request, bool result) {
+  std::unique_lock<std::mutex> lock(request->mutex);
+
+  request->result = result;
+  request->completed = true;
+  request->condition.notify_all();
+
+  if(-1 != request->fd) {
+    uint64_t value = 1;
+    write(request->fd, &value, sizeof(value));
+  }
+}
+
+bool I2CBus::RequestOrder::operator()(const RequestPtr &a, const RequestPtr &b) const {
+  // The priority_queue keeps the 'largest' element at the top, so this
+  // returns true if a is less urgent than b
+  if(a->priority != b->priority) {
+    return a->priority > b->priority;
+  }
+
+  if(a->deadline != b->deadline) {
+    return a->deadline > b->deadline;
+  }
+
+  return a->sequence > b->sequence;
+}
+
+bool I2CBus::DelayedOrder::operator()(const RequestPtr &a, const RequestPtr &b) const {
+  if(a->notBefore != b->notBefore) {
+    return a->notBefore > b->notBefore;
+  }
+
+  return a->sequence > b->sequence;
+}
+
+void I2CBus::busThread(I2CBus *bus) {
+  std::unique_lock<std::mutex> lock(bus->_mutex);
+
+  while(!bus->_quit) {
+    clock::time_point now = clock::now();
+    RequestPtr request;
+
+    // Move any delayed requests that are now due onto the main queue
+    while(!bus->_delayed.empty() && bus->_delayed.top()->notBefore <= now) {
+      bus->_queue.push(bus->_delayed.top());
+      bus->_delayed.pop();
+    }
+
+    // Wait for something to do, probing any quiet devices in the meantime
+    if(bus->_queue.empty()) {
+      clock::time_point wake = clock::time_point::max();
+      uint8_t address;
+      uint32_t baud;
+
+      if(bus->_presence.due(now, address, wake)) {
+        bus->probe(address);
+        continue;
+      }
+
+      // Now nothing's waiting the clock can be changed, and faster
+      // clocks tried, without holding anything up
+      lock.unlock();
+      if(bus->_transport->clock() && bus->_clocks.due(now, address, baud)) {
+        bus->trial(address, baud);
+      }
+      wake = std::min(wake, bus->settleClock(now));
+      lock.lock();
+
+      // Anything might have been queued in the meantime
+      if(!bus->_queue.empty()) {
+        continue;
+      }
+
+      if(!bus->_delayed.empty()) {
+        wake = std::min(wake, bus->_delayed.top()->notBefore);
+      }
+
+      if(clock::time_point::max() == wake) {
+        bus->_queued.wait(lock);
+      }
+      else {
+        bus->_queued.wait_until(lock, wake);
+      }
+      continue;
+    }
+
+    // Take the most urgent request
+    request = bus->_queue.top();
+    bus->_queue.pop();
+
+    // and send it, without holding the lock so more requests can be queued
+    lock.unlock();
+    bus->attempt(request);
+    lock.lock();
+  }
+
+  // Fail anything still waiting
+  while(!bus->_queue.empty()) {
+    complete(bus->_queue.top(), false);
+    bus->_queue.pop();
+  }
+  while(!bus->_delayed.empty()) {
+    complete(bus->_delayed.top(), false);
+    bus->_delayed.pop();
+  }
+}
+
+uint32_t I2CBus::deviceClock(uint8_t address) {
+  uint32_t baud = _clocks.clock(address);
+
+  return baud ? baud : _defaultClock;
+}
+
+I2CBus::clock::time_point I2CBus::settleClock(const clock::time_point &now) {
+  clock::time_point next = clock::time_point::max();
+  uint32_t baud = 0;
+
+  // Find the slowest device still in use
+  for(auto used = _lastUsed.begin(); used != _lastUsed.end(); ) {
+    if(now - used->second > clockHoldTime) {
+      used = _lastUsed.erase(used);
+      continue;
+    }
+
+    uint32_t device = deviceClock(used->first);
+
+    if(0 == baud || device < baud) {
+      baud = device;
+    }
+    next = std::min(next, used->second + clockHoldTime);
+    used++;
+  }
+
+  if(baud && _transport->clock() && baud != _transport->clock()) {
+    _transport->setClock(baud);
+  }
+
+  return next;
+}
+
+void I2CBus::trial(uint8_t address, uint32_t baud) {
+  I2CTransaction transaction;
+  uint32_t previous = _transport->clock();
+  char reply;
+
+  probeTransaction(address, transaction, &reply);
+
+  if(_transport->setClock(baud)) {
+    _clocks.recordTrial(address, baud, transfer(address, transaction, clock::now()));
+  }
+
+  // Put it back for the devices in use
+  _transport->setClock(previous);
+}
+
+bool I2CBus::send(const RequestPtr &request) {
+  uint32_t baud = deviceClock(request->address);
+
+  // Slow down if the device can't keep up. Anything faster can be sent
+  // at the current clock, leaving it to be raised once the bus is idle.
+  if(baud && _transport->clock() && baud < _transport->clock()) {
+    _transport->setClock(baud);
+  }
+  if(_transport->clock()) {
+    baud = _transport->clock();
+  }
+
+  // Delayed requests have only been waiting since they became due
+  clock::time_point due = std::max(request->queued, request->notBefore);
+  clock::time_point started = clock::now();
+  bool result = transfer(request->address, *request->transaction, due);
+
+  _clocks.record(request->address, baud, result);
+  _presence.record(request->address, result, started);
+
+  // Probes don't hold the clock down, only real requests
+  if(I2CPriority::PROBE != request->priority) {
+    _lastUsed[request->address] = started;
+  }
+
+  return result;
+}
+
+bool I2CBus::transfer(uint8_t address, I2CTransaction &transaction, const clock::time_point &due) {
+  clock::time_point started = clock::now();
+  bool result = _transport->execute(address, transaction);
+  clock::time_point finished = clock::now();
+
+  _stats.record(address, transaction, started - due, finished - started, result);
+
+  if(_trace) {
+    _trace->record(_traceBus, address, transaction, started, finished - started, result);
+  }
+
+  return result;
+}
+
+void I2CBus::attempt(const RequestPtr &request) {
+  I2CRetryPolicy policy = retryPolicy(request->priority);
+  clock::time_point now = clock::now();
+
+  if(0 == request->backoffs) {
+    request->firstAttempt = now;
+  }
+
+  clock::time_point giveUp = request->firstAttempt + policy.giveUpAfter;
+  bool result = send(request);
+
+  // Get past any one off glitches straight away
+  for(unsigned i = 0; !result && i < policy.immediateRetries && clock::now() < giveUp; i++) {
+    _stats.recordRetry(request->address, *request->transaction);
+    result = send(request);
+  }
+
+  // Make sure a device hasn't been left holding the bus, and if it had
+  // try again now it's free
+  if(!result && _transport->recover()) {
+    std::cerr << __func__ << ": Cleared stuck I2C bus " << _name << std::endl;
+
+    _stats.recordRetry(request->address, *request->transaction);
+    result = send(request);
+  }
+
+  if(!result) {
+    // Try again later, if it won't take too long
+    if(request->backoffs < policy.backoffRetries) {
+      clock::duration backoff = policy.initialBackoff * (1 << request->backoffs);
+
+      if(backoff > policy.maxBackoff) {
+        backoff = policy.maxBackoff;
+      }
+
+      now = clock::now();
+
+      if(now + backoff <= giveUp) {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        if(!_quit) {
+          request->backoffs++;
+          request->notBefore = now + backoff;
+          _stats.recordRetry(request->address, *request->transaction);
+          _delayed.push(request);
+          return;
+        }
+      }
+    }
+  }
+
+  complete(request, result);
+}
+
+I2CCompletion::State::State()
+  : address(0)
+  , transaction(nullptr)
+  , priority(I2CPriority::BACKGROUND)
+  , backoffs(0)
+  , sequence(0)
+  , completed(false)
+  , result(false)
+  , fd(-1)
+{
+}
+
+I2CCompletion::State::~State() {
+  if(-1 != fd) {
+    close(fd);
+  }
+}
+
+I2CCompletion::I2CCompletion() {
+}
+
+I2CCompletion::~I2CCompletion() {
+}
+
+bool I2CCompletion::ready() {
+  if(!_state) {
+    return true;
+  }
+
+  std::unique_lock<std::mutex> lock(_state->mutex);
+  return _state->completed;
+}
+
+bool I2CCompletion::wait() {
+  if(!_state) {
+    return false;
+  }
+
+  std::unique_lock<std::mutex> lock(_state->mutex);
+
+  while(!_state->completed) {
+    _state->condition.wait(lock);
+  }
+
+  return _state->result;
+}
+
+bool I2CCompletion::result() {
+  if(!_state) {
+    return false;
+  }
+
+  std::unique_lock<std::mutex> lock(_state->mutex);
+  return _state->completed && _state->result;
+}
+
+int I2CCompletion::getFD() const {
+  return _state ? _state->fd : -1;
+}
+
+}
@@ -0,0 +1,369 @@
+/**
+ * The I2CBus owns a single I2C bus, and is the only thing that talks to it.
+ * Requests from all the devices on the bus are queued up and then
+ * sent, one at a time, from a dedicated thread. This stops devices
+ * polled from different threads from trampling over each other, and
+ * allows time critical requests (e.g. motor commands) to jump the queue.
+ * While the bus is idle any devices that have gone quiet are probed, so
+ * it's always known which devices are present.
+ *
+ * Changing the clock speed can be as slow as a transaction, so the bus
+ * runs at the slowest clock of the devices currently in use. It only
+ * slows down for a request that needs it, and only speeds up again while
+ * the bus is idle, so interleaved requests to devices with different
+ * clocks don't keep switching it.
+ */
+
+#ifndef _PIWARS_I2CBUS_H
+#define _PIWARS_I2CBUS_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "I2CClock.h"
+#include "I2CPresence.h"
+#include "I2CStats.h"
+#include "I2CTrace.h"
+#include "I2CTransaction.h"
+#include "I2CTransport.h"
+
+namespace PiWars {
+
+  // The priority classes of requests on the bus, from most to least urgent
+  enum class I2CPriority {
+    ACTUATOR, //<! Commands to actuators such as the motors
+    CONTROL, //<! Sensor reads that a control loop is waiting on
+    BACKGROUND, //<! Background polling of sensors
+    PROBE //<! Checking if a device is present
+  };
+
+  // How a failed transaction is retried. Each attempt is first retried
+  // straight away, to get past a one off glitch, then retried after a
+  // growing delay, leaving the bus free for other requests in between.
+  // Retrying stops once the transaction has been failing for giveUpAfter.
+  struct I2CRetryPolicy {
+    unsigned immediateRetries; //<! Retries straight after each failed attempt
+    unsigned backoffRetries; //<! Retries after a delay
+    std::chrono::microseconds initialBackoff; //<! The delay before the first delayed retry, doubling each time
+    std::chrono::microseconds maxBackoff; //<! The longest delay between retries
+    std::chrono::microseconds giveUpAfter; //<! How long after the first attempt to stop retrying
+  };
+
+  // Forward declarations
+  class I2CBus;
+
+  // A handle to a transaction submitted to the bus without waiting for it
+  // to be sent. The handle can be waited on, polled, or an eventfd used to
+  // wait for it alongside other file descriptors.
+  //
+  // Note: Any buffers the transaction reads into must remain valid until
+  //       the transaction has completed.
+  class I2CCompletion {
+    public:
+      // Creates an empty handle, not associated with any transaction
+      I2CCompletion();
+      ~I2CCompletion();
+
+      // Checks if the handle is associated with a transaction
+      //
+      // @returns true if a transaction was submitted
+      bool valid() const { return (bool)_state; }
+
+      // Checks if the transaction has been sent
+      //
+      // @returns true if the transaction has been sent, or the handle is empty
+      bool ready();
+
+      // Waits for the transaction to be sent
+      //
+      // @returns true if all the messages were sent, and all the
+      //          requested bytes read
+      bool wait();
+
+      // Returns the result of the transaction, without waiting
+      //
+      // @returns true if the transaction has been sent successfully
+      bool result();
+
+      // Returns the FD that becomes readable once the transaction has been
+      // sent, if one was asked for when it was submitted
+      //
+      // @returns The file descriptor, or -1 if there isn't one
+      int getFD() const;
+
+      // Forgets about the transaction. It will still be sent.
+      void reset() { _state.reset(); }
+
+    private:
+      friend class I2CBus;
+
+      // Everything needed to send a single transaction and report back
+      struct State {
+        uint8_t address; //<! The address of the I2C device
+        I2CTransaction *transaction; //<! The transaction to send
+        I2CTransaction copy; //<! The caller's transaction, when submitted without waiting
+        char reply; //<! Where a probe's reply is read into
+        I2CPriority priority; //<! How urgent the transaction is
+        std::chrono::steady_clock::time_point deadline; //<! When the transaction should be sent by
+        std::chrono::steady_clock::time_point notBefore; //<! The transaction mustn't be sent before this
+        std::chrono::steady_clock::time_point queued; //<! When the transaction was queued
+        std::chrono::steady_clock::time_point firstAttempt; //<! When the transaction was first sent
+        unsigned backoffs; //<! Number of delayed retries so far
+        uint64_t sequence; //<! Used to keep requests in order when all else is equal
+        bool completed; //<! Set once the transaction has been sent
+        bool result; //<! Did the transaction succeed?
+        int fd; //<! eventfd signalled on completion, or -1
+        std::mutex mutex; //<! Protects completed and result
+        std::condition_variable condition; //<! Signalled on completion
+
+        State();
+        ~State();
+      };
+
+      I2CCompletion(const std::shared_ptr<State> &state) : _state(state) {}
+
+      std::shared_ptr<State> _state; //<! The submitted transaction
+  };
+
+  class I2CBus {
+    public:
+      typedef std::chrono::steady_clock clock;
+
+      // Starts the thread that will own the bus
+      //
+      // @param transport The transport used to access the bus. The I2CBus
+      //                  takes ownership of it.
+      // @param name The name of the bus, used when reporting statistics
+      I2CBus(I2CTransport *transport, const std::string &name = "");
+      ~I2CBus();
+
+      // Queues up the transaction and waits for it to be sent. Requests are
+      // sent in priority order, and by the earliest deadline within each
+      // priority. The deadline defaults to a budget based on the priority.
+      //
+      // @param address The address of the I2C device
+      // @param transaction The queued up reads and writes
+      // @param priority How urgent the transaction is
+      //
+      // @returns true if all the messages were sent, and all the
+      //          requested bytes read
+      bool execute(uint8_t address, I2CTransaction &transaction, I2CPriority priority);
+
+      // Queues up the transaction, with an explicit deadline, and waits
+      // for it to be sent.
+      //
+      // @param address The address of the I2C device
+      // @param transaction The queued up reads and writes
+      // @param priority How urgent the transaction is
+      // @param deadline When the transaction should ideally be sent by
+      //
+      // @returns true if all the messages were sent, and all the
+      //          requested bytes read
+      bool execute(uint8_t address, I2CTransaction &transaction, I2CPriority priority, const clock::time_point &deadline);
+
+      // Queues up a copy of the transaction without waiting for it to be
+      // sent. The transaction won't be sent before notBefore, allowing a
+      // device time to prepare a response without holding up the bus.
+      //
+      // @param address The address of the I2C device
+      // @param transaction The queued up reads and writes
+      // @param priority How urgent the transaction is
+      // @param notBefore The earliest time the transaction can be sent
+      // @param notify true if an eventfd should be signalled on completion
+      //
+      // @returns A handle to wait for the transaction with
+      I2CCompletion submit(uint8_t address, const I2CTransaction &transaction, I2CPriority priority, const clock::time_point &notBefore, bool notify = false);
+
+      // Returns the statistics of all the transactions sent on the bus
+      //
+      // @returns the statistics
+      I2CStats &stats() { return _stats; }
+
+      // Returns the controller of each device's clock speed. Devices that
+      // haven't been configured are sent at the clock the transport
+      // started with.
+      //
+      // @returns the clock controller
+      I2CClockController &clocks() { return _clocks; }
+
+      // Returns which devices are present on the bus, from the outcome of
+      // the transactions sent to them
+      //
+      // @returns the presence of the devices
+      I2CPresence &presence() { return _presence; }
+
+      // Sets what the device is sent to check it's present. This can be
+      // sent whenever the device has gone quiet, so it must be something
+      // the device doesn't act on (e.g. a no-op command, or reading an ID
+      // register).
+      //
+      // @param address The address of the device
+      // @param bytes The bytes to write
+      // @param length Number of bytes to write, or zero to just read a byte
+      // @param readReply true to read back a byte after them, joined by a
+      //                  repeated start
+      void setProbe(uint8_t address, const char *bytes, size_t length, bool readReply);
+
+      // Fills in the transaction used to check the device is present.
+      // Devices without their own probe just have a byte read from them.
+      //
+      // @param address The address of the device
+      // @param transaction The transaction to fill in
+      // @param reply Where any byte read back goes. This must remain valid
+      //              until the transaction is executed.
+      void probeTransaction(uint8_t address, I2CTransaction &transaction, char *reply);
+
+      // Sets how often tracked devices are probed while they're quiet.
+      // Devices are tracked with presence().track().
+      //
+      // @param interval The interval, or zero to stop probing
+      void setHeartbeat(std::chrono::milliseconds interval);
+
+      // Returns the name of the bus
+      //
+      // @returns the name
+      const std::string &name() const { return _name; }
+
+      // Records every transaction sent on the bus
+      // Note: This must be called before any transactions are sent
+      //
+      // @param recorder Where to record the transactions, or nullptr to stop.
+      //                 This isn't owned by the bus.
+      // @param bus Identifies the bus in the recording
+      void setTrace(I2CTraceRecorder *recorder, uint8_t bus) { _trace = recorder; _traceBus = bus; }
+
+      // Sets how failed transactions of a priority class are retried
+      //
+      // @param priority The priority class
+      // @param policy The retry policy
+      void setRetryPolicy(I2CPriority priority, const I2CRetryPolicy &policy);
+
+      // Returns how failed transactions of a priority class are retried
+      //
+      // @param priority The priority class
+      //
+      // @returns The retry policy
+      I2CRetryPolicy retryPolicy(I2CPriority priority);
+
+    private:
+      typedef I2CCompletion::State Request;
+      typedef std::shared_ptr<Request> RequestPtr;
+
+      // How a device is checked to be present
+      struct Probe {
+        std::vector<char> bytes; //<! The bytes to write
+        bool readReply; //<! Is a byte read back after them?
+      };
+
+      // Orders the requests so the most urgent is at the top of the queue
+      struct RequestOrder {
+        bool operator()(const RequestPtr &a, const RequestPtr &b) const;
+      };
+
+      // Orders the delayed requests so the earliest is at the top of the queue
+      struct DelayedOrder {
+        bool operator()(const RequestPtr &a, const RequestPtr &b) const;
+      };
+
+      // Queues up a probe of the device, to check it's still there.
+      // The lock must be held.
+      //
+      // @param address The address of the device
+      void probe(uint8_t address);
+
+      // Adds the request to the appropriate queue for the bus thread
+      //
+      // @param request The request to send
+      //
+      // @returns false if the bus is shutting down
+      bool queue(const RequestPtr &request);
+
+      // Marks the request as sent, and wakes up anything waiting for it
+      //
+      // @param request The request that's been sent
+      // @param result true if it was successful
+      static void complete(const RequestPtr &request, bool result);
+
+      // Sends the request once, no faster than the device's clock speed,
+      // recording how it went
+      //
+      // @param request The request to send
+      //
+      // @returns true if the transaction succeeded
+      bool send(const RequestPtr &request);
+
+      // Sends a transaction at the current clock, recording it in the
+      // statistics and trace
+      //
+      // @param address The address of the device
+      // @param transaction The transaction to send
+      // @param due When the transaction was due to be sent
+      //
+      // @returns true if the transaction succeeded
+      bool transfer(uint8_t address, I2CTransaction &transaction, const clock::time_point &due);
+
+      // Returns the clock speed the device should be sent at
+      //
+      // @param address The address of the device
+      //
+      // @returns The clock speed
+      uint32_t deviceClock(uint8_t address);
+
+      // Sets the clock to the slowest of the devices used recently. This
+      // should only be called while the bus is idle.
+      //
+      // @param now The current time
+      //
+      // @returns When a device will stop being in use, allowing the clock
+      //          to change, or clock::time_point::max() if none are in use
+      clock::time_point settleClock(const clock::time_point &now);
+
+      // Probes the device at a faster clock, to see if its clock can be
+      // raised. This should only be called while the bus is idle.
+      //
+      // @param address The address of the device
+      // @param baud The clock to probe it at
+      void trial(uint8_t address, uint32_t baud);
+
+      // Sends the request, retrying it straight away if it fails. If it
+      // still fails it is queued up to be retried later, if the policy
+      // allows, otherwise it is completed.
+      //
+      // @param request The request to send
+      void attempt(const RequestPtr &request);
+
+      static void busThread(I2CBus *bus); //<! The thread that owns the bus
+
+      I2CTransport *_transport; //<! The transport used to access the bus
+      std::string _name; //<! The name of the bus
+      I2CStats _stats; //<! Statistics of the transactions sent
+      I2CClockController _clocks; //<! The clock speed of each device
+      I2CPresence _presence; //<! Which devices are present
+      std::map<uint8_t, Probe> _probes; //<! How each device is probed, if not the default
+      std::mutex _probeMutex; //<! Protects access to the probes
+      uint32_t _defaultClock; //<! The clock speed of devices without their own
+      std::map<uint8_t, clock::time_point> _lastUsed; //<! When each device was last sent a request. Only used by the bus thread
+      std::vector<I2CRetryPolicy> _retryPolicies; //<! How each priority class is retried
+      I2CTraceRecorder *_trace; //<! Records every transaction, if set
+      uint8_t _traceBus; //<! Identifies the bus in the recording
+      std::priority_queue<RequestPtr, std::vector<RequestPtr>, RequestOrder> _queue; //<! The requests waiting to be sent
+      std::priority_queue<RequestPtr, std::vector<RequestPtr>, DelayedOrder> _delayed; //<! The requests that can't be sent yet
+      uint64_t _sequence; //<! The sequence number of the next request
+      bool _quit; //<! Used to tell the bus thread to exit
+      std::mutex _mutex; //<! Protects access to the queue
+      std::condition_variable _queued; //<! Signalled when a request is queued
+      std::thread *_busThread; //<! The thread that owns the bus
+  };
+
+}
+
+#endif
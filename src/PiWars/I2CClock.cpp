@@ -0,0 +1,199 @@
+/**
+ * The I2CClockController decides which clock speed each device on a bus
+ * should be talked to at. Devices can be given a fixed clock, or a range
+ * for the clock to adapt within: the clock is backed off as soon as
+ * transactions start failing, and raised once probes sent at the next
+ * clock up, while the bus is idle, succeed. This finds the fastest speed
+ * each device can reliably sustain without risking real transactions on
+ * a clock that hasn't been proven.
+ */
+
+#include "I2CClock.h"
+
+#include <algorithm>
+#include <iomanip>
+
+namespace PiWars
+{
+
+// How many transactions in a row must succeed before the next clock up
+// is tried
+static const uint32_t RAISE_AFTER = 32;
+
+// How many must succeed before trying a clock that has failed before
+static const uint32_t RETRY_CEILING_AFTER = 1024;
+
+// How many probes at the next clock up must succeed before it's used
+static const uint32_t RAISE_AFTER_TRIALS = 8;
+
+// The shortest time between probes of a device at the next clock up
+static const std::chrono::milliseconds trialInterval(50);
+
+// Each raise adds an eighth to the clock, each back off removes a quarter
+static const uint32_t RAISE_DIVISOR = 8;
+static const uint32_t BACKOFF_DIVISOR = 4;
+
+I2CClockController::I2CClockController() {
+}
+
+I2CClockController::~I2CClockController() {
+}
+
+void I2CClockController::setFixed(uint8_t address, uint32_t baud) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  I2CClockState &state = _devices[address];
+
+  state = I2CClockState();
+  state.adaptive = false;
+  state.baud = state.minBaud = state.maxBaud = baud;
+}
+
+void I2CClockController::setAdaptive(uint8_t address, uint32_t minBaud, uint32_t maxBaud) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  I2CClockState &state = _devices[address];
+
+  state = I2CClockState();
+  state.adaptive = true;
+  state.baud = state.minBaud = minBaud;
+  state.maxBaud = (maxBaud > minBaud) ? maxBaud : minBaud;
+}
+
+uint32_t I2CClockController::clock(uint8_t address) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  auto found = _devices.find(address);
+
+  return (found == _devices.end()) ? 0 : found->second.baud;
+}
+
+void I2CClockController::record(uint8_t address, uint32_t baud, bool success) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  auto found = _devices.find(address);
+
+  if(found == _devices.end() || !found->second.adaptive) {
+    return;
+  }
+
+  I2CClockState &state = found->second;
+
+  if(success) {
+    state.successes++;
+
+    // Has this clock now been sustained?
+    if(state.successes >= RAISE_AFTER && baud > state.sustainedBaud) {
+      state.sustainedBaud = baud;
+    }
+  }
+  else {
+    // Remember where it failed, and back off from there
+    uint32_t backoff = baud - (baud / BACKOFF_DIVISOR);
+
+    state.ceilingBaud = baud;
+    state.baud = std::max(state.minBaud, std::min(state.baud, backoff));
+    state.successes = 0;
+    state.trials = 0;
+    state.backoffs++;
+  }
+}
+
+bool I2CClockController::due(std::chrono::steady_clock::time_point now, uint8_t &address, uint32_t &baud) {
+  std::unique_lock<std::mutex> lock(_mutex);
+
+  for(auto &entry : _devices) {
+    I2CClockState &state = entry.second;
+
+    // Only try to speed up once the current clock is working, unless
+    // we're already as fast as we're allowed to go
+    if(!state.adaptive || state.successes < RAISE_AFTER || state.baud >= state.maxBaud ||
+       now < state.lastTrial + trialInterval) {
+      continue;
+    }
+
+    uint32_t next = std::min(state.maxBaud, state.baud + (state.baud / RAISE_DIVISOR));
+
+    // Don't go back to a clock that's failed before until we've had a
+    // long enough run to try it again
+    if(state.ceilingBaud && next >= state.ceilingBaud && state.successes < RETRY_CEILING_AFTER) {
+      continue;
+    }
+
+    state.lastTrial = now;
+    address = entry.first;
+    baud = next;
+
+    return true;
+  }
+
+  return false;
+}
+
+void I2CClockController::recordTrial(uint8_t address, uint32_t baud, bool success) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  auto found = _devices.find(address);
+
+  if(found == _devices.end() || !found->second.adaptive) {
+    return;
+  }
+
+  I2CClockState &state = found->second;
+
+  if(success) {
+    // Speed up once it's proven itself
+    if(++state.trials >= RAISE_AFTER_TRIALS) {
+      if(state.ceilingBaud && baud >= state.ceilingBaud) {
+        state.ceilingBaud = 0;
+      }
+
+      state.baud = baud;
+      state.successes = 0;
+      state.trials = 0;
+      state.raises++;
+    }
+  }
+  else {
+    // Remember where it failed, and wait for another long run before
+    // trying it again
+    state.ceilingBaud = baud;
+    state.successes = 0;
+    state.trials = 0;
+  }
+}
+
+bool I2CClockController::get(uint8_t address, I2CClockState &state) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  auto found = _devices.find(address);
+
+  if(found == _devices.end()) {
+    return false;
+  }
+
+  state = found->second;
+  return true;
+}
+
+void I2CClockController::dump(std::ostream &out, const std::string &bus) {
+  std::unique_lock<std::mutex> lock(_mutex);
+
+  if(_devices.empty()) {
+    return;
+  }
+
+  out << "I2C bus " << bus << " clocks (baud)" << std::endl;
+  out << "  addr mode            min       max   current sustained   raises backoffs" << std::endl;
+
+  for(auto &entry : _devices) {
+    const I2CClockState &state = entry.second;
+
+    out << "  0x" << std::hex << std::setw(2) << std::setfill('0') << (int)entry.first
+        << std::dec << std::setfill(' ')
+        << " " << std::left << std::setw(9) << (state.adaptive ? "adaptive" : "fixed") << std::right
+        << std::setw(10) << state.minBaud
+        << std::setw(10) << state.maxBaud
+        << std::setw(10) << state.baud
+        << std::setw(10) << state.sustainedBaud
+        << std::setw(9) << state.raises
+        << std::setw(9) << state.backoffs
+        << std::endl;
+  }
+}
+
+}
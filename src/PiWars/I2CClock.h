@@ -0,0 +1,113 @@
+/**
+ * The I2CClockController decides which clock speed each device on a bus
+ * should be talked to at. Devices can be given a fixed clock, or a range
+ * for the clock to adapt within: the clock is backed off as soon as
+ * transactions start failing, and raised once probes sent at the next
+ * clock up, while the bus is idle, succeed. This finds the fastest speed
+ * each device can reliably sustain without risking real transactions on
+ * a clock that hasn't been proven.
+ */
+
+#ifndef _PIWARS_I2CCLOCK_H
+#define _PIWARS_I2CCLOCK_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+namespace PiWars {
+
+  // The clock state of a single device
+  struct I2CClockState {
+    bool adaptive; //<! true if the clock adapts to the error rate
+    uint32_t baud; //<! The clock transactions are currently sent at
+    uint32_t minBaud; //<! The slowest the clock can adapt to
+    uint32_t maxBaud; //<! The fastest the clock can adapt to
+    uint32_t sustainedBaud; //<! The fastest clock a full run of transactions has succeeded at
+    uint32_t ceilingBaud; //<! The slowest clock that has failed, or 0
+    uint32_t successes; //<! Transactions that have succeeded since the clock last changed
+    uint32_t trials; //<! Probes that have succeeded at the next clock up
+    std::chrono::steady_clock::time_point lastTrial; //<! When a probe was last sent at the next clock up
+    uint64_t raises; //<! Number of times the clock has been raised
+    uint64_t backoffs; //<! Number of times the clock has been backed off
+  };
+
+  class I2CClockController {
+    public:
+      I2CClockController();
+      ~I2CClockController();
+
+      // Sends all transactions to the device at a fixed clock speed
+      //
+      // @param address The address of the device
+      // @param baud The clock speed
+      void setFixed(uint8_t address, uint32_t baud);
+
+      // Lets the clock speed of the device adapt within the range,
+      // starting from the slowest
+      //
+      // @param address The address of the device
+      // @param minBaud The slowest clock to use
+      // @param maxBaud The fastest clock to try
+      void setAdaptive(uint8_t address, uint32_t minBaud, uint32_t maxBaud);
+
+      // Returns the clock the next transaction to the device should use
+      //
+      // @param address The address of the device
+      //
+      // @returns The clock speed, or 0 if the device hasn't been configured
+      uint32_t clock(uint8_t address);
+
+      // Records the outcome of a transaction, backing off the clock if
+      // it failed
+      //
+      // @param address The address of the device
+      // @param baud The clock the transaction was sent at
+      // @param success true if the transaction succeeded
+      void record(uint8_t address, uint32_t baud, bool success);
+
+      // Finds a device that's due a probe at the next clock up, to see if
+      // it can be raised. The probes should only be sent while the bus is
+      // idle.
+      //
+      // @param now The current time
+      // @param address Filled in with the device due a probe, if any
+      // @param baud Filled in with the clock to probe it at
+      //
+      // @returns true if a device is due a probe
+      bool due(std::chrono::steady_clock::time_point now, uint8_t &address, uint32_t &baud);
+
+      // Records the outcome of a probe at the next clock up, raising the
+      // clock once enough have succeeded
+      //
+      // @param address The address of the device
+      // @param baud The clock the probe was sent at
+      // @param success true if the probe succeeded
+      void recordTrial(uint8_t address, uint32_t baud, bool success);
+
+      // Takes a copy of the clock state of the device
+      //
+      // @param address The address of the device
+      // @param state Filled in with the state
+      //
+      // @returns true if the device has been configured
+      bool get(uint8_t address, I2CClockState &state);
+
+      // Writes a summary of the clock state of every device
+      //
+      // @param out Where to write the summary
+      // @param bus The name of the bus, to head the summary with
+      void dump(std::ostream &out, const std::string &bus);
+
+    private:
+      std::map<uint8_t, I2CClockState> _devices; //<! The clock state of each configured device
+      std::mutex _mutex; //<! Protects access to the devices
+  };
+
+}
+
+#endif
@@ -0,0 +1,128 @@
+/**
+ * The I2CPresence keeps track of which devices on a bus are present,
+ * from the outcome of every transaction sent to them. Devices that have
+ * gone quiet are due a heartbeat probe, so their state never gets stale,
+ * and checking if a device is present never needs to touch the bus.
+ */
+
+#include "I2CPresence.h"
+
+namespace PiWars
+{
+
+// How many transactions in a row must fail before a device is taken to
+// be gone
+static const unsigned ABSENT_AFTER = 3;
+
+I2CPresence::I2CPresence() : _heartbeat(0) {
+}
+
+I2CPresence::~I2CPresence() {
+}
+
+void I2CPresence::track(uint8_t address) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  auto found = _devices.find(address);
+
+  if(found == _devices.end()) {
+    Device &device = _devices[address];
+
+    device.known = false;
+    device.present = false;
+    device.failures = 0;
+
+    // Probe it as soon as the bus is free
+    device.lastSent = clock::time_point();
+    found = _devices.find(address);
+  }
+
+  found->second.tracked = true;
+}
+
+void I2CPresence::setHeartbeat(std::chrono::milliseconds interval) {
+  std::unique_lock<std::mutex> lock(_mutex);
+
+  _heartbeat = interval;
+}
+
+void I2CPresence::record(uint8_t address, bool success, clock::time_point when) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  auto found = _devices.find(address);
+
+  if(found == _devices.end()) {
+    Device &device = _devices[address];
+
+    device.tracked = false;
+    device.known = false;
+    device.failures = 0;
+    found = _devices.find(address);
+  }
+
+  Device &device = found->second;
+
+  if(success) {
+    device.present = true;
+    device.failures = 0;
+  }
+  else {
+    device.failures++;
+
+    // The first answer is taken as it is
+    if(!device.known || device.failures >= ABSENT_AFTER) {
+      device.present = false;
+    }
+  }
+
+  device.known = true;
+  device.lastSent = when;
+}
+
+bool I2CPresence::get(uint8_t address, bool &present) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  auto found = _devices.find(address);
+
+  if(found == _devices.end() || !found->second.known) {
+    return false;
+  }
+
+  present = found->second.present;
+  return true;
+}
+
+bool I2CPresence::due(clock::time_point now, uint8_t &address, clock::time_point &next) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  bool found = false;
+
+  next = clock::time_point::max();
+
+  if(0 == _heartbeat.count()) {
+    return false;
+  }
+
+  // Find the device that's been quiet the longest
+  for(auto &device : _devices) {
+    if(device.second.tracked && (!found || device.second.lastSent < next)) {
+      address = device.first;
+      next = device.second.lastSent;
+      found = true;
+    }
+  }
+
+  if(!found) {
+    next = clock::time_point::max();
+    return false;
+  }
+
+  next += _heartbeat;
+
+  if(next > now) {
+    return false;
+  }
+
+  // Don't probe it again while this one is on its way
+  _devices[address].lastSent = now;
+
+  return true;
+}
+
+}
@@ -0,0 +1,84 @@
+/**
+ * The I2CPresence keeps track of which devices on a bus are present,
+ * from the outcome of every transaction sent to them. Devices that have
+ * gone quiet are due a heartbeat probe, so their state never gets stale,
+ * and checking if a device is present never needs to touch the bus.
+ */
+
+#ifndef _PIWARS_I2CPRESENCE_H
+#define _PIWARS_I2CPRESENCE_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <map>
+#include <mutex>
+
+namespace PiWars {
+
+  class I2CPresence {
+    public:
+      typedef std::chrono::steady_clock clock;
+
+      I2CPresence();
+      ~I2CPresence();
+
+      // Keeps the device's state up to date, having it probed if it goes
+      // a heartbeat interval without any transactions
+      //
+      // @param address The address of the device
+      void track(uint8_t address);
+
+      // Sets how often quiet devices are probed
+      //
+      // @param interval The interval, or zero to stop probing
+      void setHeartbeat(std::chrono::milliseconds interval);
+
+      // Records the outcome of a transaction sent to the device. One
+      // success is enough to show it's there, but it must fail several
+      // times in a row before it's taken to be gone, so a single glitch
+      // doesn't lose it.
+      //
+      // @param address The address of the device
+      // @param success true if the transaction succeeded
+      // @param when When the transaction was sent
+      void record(uint8_t address, bool success, clock::time_point when);
+
+      // Checks if the device is present
+      //
+      // @param address The address of the device
+      // @param present Filled in with true if the device is present
+      //
+      // @returns false if nothing has been sent to the device yet
+      bool get(uint8_t address, bool &present);
+
+      // Finds a tracked device that's due a heartbeat probe
+      //
+      // @param now The current time
+      // @param address Filled in with the device due a probe, if any
+      // @param next Filled in with when the next probe will be due, if
+      //             none are due now, or clock::time_point::max() if
+      //             there's nothing to probe
+      //
+      // @returns true if a device is due a probe, false if not or the
+      //          heartbeat is stopped
+      bool due(clock::time_point now, uint8_t &address, clock::time_point &next);
+
+    private:
+      // The state of a single device
+      struct Device {
+        bool tracked; //<! Is the device probed once it's been quiet?
+        bool known; //<! Has anything been sent to the device?
+        bool present; //<! Is the device present?
+        unsigned failures; //<! Transactions that have failed in a row
+        clock::time_point lastSent; //<! When a transaction was last sent, or a probe last queued
+      };
+
+      std::map<uint8_t, Device> _devices; //<! The state of each device
+      std::chrono::milliseconds _heartbeat; //<! How often quiet devices are probed, or zero
+      std::mutex _mutex; //<! Protects access to the devices
+  };
+
+}
+
+#endif
@@ -0,0 +1,158 @@
+/**
+ * The I2CRegisterMap class provides access to the registers of an I2C
+ * device that uses 16 bit register addresses (e.g. the VL6180).
+ *
+ * A shadow copy of every register written is kept so that writing a value
+ * the register already holds doesn't touch the bus, and queued up
+ * accesses to neighbouring registers are merged into burst reads
+ * and writes.
+ */
+
+#include "I2CRegisterMap.h"
+#include "I2C.h"
+
+namespace PiWars
+{
+
+// The most registers that can be accessed in a single burst, allowing for
+// the two bytes of register address at the start of each message
+const static size_t BURST_MAX = I2CTransaction::MAX_MESSAGE_LENGTH - 2;
+
+I2CRegisterMap::I2CRegisterMap(I2C *i2c) : _i2c(i2c) {
+}
+
+I2CRegisterMap::~I2CRegisterMap() {
+}
+
+void I2CRegisterMap::invalidate() {
+  _shadow.clear();
+}
+
+void I2CRegisterMap::queueWrite(uint16_t reg, uint8_t value) {
+  auto cached = _shadow.find(reg);
+
+  // Skip the write if the register already holds the value
+  if(cached != _shadow.end() && cached->second == value) {
+    return;
+  }
+
+  _queue.push_back(Access { false, true, reg, value, nullptr });
+}
+
+void I2CRegisterMap::queueWrite(const I2CRegisterValue *table, size_t count) {
+  for(size_t i = 0; i < count; i++) {
+    queueWrite(table[i].reg, table[i].value);
+  }
+}
+
+void I2CRegisterMap::queueStrobe(uint16_t reg, uint8_t value) {
+  _queue.push_back(Access { false, false, reg, value, nullptr });
+}
+
+void I2CRegisterMap::queueRead(uint16_t reg, uint8_t &value) {
+  _queue.push_back(Access { true, false, reg, 0, &value });
+}
+
+bool I2CRegisterMap::flush() {
+  I2CTransaction transaction;
+  std::vector<char> readBuffer;
+  size_t readLength = 0;
+  bool success;
+
+  // Nothing to do?
+  if(_queue.empty()) {
+    return true;
+  }
+
+  // Size the read buffer up front, as the transaction will hold pointers
+  // into it
+  for(auto &access : _queue) {
+    if(access.read) {
+      readLength++;
+    }
+  }
+  readBuffer.resize(readLength);
+  readLength = 0;
+
+  for(size_t first = 0; first < _queue.size(); ) {
+    char message[I2CTransaction::MAX_MESSAGE_LENGTH];
+    size_t length = 0, last = first + 1;
+
+    // Keep extending the burst while the accesses are of the same type
+    // and to the next register along
+    while(last < _queue.size() && (last - first) < BURST_MAX &&
+          _queue[last].read == _queue[first].read &&
+          _queue[last].reg == _queue[first].reg + (last - first)) {
+      last++;
+    }
+
+    message[length++] = (_queue[first].reg >> 8) & 0xFF; // MSB of register address
+    message[length++] = _queue[first].reg & 0xFF; // LSB of register address
+
+    if(_queue[first].read) {
+      transaction.writeRead(message, length, &readBuffer[readLength], last - first);
+      readLength += last - first;
+    }
+    else {
+      for(size_t i = first; i < last; i++) {
+        message[length++] = _queue[i].value;
+      }
+
+      transaction.write(message, length);
+    }
+
+    first = last;
+  }
+
+  success = _i2c->execute(transaction);
+
+  // Pass back the values read, and update the shadow copy
+  readLength = 0;
+  for(auto &access : _queue) {
+    if(access.read) {
+      if(success) {
+        *access.destination = readBuffer[readLength];
+      }
+      readLength++;
+    }
+    else if(success && access.cache) {
+      _shadow[access.reg] = access.value;
+    }
+    else {
+      // We no longer know what the register holds
+      _shadow.erase(access.reg);
+    }
+  }
+
+  _queue.clear();
+
+  return success;
+}
+
+bool I2CRegisterMap::write(uint16_t reg, uint8_t value) {
+  queueWrite(reg, value);
+
+  return flush();
+}
+
+bool I2CRegisterMap::write(const I2CRegisterValue *table, size_t count) {
+  queueWrite(table, count);
+
+  return flush();
+}
+
+bool I2CRegisterMap::read(uint16_t reg, uint8_t &value) {
+  queueRead(reg, value);
+
+  return flush();
+}
+
+bool I2CRegisterMap::read(uint16_t reg, uint8_t *values, size_t count) {
+  for(size_t i = 0; i < count; i++) {
+    queueRead(reg + i, values[i]);
+  }
+
+  return flush();
+}
+
+}
@@ -0,0 +1,127 @@
+/**
+ * The I2CRegisterMap class provides access to the registers of an I2C
+ * device that uses 16 bit register addresses (e.g. the VL6180).
+ *
+ * A shadow copy of every register written is kept so that writing a value
+ * the register already holds doesn't touch the bus, and queued up
+ * accesses to neighbouring registers are merged into burst reads
+ * and writes.
+ */
+
+#ifndef _PIWARS_I2CREGISTERMAP_H
+#define _PIWARS_I2CREGISTERMAP_H
+
+#include <cstdint>
+#include <cstddef>
+#include <map>
+#include <vector>
+
+namespace PiWars {
+
+  // Forward declarations
+  class I2C;
+
+  // A single register and the value to write to it. Allows a device's
+  // initialisation sequence to be described as a constexpr table
+  struct I2CRegisterValue {
+    uint16_t reg; //<! The register address
+    uint8_t value; //<! The value to write
+  };
+
+  class I2CRegisterMap {
+    public:
+      // Initialise the register map for the specified device
+      //
+      // @param i2c The I2C device the registers belong to
+      I2CRegisterMap(I2C *i2c);
+      ~I2CRegisterMap();
+
+      // Forgets all the cached register values. Should be called whenever
+      // the device may have been reset behind our backs
+      void invalidate();
+
+      // Queues up a write of the register, unless the register is already
+      // known to hold the value
+      //
+      // @param reg The register to write
+      // @param value The value to write
+      void queueWrite(uint16_t reg, uint8_t value);
+
+      // Queues up writes for all the entries in the table, in order
+      //
+      // @param table The registers and values to write
+      // @param count The number of entries in the table
+      void queueWrite(const I2CRegisterValue *table, size_t count);
+
+      // Queues up a write of the register regardless of its cached value.
+      // Used for registers that trigger an action or clear themselves
+      //
+      // @param reg The register to write
+      // @param value The value to write
+      void queueStrobe(uint16_t reg, uint8_t value);
+
+      // Queues up a read of the register.
+      // Note: value must remain valid until flush() is called
+      //
+      // @param reg The register to read
+      // @param value Filled in with the register's value by flush()
+      void queueRead(uint16_t reg, uint8_t &value);
+
+      // Sends all the queued up reads and writes to the device as a
+      // single transaction, merging neighbouring registers into bursts
+      //
+      // @returns true if everything was successfully read and written
+      bool flush();
+
+      // Writes a single register, skipping the write if the register
+      // is already known to hold the value
+      //
+      // @param reg The register to write
+      // @param value The value to write
+      //
+      // @returns true if the register holds the value
+      bool write(uint16_t reg, uint8_t value);
+
+      // Writes all the entries in the table in a single transaction
+      //
+      // @param table The registers and values to write
+      // @param count The number of entries in the table
+      //
+      // @returns true if all the registers were written
+      bool write(const I2CRegisterValue *table, size_t count);
+
+      // Reads a single register
+      //
+      // @param reg The register to read
+      // @param value Filled in with the register's value
+      //
+      // @returns true if the register was read
+      bool read(uint16_t reg, uint8_t &value);
+
+      // Reads a block of consecutive registers in a single burst
+      //
+      // @param reg The first register to read
+      // @param values Filled in with the registers' values
+      // @param count Number of registers to read
+      //
+      // @returns true if all the registers were read
+      bool read(uint16_t reg, uint8_t *values, size_t count);
+
+    private:
+      // A single queued up register access
+      struct Access {
+        bool read; //<! true for a read, false for a write
+        bool cache; //<! true if the written value should be remembered
+        uint16_t reg; //<! The register to access
+        uint8_t value; //<! The value to write
+        uint8_t *destination; //<! Where to store the value read
+      };
+
+      I2C *_i2c; //<! The device the registers belong to
+      std::map<uint16_t, uint8_t> _shadow; //<! The last value successfully written to each register
+      std::vector<Access> _queue; //<! The accesses waiting to be flushed
+  };
+
+}
+
+#endif
@@ -0,0 +1,91 @@
+/**
+ * The I2CSimulator is a transport that simulates an I2C bus in-process,
+ * with models of the devices registered at their addresses. This allows
+ * the library to be run, tested and benchmarked without any hardware.
+ */
+
+#include "I2CSimulator.h"
+
+#include <chrono>
+#include <thread>
+
+namespace PiWars
+{
+
+I2CSimulator::I2CSimulator(uint32_t baud) : _baud(baud), _stuck(false) {
+}
+
+I2CSimulator::~I2CSimulator() {
+  for(auto &attached : _devices) {
+    delete attached.second.device;
+  }
+}
+
+void I2CSimulator::addDevice(uint8_t address, I2CSimulatedDevice *device, uint32_t maxBaud) {
+  // Replace any device already at the address
+  auto existing = _devices.find(address);
+
+  if(existing != _devices.end()) {
+    delete existing->second.device;
+  }
+
+  _devices[address].device = device;
+  _devices[address].maxBaud = maxBaud;
+}
+
+bool I2CSimulator::setClock(uint32_t baud) {
+  // A simulator that completes instantly has no clock to change
+  if(0 == _baud || 0 == baud) {
+    return false;
+  }
+
+  _baud = baud;
+  return true;
+}
+
+bool I2CSimulator::recover() {
+  return _stuck.exchange(false);
+}
+
+bool I2CSimulator::execute(uint8_t address, I2CTransaction &transaction) {
+  auto attached = _devices.find(address);
+  size_t bits = 0;
+  bool result = true;
+
+  if(!sendable(transaction)) {
+    return false;
+  }
+
+  for(auto &message : transaction.messages()) {
+    // Every message is an address byte followed by the data, each with an
+    // acknowledge bit
+    bits += 9 * (1 + message.length);
+
+    // Is there anything at that address to acknowledge, that can keep up?
+    if(_stuck || attached == _devices.end() ||
+       (attached->second.maxBaud && _baud > attached->second.maxBaud)) {
+      result = false;
+      break;
+    }
+
+    if(message.read) {
+      result = attached->second.device->read(message.buffer, message.length);
+    }
+    else {
+      result = attached->second.device->write(transaction.data(message), message.length);
+    }
+
+    if(!result) {
+      break;
+    }
+  }
+
+  // Take as long as the real bus would
+  if(_baud) {
+    std::this_thread::sleep_for(std::chrono::microseconds((bits * 1000000) / _baud));
+  }
+
+  return result;
+}
+
+}
@@ -0,0 +1,93 @@
+/**
+ * The I2CSimulator is a transport that simulates an I2C bus in-process,
+ * with models of the devices registered at their addresses. This allows
+ * the library to be run, tested and benchmarked without any hardware.
+ */
+
+#ifndef _PIWARS_I2CSIMULATOR_H
+#define _PIWARS_I2CSIMULATOR_H
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <map>
+
+#include "I2CTransport.h"
+
+namespace PiWars {
+
+  // The model of a single device on the simulated bus
+  class I2CSimulatedDevice {
+    public:
+      virtual ~I2CSimulatedDevice() {}
+
+      // Called when the master writes a message to the device
+      //
+      // @param bytes The bytes written
+      // @param length Number of bytes written
+      //
+      // @returns true if the device acknowledged the write
+      virtual bool write(const char *bytes, size_t length) = 0;
+
+      // Called when the master reads a message from the device
+      //
+      // @param buffer Filled in with the bytes read
+      // @param length Number of bytes to read
+      //
+      // @returns true if the device acknowledged the read
+      virtual bool read(char *buffer, size_t length) = 0;
+  };
+
+  class I2CSimulator : public I2CTransport {
+    public:
+      // Creates an empty simulated bus
+      //
+      // @param baud The clock speed of the bus to simulate. Each transaction
+      //             takes as long as it would on a real bus. 0 disables this,
+      //             so transactions complete instantly.
+      I2CSimulator(uint32_t baud = 0);
+      ~I2CSimulator();
+
+      // Adds a device to the bus
+      //
+      // @param address The address of the device
+      // @param device The model of the device. The simulator takes ownership
+      //               of it, but it remains valid until the simulator is
+      //               destroyed so can be used to control the model.
+      // @param maxBaud The fastest clock the device copes with. Transactions
+      //                sent faster than this fail. 0 means no limit.
+      void addDevice(uint8_t address, I2CSimulatedDevice *device, uint32_t maxBaud = 0);
+
+      // Passes each message in the transaction on to the device at the
+      // address. Fails if there is no device there.
+      bool execute(uint8_t address, I2CTransaction &transaction);
+
+      // Changes the clock speed of the simulated bus. Only possible if
+      // the simulator was created with a clock speed.
+      bool setClock(uint32_t baud);
+      uint32_t clock() const { return _baud; }
+
+      // Clears the bus if it has been made stuck
+      bool recover();
+
+      // Simulates a device holding SDA low, causing every transaction
+      // to fail until the bus is recovered
+      //
+      // @param stuck true to make the bus stuck
+      void setStuck(bool stuck) { _stuck = stuck; }
+
+    private:
+      // A device attached to the bus
+      struct Attached {
+        I2CSimulatedDevice *device; //<! The model of the device
+        uint32_t maxBaud; //<! The fastest clock the device copes with
+      };
+
+      uint32_t _baud; //<! The clock speed of the simulated bus
+      std::atomic<bool> _stuck; //<! true if SDA is being held low
+      std::map<uint8_t, Attached> _devices; //<! The devices on the bus
+  };
+
+}
+
+#endif
@@ -0,0 +1,193 @@
+/**
+ * I2CStats keeps track of how long transactions on an I2C bus take, and
+ * how often they fail, broken down by device and type of operation. This
+ * allows the devices eating into a control loop's time budget to be found.
+ */
+
+#include "I2CStats.h"
+
+#include <iomanip>
+
+namespace PiWars
+{
+
+I2CHistogram::I2CHistogram() : _buckets(), _count(0), _total(0), _min(0), _max(0) {
+}
+
+void I2CHistogram::record(uint64_t value) {
+  _buckets[bucket(value)]++;
+
+  if(0 == _count || value < _min) {
+    _min = value;
+  }
+
+  if(value > _max) {
+    _max = value;
+  }
+
+  _count++;
+  _total += value;
+}
+
+uint64_t I2CHistogram::percentile(double percentile) const {
+  uint64_t wanted = (uint64_t)((percentile / 100.0) * _count + 0.5);
+  uint64_t seen = 0;
+
+  if(0 == _count) {
+    return 0;
+  }
+
+  // Always include at least one value
+  if(0 == wanted) {
+    wanted = 1;
+  }
+
+  for(size_t i = 0; i < BUCKETS; i++) {
+    seen += _buckets[i];
+
+    if(seen >= wanted) {
+      // The bucket's upper bound may be beyond anything recorded
+      uint64_t value = bucketValue(i);
+
+      return (value < _max) ? value : _max;
+    }
+  }
+
+  return _max;
+}
+
+size_t I2CHistogram::bucket(uint64_t value) {
+  // Small values get a bucket each
+  if(value < SUB_BUCKETS) {
+    return value;
+  }
+
+  // Larger values share buckets, keeping the top SUB_BUCKET_BITS
+  // bits of the value
+  size_t top = 63 - __builtin_clzll(value);
+  size_t shift = top - (SUB_BUCKET_BITS - 1);
+  size_t index = SUB_BUCKETS + ((shift - 1) * HALF_BUCKETS) + ((value >> shift) - HALF_BUCKETS);
+
+  return (index < BUCKETS) ? index : BUCKETS - 1;
+}
+
+uint64_t I2CHistogram::bucketValue(size_t bucket) {
+  if(bucket < SUB_BUCKETS) {
+    return bucket;
+  }
+
+  size_t shift = ((bucket - SUB_BUCKETS) / HALF_BUCKETS) + 1;
+  uint64_t top = ((bucket - SUB_BUCKETS) % HALF_BUCKETS) + HALF_BUCKETS;
+
+  return ((top + 1) << shift) - 1;
+}
+
+I2CStats::I2CStats() {
+}
+
+I2CStats::~I2CStats() {
+}
+
+I2COperation I2CStats::operation(const I2CTransaction &transaction) {
+  const std::vector<I2CTransaction::Message> &messages = transaction.messages();
+
+  if(1 == messages.size()) {
+    return messages[0].read ? I2COperation::READ : I2COperation::WRITE;
+  }
+
+  if(2 == messages.size() && !messages[0].read && messages[0].repeatedStart && messages[1].read) {
+    return I2COperation::WRITE_READ;
+  }
+
+  return I2COperation::BATCH;
+}
+
+const char *I2CStats::name(I2COperation operation) {
+  switch(operation) {
+    case I2COperation::WRITE:
+      return "write";
+    case I2COperation::READ:
+      return "read";
+    case I2COperation::WRITE_READ:
+      return "write/read";
+    case I2COperation::BATCH:
+      return "batch";
+  }
+
+  return "unknown";
+}
+
+void I2CStats::record(uint8_t address, const I2CTransaction &transaction, clock::duration wait, clock::duration latency, bool success) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  I2COperationStats &stats = _stats[Key(address, operation(transaction))];
+
+  stats.transactions++;
+  stats.wait.record(std::chrono::duration_cast<std::chrono::microseconds>(wait).count());
+  stats.latency.record(std::chrono::duration_cast<std::chrono::microseconds>(latency).count());
+
+  if(success) {
+    stats.bytesWritten += transaction.writeLength();
+    stats.bytesRead += transaction.readLength();
+  }
+  else {
+    stats.failures++;
+  }
+}
+
+void I2CStats::recordRetry(uint8_t address, const I2CTransaction &transaction) {
+  std::unique_lock<std::mutex> lock(_mutex);
+
+  _stats[Key(address, operation(transaction))].retries++;
+}
+
+bool I2CStats::get(uint8_t address, I2COperation operation, I2COperationStats &stats) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  auto found = _stats.find(Key(address, operation));
+
+  if(found == _stats.end()) {
+    stats = I2COperationStats();
+    return false;
+  }
+
+  stats = found->second;
+  return true;
+}
+
+void I2CStats::reset() {
+  std::unique_lock<std::mutex> lock(_mutex);
+
+  _stats.clear();
+}
+
+void I2CStats::dump(std::ostream &out, const std::string &bus) {
+  std::unique_lock<std::mutex> lock(_mutex);
+
+  if(_stats.empty()) {
+    return;
+  }
+
+  out << "I2C bus " << bus << " (latencies in us)" << std::endl;
+  out << "  addr operation     count  fail retry  written     read   min   p50   p90   p99   max  wait p99" << std::endl;
+
+  for(auto &entry : _stats) {
+    const I2COperationStats &stats = entry.second;
+
+    out << "  0x" << std::hex << std::setw(2) << std::setfill('0') << (int)entry.first.first
+        << std::dec << std::setfill(' ')
+        << " " << std::left << std::setw(10) << name(entry.first.second) << std::right
+        << std::setw(9) << stats.transactions
+        << std::setw(6) << stats.failures
+        << std::setw(6) << stats.retries
+        << std::setw(9) << stats.bytesWritten
+        << std::setw(9) << stats.bytesRead
+        << std::setw(6) << stats.latency.min()
+        << std::setw(6) << stats.latency.percentile(50)
+        << std::setw(6) << stats.latency.percentile(90)
+        << std::setw(6) << stats.latency.percentile(99)
+        << std::setw(6) << stats.latency.max()
+        << std::setw(10) << stats.wait.percentile(99)
+        << std::endl;
+  }
+}
+
+}
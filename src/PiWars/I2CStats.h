@@ -0,0 +1,163 @@
+/**
+ * I2CStats keeps track of how long transactions on an I2C bus take, and
+ * how often they fail, broken down by device and type of operation. This
+ * allows the devices eating into a control loop's time budget to be found.
+ */
+
+#ifndef _PIWARS_I2CSTATS_H
+#define _PIWARS_I2CSTATS_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <utility>
+
+#include "I2CTransaction.h"
+
+namespace PiWars {
+
+  // The types of transaction sent to a device
+  enum class I2COperation {
+    WRITE, //<! A single write
+    READ, //<! A single read
+    WRITE_READ, //<! A write followed by a read (e.g. a register read)
+    BATCH //<! Anything else
+  };
+
+  // A histogram of latencies with a bounded relative error, in the style
+  // of an HDR histogram. Values are recorded in microseconds into buckets
+  // that double in width every HALF_BUCKETS buckets, so every value is
+  // held to within about 3% without needing a bucket per microsecond.
+  class I2CHistogram {
+    public:
+      I2CHistogram();
+
+      // Records a single value
+      //
+      // @param value The latency in microseconds
+      void record(uint64_t value);
+
+      // Returns the number of values recorded
+      //
+      // @returns the number of values
+      uint64_t count() const { return _count; }
+
+      // Returns the smallest value recorded
+      //
+      // @returns the value in microseconds, or 0 if nothing was recorded
+      uint64_t min() const { return _count ? _min : 0; }
+
+      // Returns the largest value recorded
+      //
+      // @returns the value in microseconds
+      uint64_t max() const { return _max; }
+
+      // Returns the mean of the values recorded
+      //
+      // @returns the mean in microseconds
+      double mean() const { return _count ? (double)_total / _count : 0.0; }
+
+      // Returns the value that the given percentage of values are at or below
+      //
+      // @param percentile The percentile to find, from 0 to 100
+      //
+      // @returns the value in microseconds
+      uint64_t percentile(double percentile) const;
+
+    private:
+      static const size_t SUB_BUCKET_BITS = 6; //<! Precision of each bucket, in bits
+      static const size_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS; //<! Values below this get a bucket each
+      static const size_t HALF_BUCKETS = SUB_BUCKETS / 2; //<! Buckets for each further power of two
+      static const size_t BUCKETS = SUB_BUCKETS + (HALF_BUCKETS * 32); //<! Enough to cover days
+
+      static size_t bucket(uint64_t value); //<! Finds the bucket a value goes in
+      static uint64_t bucketValue(size_t bucket); //<! Highest value that can be held in a bucket
+
+      uint64_t _buckets[BUCKETS]; //<! The number of values in each bucket
+      uint64_t _count; //<! Number of values recorded
+      uint64_t _total; //<! Sum of the values recorded
+      uint64_t _min; //<! Smallest value recorded
+      uint64_t _max; //<! Largest value recorded
+  };
+
+  // Everything recorded for one type of operation on one device
+  struct I2COperationStats {
+    I2CHistogram latency; //<! How long the transactions took on the bus
+    I2CHistogram wait; //<! How long the transactions were queued for before being sent
+    uint64_t transactions; //<! Number of transactions sent
+    uint64_t bytesWritten; //<! Number of bytes written by successful transactions
+    uint64_t bytesRead; //<! Number of bytes read by successful transactions
+    uint64_t failures; //<! Number of transactions that failed
+    uint64_t retries; //<! Number of times a transaction was retried
+
+    I2COperationStats() : transactions(0), bytesWritten(0), bytesRead(0), failures(0), retries(0) {}
+  };
+
+  class I2CStats {
+    public:
+      typedef std::chrono::steady_clock clock;
+
+      I2CStats();
+      ~I2CStats();
+
+      // Works out what type of operation a transaction is
+      //
+      // @param transaction The transaction
+      //
+      // @returns the type of operation
+      static I2COperation operation(const I2CTransaction &transaction);
+
+      // Returns the name of a type of operation, for reporting
+      //
+      // @param operation The type of operation
+      //
+      // @returns the name
+      static const char *name(I2COperation operation);
+
+      // Records the outcome of a single transaction
+      //
+      // @param address The address of the device
+      // @param transaction The transaction that was sent
+      // @param wait How long the transaction was queued for
+      // @param latency How long the transaction took to send
+      // @param success true if the transaction succeeded
+      void record(uint8_t address, const I2CTransaction &transaction, clock::duration wait, clock::duration latency, bool success);
+
+      // Records that a transaction is being retried
+      //
+      // @param address The address of the device
+      // @param transaction The transaction being retried
+      void recordRetry(uint8_t address, const I2CTransaction &transaction);
+
+      // Takes a copy of what has been recorded for a device
+      //
+      // @param address The address of the device
+      // @param operation The type of operation
+      // @param stats Filled in with a copy of the statistics
+      //
+      // @returns true if anything has been recorded
+      bool get(uint8_t address, I2COperation operation, I2COperationStats &stats);
+
+      // Forgets everything that has been recorded
+      void reset();
+
+      // Writes a summary of everything recorded
+      //
+      // @param out Where to write the summary
+      // @param bus The name of the bus, to head the summary with
+      void dump(std::ostream &out, const std::string &bus);
+
+    private:
+      typedef std::pair<uint8_t, I2COperation> Key;
+
+      std::map<Key, I2COperationStats> _stats; //<! The statistics for each device and operation
+      std::mutex _mutex; //<! Protects access to the statistics
+  };
+
+}
+
+#endif
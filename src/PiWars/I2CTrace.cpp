@@ -0,0 +1,305 @@
+/**
+ * The I2CTraceRecorder keeps a binary record of every transaction sent
+ * on the I2C buses, including the bytes written, the bytes read back and
+ * how long it took. Recent transactions are held in a preallocated ring
+ * buffer, and can optionally be spilled to a file as they're recorded
+ * so a whole run can be kept.
+ *
+ * The I2CTraceReader reads the transactions back from a trace file, e.g.
+ * for the I2CTransportReplay to feed back through the I2C classes.
+ *
+ * A trace file starts with TRACE_MAGIC, followed by the records. All
+ * values are little endian. Each record is:
+ *   u32 length of the whole record
+ *   u64 timestamp (ns)
+ *   u32 duration (ns)
+ *   u8  bus
+ *   u8  address
+ *   u8  result
+ *   u8  number of messages
+ * followed by each message:
+ *   u8  flags (bit 0 read, bit 1 repeated start)
+ *   u16 length
+ *   the bytes written or read
+ */
+
+#include "I2CTrace.h"
+
+#include <algorithm>
+#include <iostream>
+#include "string.h"
+
+namespace PiWars
+{
+
+// Identifies a trace file
+static const char TRACE_MAGIC[8] = { 'P', 'W', 'I', '2', 'C', 'T', 'R', '1' };
+
+// Sizes of the parts of a record
+static const size_t RECORD_HEADER_LENGTH = 20;
+static const size_t MESSAGE_HEADER_LENGTH = 3;
+
+// Message flags
+static const uint8_t MESSAGE_READ = 0x01;
+static const uint8_t MESSAGE_REPEATED_START = 0x02;
+
+// Stores a value little endian
+static void store(char *bytes, uint64_t value, size_t length) {
+  for(size_t i = 0; i < length; i++) {
+    bytes[i] = (char)((value >> (8 * i)) & 0xFF);
+  }
+}
+
+// Loads a little endian value
+static uint64_t load(const char *bytes, size_t length) {
+  uint64_t value = 0;
+
+  for(size_t i = 0; i < length; i++) {
+    value |= (uint64_t)(uint8_t)bytes[i] << (8 * i);
+  }
+
+  return value;
+}
+
+I2CTraceRecorder::I2CTraceRecorder(size_t capacity)
+  : _ring(capacity)
+  , _head(0)
+  , _tail(0)
+  , _used(0)
+  , _dropped(0)
+  , _spillThread(nullptr)
+  , _quit(false)
+{
+}
+
+I2CTraceRecorder::~I2CTraceRecorder() {
+  if(_spillThread) {
+    // Tell the thread to write out what's left and exit
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _quit = true;
+    }
+    _recorded.notify_one();
+
+    _spillThread->join();
+    delete _spillThread;
+    _spillThread = nullptr;
+  }
+}
+
+bool I2CTraceRecorder::spill(const std::string &path) {
+  if(_spillThread) {
+    return false;
+  }
+
+  _file.open(path, std::ios::binary | std::ios::trunc);
+  if(!_file) {
+    std::cerr << __func__ << ": Failed to open " << path << std::endl;
+    return false;
+  }
+
+  _file.write(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+  _spillThread = new std::thread(spillThread, this);
+
+  return true;
+}
+
+void I2CTraceRecorder::record(uint8_t bus, uint8_t address, const I2CTransaction &transaction, clock::time_point started, clock::duration duration, bool result) {
+  const std::vector<I2CTransaction::Message> &messages = transaction.messages();
+  size_t length = RECORD_HEADER_LENGTH;
+  char header[RECORD_HEADER_LENGTH];
+
+  for(auto &message : messages) {
+    length += MESSAGE_HEADER_LENGTH + message.length;
+  }
+
+  // Will it ever fit?
+  if(length > _ring.size() || messages.size() > 0xFF) {
+    _dropped++;
+    return;
+  }
+
+  store(&header[0], length, 4);
+  store(&header[4], std::chrono::duration_cast<std::chrono::nanoseconds>(started.time_since_epoch()).count(), 8);
+  store(&header[12], std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count(), 4);
+  header[16] = (char)bus;
+  header[17] = (char)address;
+  header[18] = result ? 1 : 0;
+  header[19] = (char)messages.size();
+
+  std::unique_lock<std::mutex> lock(_mutex);
+
+  // Make room by forgetting the oldest records
+  while(_ring.size() - _used < length) {
+    char oldest[4];
+
+    for(size_t i = 0; i < sizeof(oldest); i++) {
+      oldest[i] = _ring[(_tail + i) % _ring.size()];
+    }
+
+    size_t oldestLength = load(oldest, sizeof(oldest));
+
+    _tail = (_tail + oldestLength) % _ring.size();
+    _used -= oldestLength;
+    _dropped++;
+  }
+
+  put(header, RECORD_HEADER_LENGTH);
+
+  for(auto &message : messages) {
+    char messageHeader[MESSAGE_HEADER_LENGTH];
+
+    messageHeader[0] = (message.read ? MESSAGE_READ : 0) | (message.repeatedStart ? MESSAGE_REPEATED_START : 0);
+    store(&messageHeader[1], message.length, 2);
+
+    put(messageHeader, MESSAGE_HEADER_LENGTH);
+    put(message.read ? message.buffer : transaction.data(message), message.length);
+  }
+
+  if(_spillThread) {
+    _recorded.notify_one();
+  }
+}
+
+bool I2CTraceRecorder::save(const std::string &path) {
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  std::vector<char> records;
+
+  if(!file) {
+    std::cerr << __func__ << ": Failed to open " << path << std::endl;
+    return false;
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    copy(_tail, _used, records);
+  }
+
+  file.write(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+  file.write(records.data(), records.size());
+
+  return (bool)file;
+}
+
+void I2CTraceRecorder::copy(size_t from, size_t length, std::vector<char> &out) {
+  size_t first = std::min(length, _ring.size() - from);
+
+  out.insert(out.end(), &_ring[from], &_ring[from] + first);
+  out.insert(out.end(), &_ring[0], &_ring[0] + (length - first));
+}
+
+void I2CTraceRecorder::put(const void *bytes, size_t length) {
+  const char *source = (const char *)bytes;
+  size_t first = std::min(length, _ring.size() - _head);
+
+  memcpy(&_ring[_head], source, first);
+  memcpy(&_ring[0], source + first, length - first);
+
+  _head = (_head + length) % _ring.size();
+  _used += length;
+}
+
+void I2CTraceRecorder::spillThread(I2CTraceRecorder *recorder) {
+  std::unique_lock<std::mutex> lock(recorder->_mutex);
+  std::vector<char> records;
+
+  while(true) {
+    // Wait for something to write
+    if(0 == recorder->_used) {
+      if(recorder->_quit) {
+        break;
+      }
+
+      recorder->_recorded.wait(lock);
+      continue;
+    }
+
+    // Take everything recorded so far
+    records.clear();
+    recorder->copy(recorder->_tail, recorder->_used, records);
+    recorder->_tail = recorder->_head;
+    recorder->_used = 0;
+
+    // and write it out without holding up the recording
+    lock.unlock();
+    recorder->_file.write(records.data(), records.size());
+    lock.lock();
+  }
+
+  recorder->_file.close();
+}
+
+I2CTraceReader::I2CTraceReader() {
+}
+
+I2CTraceReader::~I2CTraceReader() {
+}
+
+bool I2CTraceReader::open(const std::string &path) {
+  char magic[sizeof(TRACE_MAGIC)];
+
+  _file.open(path, std::ios::binary);
+  if(!_file) {
+    std::cerr << __func__ << ": Failed to open " << path << std::endl;
+    return false;
+  }
+
+  if(!_file.read(magic, sizeof(magic)) || 0 != memcmp(magic, TRACE_MAGIC, sizeof(magic))) {
+    std::cerr << __func__ << ": " << path << " isn't an I2C trace" << std::endl;
+    _file.close();
+    return false;
+  }
+
+  return true;
+}
+
+bool I2CTraceReader::next(I2CTraceEntry &entry) {
+  char header[RECORD_HEADER_LENGTH];
+  std::vector<char> body;
+  size_t offset = 0;
+
+  if(!_file.read(header, RECORD_HEADER_LENGTH)) {
+    return false;
+  }
+
+  size_t length = load(&header[0], 4);
+
+  if(length < RECORD_HEADER_LENGTH) {
+    return false;
+  }
+
+  body.resize(length - RECORD_HEADER_LENGTH);
+  if(!_file.read(body.data(), body.size())) {
+    return false;
+  }
+
+  entry.timestamp = load(&header[4], 8);
+  entry.duration = load(&header[12], 4);
+  entry.bus = (uint8_t)header[16];
+  entry.address = (uint8_t)header[17];
+  entry.result = (0 != header[18]);
+  entry.messages.resize((uint8_t)header[19]);
+
+  for(auto &message : entry.messages) {
+    if(offset + MESSAGE_HEADER_LENGTH > body.size()) {
+      return false;
+    }
+
+    uint8_t flags = (uint8_t)body[offset];
+    size_t messageLength = load(&body[offset + 1], 2);
+
+    offset += MESSAGE_HEADER_LENGTH;
+    if(offset + messageLength > body.size()) {
+      return false;
+    }
+
+    message.read = (0 != (flags & MESSAGE_READ));
+    message.repeatedStart = (0 != (flags & MESSAGE_REPEATED_START));
+    message.data.assign(&body[offset], &body[offset] + messageLength);
+    offset += messageLength;
+  }
+
+  return true;
+}
+
+}
@@ -0,0 +1,146 @@
+/**
+ * The I2CTraceRecorder keeps a binary record of every transaction sent
+ * on the I2C buses, including the bytes written, the bytes read back and
+ * how long it took. Recent transactions are held in a preallocated ring
+ * buffer, and can optionally be spilled to a file as they're recorded
+ * so a whole run can be kept.
+ *
+ * The I2CTraceReader reads the transactions back from a trace file, e.g.
+ * for the I2CTransportReplay to feed back through the I2C classes.
+ */
+
+#ifndef _PIWARS_I2CTRACE_H
+#define _PIWARS_I2CTRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "I2CTransaction.h"
+
+namespace PiWars {
+
+  // A single recorded transaction
+  struct I2CTraceEntry {
+    // A single read or write within the transaction
+    struct Message {
+      bool read; //<! true if this was a read, false for a write
+      bool repeatedStart; //<! true if the next message followed with a repeated start
+      std::vector<char> data; //<! The bytes written, or the bytes read back
+    };
+
+    uint64_t timestamp; //<! When the transaction was sent, in nanoseconds on the steady clock
+    uint32_t duration; //<! How long the transaction took, in nanoseconds
+    uint8_t bus; //<! The bus the transaction was sent on
+    uint8_t address; //<! The address of the device
+    bool result; //<! Did the transaction succeed?
+    std::vector<Message> messages; //<! The reads and writes
+  };
+
+  class I2CTraceRecorder {
+    public:
+      typedef std::chrono::steady_clock clock;
+
+      // Creates a recorder
+      //
+      // @param capacity The size of the ring buffer in bytes
+      I2CTraceRecorder(size_t capacity = 1024 * 1024);
+      ~I2CTraceRecorder();
+
+      // Starts writing every recorded transaction out to a file, from a
+      // background thread so recording never waits on the file.
+      // Transactions are only lost if the file can't keep up with the
+      // ring buffer.
+      //
+      // @param path The file to write to
+      //
+      // @returns true if the file was opened
+      bool spill(const std::string &path);
+
+      // Records a single transaction. Called by the I2CBus after every
+      // transaction, so it must be quick.
+      //
+      // @param bus The bus the transaction was sent on
+      // @param address The address of the device
+      // @param transaction The transaction, including the bytes read
+      // @param started When the transaction was sent
+      // @param duration How long the transaction took
+      // @param result true if the transaction succeeded
+      void record(uint8_t bus, uint8_t address, const I2CTransaction &transaction, clock::time_point started, clock::duration duration, bool result);
+
+      // Writes everything currently in the ring buffer to a file, leaving
+      // the ring buffer untouched. Used to capture the transactions leading
+      // up to a problem when not spilling.
+      //
+      // @param path The file to write to
+      //
+      // @returns true if the file was written
+      bool save(const std::string &path);
+
+      // Returns how many transactions have been dropped, either because
+      // they were too large or were overwritten before being spilled
+      //
+      // @returns the number of transactions
+      uint64_t dropped() const { return _dropped; }
+
+    private:
+      static void spillThread(I2CTraceRecorder *recorder); //<! Writes the ring buffer out to the file
+
+      // Copies bytes out of the ring buffer, wrapping around its end
+      //
+      // @param from The offset of the first byte
+      // @param length The number of bytes to copy
+      // @param out Where to append them
+      void copy(size_t from, size_t length, std::vector<char> &out);
+
+      // Copies bytes into the ring buffer at the head, wrapping around its end
+      //
+      // @param bytes The bytes to copy
+      // @param length The number of bytes to copy
+      void put(const void *bytes, size_t length);
+
+      std::vector<char> _ring; //<! The ring buffer
+      size_t _head; //<! Offset the next record is written at
+      size_t _tail; //<! Offset of the oldest record
+      size_t _used; //<! Number of bytes in use
+      std::atomic<uint64_t> _dropped; //<! Number of transactions dropped
+      std::ofstream _file; //<! The file being spilled to
+      std::thread *_spillThread; //<! Writes the records out to the file
+      bool _quit; //<! Used to tell the spill thread to exit
+      std::mutex _mutex; //<! Protects access to the ring buffer
+      std::condition_variable _recorded; //<! Signalled when a record is added
+  };
+
+  class I2CTraceReader {
+    public:
+      I2CTraceReader();
+      ~I2CTraceReader();
+
+      // Opens a trace file
+      //
+      // @param path The file to read
+      //
+      // @returns true if the file is a trace file
+      bool open(const std::string &path);
+
+      // Reads the next transaction from the file
+      //
+      // @param entry Filled in with the transaction
+      //
+      // @returns true if a transaction was read, false at the end of the file
+      bool next(I2CTraceEntry &entry);
+
+    private:
+      std::ifstream _file; //<! The trace file
+  };
+
+}
+
+#endif
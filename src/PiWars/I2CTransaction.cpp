@@ -0,0 +1,86 @@
+/**
+ * An I2CTransaction is a list of reads and writes to a single I2C device
+ * that can be queued up and then sent to the device in one go, avoiding
+ * the overhead of a round trip to pigpiod for each individual access.
+ */
+
+#include "I2CTransaction.h"
+
+namespace PiWars
+{
+
+I2CTransaction::I2CTransaction() : _readLength(0) {
+}
+
+I2CTransaction::~I2CTransaction() {
+}
+
+void I2CTransaction::clear() {
+  _messages.clear();
+  _data.clear();
+  _readLength = 0;
+}
+
+bool I2CTransaction::write(const char *bytes, size_t length) {
+  Message message;
+
+  // Check the write can actually be sent
+  if(0 == length || length > MAX_MESSAGE_LENGTH) {
+    return false;
+  }
+
+  message.read = false;
+  message.repeatedStart = false;
+  message.length = length;
+  message.offset = _data.size();
+  message.buffer = nullptr;
+
+  // Take a copy of the bytes to write
+  _data.insert(_data.end(), bytes, bytes + length);
+  _messages.push_back(message);
+
+  return true;
+}
+
+bool I2CTransaction::writeByte(const uint8_t byte) {
+  char data = (char)byte;
+
+  return write(&data, 1);
+}
+
+bool I2CTransaction::read(char *buffer, size_t length) {
+  Message message;
+
+  // Check the read can actually be performed
+  if(0 == length || length > MAX_MESSAGE_LENGTH) {
+    return false;
+  }
+
+  message.read = true;
+  message.repeatedStart = false;
+  message.length = length;
+  message.offset = 0;
+  message.buffer = buffer;
+
+  _messages.push_back(message);
+  _readLength += length;
+
+  return true;
+}
+
+bool I2CTransaction::writeRead(const char *bytes, size_t writeLength, char *buffer, size_t readLength) {
+  // Validate both parts up front so we don't queue half the request
+  if(0 == writeLength || writeLength > MAX_MESSAGE_LENGTH ||
+     0 == readLength || readLength > MAX_MESSAGE_LENGTH) {
+    return false;
+  }
+
+  write(bytes, writeLength);
+
+  // Join the write to the read with a repeated start
+  _messages.back().repeatedStart = true;
+
+  return read(buffer, readLength);
+}
+
+}
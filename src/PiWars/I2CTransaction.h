@@ -0,0 +1,108 @@
+/**
+ * An I2CTransaction is a list of reads and writes to a single I2C device
+ * that can be queued up and then sent to the device in one go, avoiding
+ * the overhead of a round trip to pigpiod for each individual access.
+ */
+
+#ifndef _PIWARS_I2CTRANSACTION_H
+#define _PIWARS_I2CTRANSACTION_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace PiWars {
+
+  class I2CTransaction {
+    public:
+      // A single read or write within the transaction
+      struct Message {
+        bool read; //<! true if this is a read, false for a write
+        bool repeatedStart; //<! true if the next message follows with a repeated start instead of a stop
+        size_t length; //<! Number of bytes to read or write
+        size_t offset; //<! Offset of the bytes to write within the transaction's data
+        char *buffer; //<! Where the bytes should be read into
+      };
+
+      // The largest single read or write that can be queued
+      static const size_t MAX_MESSAGE_LENGTH = 255;
+
+      I2CTransaction();
+      ~I2CTransaction();
+
+      // Removes all queued messages, allowing the transaction to be reused
+      void clear();
+
+      // Checks if there is anything queued up
+      //
+      // @returns true if no messages have been queued
+      bool empty() const { return _messages.empty(); }
+
+      // Queues up a write to the device. The bytes are copied so
+      // don't need to remain valid until the transaction is executed
+      //
+      // @param bytes Pointer to the bytes to write
+      // @param length Number of bytes to write
+      //
+      // @returns true if the write was queued
+      bool write(const char *bytes, size_t length);
+
+      // Queues up a write of a single byte
+      //
+      // @param byte The byte to write
+      //
+      // @returns true if the write was queued
+      bool writeByte(const uint8_t byte);
+
+      // Queues up a read from the device.
+      // Note: The buffer must remain valid until the transaction is executed
+      //
+      // @param buffer Pointer to the buffer to read into
+      // @param length Number of bytes to read
+      //
+      // @returns true if the read was queued
+      bool read(char *buffer, size_t length);
+
+      // Queues up a write followed by a read, joined by a repeated start
+      // rather than a stop. This is how most devices expect a register
+      // to be selected and then read back.
+      //
+      // @param bytes Pointer to the bytes to write (e.g. the register)
+      // @param writeLength Number of bytes to write
+      // @param buffer Pointer to the buffer to read into
+      // @param readLength Number of bytes to read
+      //
+      // @returns true if the write and read were queued
+      bool writeRead(const char *bytes, size_t writeLength, char *buffer, size_t readLength);
+
+      // Returns the queued messages, in the order they should be sent
+      //
+      // @returns The queued messages
+      const std::vector<Message> &messages() const { return _messages; }
+
+      // Returns the bytes to be written for the specified message
+      //
+      // @param message A write message from this transaction
+      //
+      // @returns Pointer to the bytes to write
+      const char *data(const Message &message) const { return _data.data() + message.offset; }
+
+      // Returns the total number of bytes that will be read
+      //
+      // @returns the number of bytes
+      size_t readLength() const { return _readLength; }
+
+      // Returns the total number of bytes that will be written
+      //
+      // @returns the number of bytes
+      size_t writeLength() const { return _data.size(); }
+
+    private:
+      std::vector<Message> _messages; //<! The queued up messages
+      std::vector<char> _data; //<! Copy of all the bytes to be written
+      size_t _readLength; //<! Total number of bytes to be read
+  };
+
+}
+
+#endif
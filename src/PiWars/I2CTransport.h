@@ -0,0 +1,73 @@
+/**
+ * An I2CTransport is the mechanism used to actually talk to the devices
+ * on an I2C bus, allowing the same I2C device classes to be used whether
+ * the bus is accessed via pigpiod or directly via the kernel.
+ */
+
+#ifndef _PIWARS_I2CTRANSPORT_H
+#define _PIWARS_I2CTRANSPORT_H
+
+#include <cstdint>
+#include <cstddef>
+#include <iostream>
+
+#include "I2CTransaction.h"
+
+namespace PiWars {
+
+  class I2CTransport {
+    public:
+      virtual ~I2CTransport() {}
+
+      // Sends all the reads and writes queued up in the transaction
+      // to the specified device
+      //
+      // @param address The address of the I2C device
+      // @param transaction The queued up reads and writes
+      //
+      // @returns true if all the messages were sent, and all the
+      //          requested bytes read
+      virtual bool execute(uint8_t address, I2CTransaction &transaction) = 0;
+
+      // Changes the clock speed of the bus, if the transport allows it
+      //
+      // @param baud The new clock speed
+      //
+      // @returns true if the clock speed was changed
+      virtual bool setClock(uint32_t baud) { return false; }
+
+      // Returns the current clock speed of the bus
+      //
+      // @returns The clock speed, or 0 if it can't be changed
+      virtual uint32_t clock() const { return 0; }
+
+      // Checks if a device has been left holding the bus (e.g. by being
+      // reset part way through a read), and if so tries to free it
+      //
+      // @returns true if the bus was stuck and has been cleared
+      virtual bool recover() { return false; }
+
+    protected:
+      // Checks the transaction doesn't write zero bytes. pigpio's zip
+      // commands reject an empty write, and a device that sees just its
+      // address can't tell whether a command is coming, so it's refused
+      // before anything is sent.
+      //
+      // @param transaction The transaction to check
+      //
+      // @returns true if every message can be sent
+      static bool sendable(const I2CTransaction &transaction) {
+        for(auto &message : transaction.messages()) {
+          if(0 == message.length) {
+            std::cerr << __func__ << ": Can't send an empty I2C message" << std::endl;
+            return false;
+          }
+        }
+
+        return true;
+      }
+  };
+
+}
+
+#endif
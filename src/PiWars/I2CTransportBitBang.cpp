@@ -0,0 +1,230 @@
+/**
+ * Provides access to a 'bit banged' I2C bus, driven by pigpiod on
+ * a pair of GPIO pins.
+ */
+
+#include "I2CTransportBitBang.h"
+
+// The pigpiod_if header file doesn't protect itself when included from
+// C++, so force it to be treated as 'C' here.
+extern "C" {
+#include "pigpiod_if.h"
+}
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include "string.h"
+
+namespace PiWars
+{
+
+// The largest command and response buffers we pass to bb_i2c_zip
+const static size_t ZIP_COMMAND_MAX = 256;
+const static size_t ZIP_RESPONSE_MAX = 256;
+
+// The bb_i2c_zip commands
+const static char ZIP_END = 0x00;
+const static char ZIP_START = 0x02;
+const static char ZIP_STOP = 0x03;
+const static char ZIP_ADDRESS = 0x04;
+const static char ZIP_READ = 0x06;
+const static char ZIP_WRITE = 0x07;
+
+// Half an SCL period when clearing the bus, slow enough for any device
+const static std::chrono::microseconds RECOVER_HALF_PERIOD(5);
+
+// The lines are open drain, so are released by letting the pull up
+// take them high
+static void releaseLine(uint32_t pin) {
+  set_mode(pin, PI_INPUT);
+  std::this_thread::sleep_for(RECOVER_HALF_PERIOD);
+}
+
+// and driven low as an output
+static void pullLine(uint32_t pin) {
+  gpio_write(pin, 0);
+  set_mode(pin, PI_OUTPUT);
+  std::this_thread::sleep_for(RECOVER_HALF_PERIOD);
+}
+
+I2CTransportBitBang::I2CTransportBitBang(uint32_t sdaPin, uint32_t sclPin, uint32_t baud)
+  : _sdaPin(sdaPin)
+  , _sclPin(sclPin)
+  , _baud(baud)
+  , _open(false)
+{
+  // Create a 'bit bang' variant
+  if(0 == bb_i2c_open(_sdaPin, _sclPin, baud)) {
+    _open = true;
+  }
+  else {
+    std::cerr << "Failed to open bit bang port" << std::endl;
+  }
+}
+
+I2CTransportBitBang::~I2CTransportBitBang() {
+  if(_open) {
+    bb_i2c_close(_sdaPin);
+  }
+}
+
+bool I2CTransportBitBang::setClock(uint32_t baud) {
+  // pigpiod can only bit bang between 50 and 500000 baud
+  if(baud < 50 || baud > 500000) {
+    return false;
+  }
+
+  if(baud == _baud && _open) {
+    return true;
+  }
+
+  // The clock speed can only be set when the bus is opened
+  if(_open) {
+    bb_i2c_close(_sdaPin);
+    _open = false;
+  }
+
+  if(0 == bb_i2c_open(_sdaPin, _sclPin, baud)) {
+    _open = true;
+    _baud = baud;
+  }
+  else {
+    std::cerr << __func__ << ": Failed to reopen bit bang port at " << baud << " baud" << std::endl;
+  }
+
+  return _open;
+}
+
+bool I2CTransportBitBang::recover() {
+  // Is a device holding the bus?
+  if(!_open || 0 != gpio_read(_sdaPin)) {
+    return false;
+  }
+
+  // Take the pins back from the bit banging so they can be driven directly
+  bb_i2c_close(_sdaPin);
+  _open = false;
+
+  releaseLine(_sdaPin);
+  releaseLine(_sclPin);
+
+  // Clock out whatever the device thinks it's sending, until it lets go
+  for(int i = 0; i < 9 && 0 == gpio_read(_sdaPin); i++) {
+    pullLine(_sclPin);
+    releaseLine(_sclPin);
+  }
+
+  // and finish with a STOP, so every device goes back to waiting for a START
+  pullLine(_sclPin);
+  pullLine(_sdaPin);
+  releaseLine(_sclPin);
+  releaseLine(_sdaPin);
+
+  bool cleared = (1 == gpio_read(_sdaPin));
+
+  if(!cleared) {
+    std::cerr << __func__ << ": SDA still held low" << std::endl;
+  }
+
+  if(0 == bb_i2c_open(_sdaPin, _sclPin, _baud)) {
+    _open = true;
+  }
+  else {
+    std::cerr << __func__ << ": Failed to reopen bit bang port" << std::endl;
+  }
+
+  return cleared;
+}
+
+bool I2CTransportBitBang::execute(uint8_t address, I2CTransaction &transaction) {
+  const std::vector<I2CTransaction::Message> &messages = transaction.messages();
+  size_t first = 0;
+
+  if(!sendable(transaction) || !_open) {
+    return false;
+  }
+
+  // Send as many messages as will fit in each bb_i2c_zip call. Normally
+  // this will be the whole transaction in one go.
+  while(first < messages.size()) {
+    char command[ZIP_COMMAND_MAX];
+    char response[ZIP_RESPONSE_MAX];
+    size_t commandLength = 0, responseLength = 0;
+    size_t last = first;
+    int read;
+
+    command[commandLength++] = ZIP_ADDRESS;
+    command[commandLength++] = address;
+
+    while(last < messages.size()) {
+      size_t groupEnd = last, groupCommandLength = 1, groupResponseLength = 0;
+
+      // Messages joined by a repeated start have to be sent together,
+      // so work out how much space the whole group needs
+      do {
+        const I2CTransaction::Message &message = messages[groupEnd];
+
+        // Start, Read/Write, length and any bytes to write
+        groupCommandLength += 3 + (message.read ? 0 : message.length);
+        groupResponseLength += (message.read ? message.length : 0);
+      } while(messages[groupEnd++].repeatedStart && groupEnd < messages.size());
+
+      // Leave room for the 'End' command
+      if(commandLength + groupCommandLength + 1 > ZIP_COMMAND_MAX ||
+         responseLength + groupResponseLength > ZIP_RESPONSE_MAX) {
+        break;
+      }
+
+      for(size_t i = last; i < groupEnd; i++) {
+        const I2CTransaction::Message &message = messages[i];
+
+        command[commandLength++] = ZIP_START;
+
+        if(message.read) {
+          command[commandLength++] = ZIP_READ;
+          command[commandLength++] = (char)message.length;
+          responseLength += message.length;
+        }
+        else {
+          command[commandLength++] = ZIP_WRITE;
+          command[commandLength++] = (char)message.length;
+          memcpy(&command[commandLength], transaction.data(message), message.length);
+          commandLength += message.length;
+        }
+      }
+
+      command[commandLength++] = ZIP_STOP;
+      last = groupEnd;
+    }
+
+    // Is a single group of messages too large to send?
+    if(last == first) {
+      std::cerr << __func__ << ": I2C transaction too large" << std::endl;
+      return false;
+    }
+
+    command[commandLength++] = ZIP_END;
+
+    // Check we read in all the requested bytes
+    read = bb_i2c_zip(_sdaPin, command, commandLength, response, responseLength);
+    if(read < 0 || responseLength != (size_t)read) {
+      return false;
+    }
+
+    // and copy them out to where they were requested
+    responseLength = 0;
+    for(size_t i = first; i < last; i++) {
+      if(messages[i].read) {
+        memcpy(messages[i].buffer, &response[responseLength], messages[i].length);
+        responseLength += messages[i].length;
+      }
+    }
+
+    first = last;
+  }
+
+  return true;
+}
+
+}
@@ -0,0 +1,45 @@
+/**
+ * Provides access to a 'bit banged' I2C bus, driven by pigpiod on
+ * a pair of GPIO pins.
+ */
+
+#ifndef _PIWARS_I2CTRANSPORTBITBANG_H
+#define _PIWARS_I2CTRANSPORTBITBANG_H
+
+#include "I2CTransport.h"
+
+namespace PiWars {
+
+  class I2CTransportBitBang : public I2CTransport {
+    public:
+      // Opens the bit banged bus on the specified pins
+      // Note: The connection to pigpiod must already have been established
+      //
+      // @param sdaPin The GPIO pin to use for SDA
+      // @param sclPin The GPIO pin to use for SCL
+      // @param baud The clock speed of the bus
+      I2CTransportBitBang(uint32_t sdaPin, uint32_t sclPin, uint32_t baud);
+      ~I2CTransportBitBang();
+
+      // Sends the transaction as a single bb_i2c_zip command list,
+      // only splitting it if it is too large to send in one go
+      bool execute(uint8_t address, I2CTransaction &transaction);
+
+      // Reopens the bus at the new clock speed
+      bool setClock(uint32_t baud);
+      uint32_t clock() const { return _baud; }
+
+      // If a device is holding SDA low, clocks it out with up to 9 SCL
+      // pulses followed by a STOP, then reopens the bus
+      bool recover();
+
+    private:
+      uint32_t _sdaPin; //<! The GPIO pin used for SDA
+      uint32_t _sclPin; //<! The GPIO pin used for SCL
+      uint32_t _baud; //<! The clock speed of the bus
+      bool _open; //<! Was the bus successfully opened?
+  };
+
+}
+
+#endif
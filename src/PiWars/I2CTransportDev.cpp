@@ -0,0 +1,95 @@
+/**
+ * Provides access to an I2C bus directly through the kernel's i2c-dev
+ * interface (/dev/i2c-N), avoiding the round trip to the pigpio daemon.
+ */
+
+#include "I2CTransportDev.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include <iostream>
+
+namespace PiWars
+{
+
+I2CTransportDev::I2CTransportDev(uint32_t bus) : I2CTransportDev("/dev/i2c-" + std::to_string(bus)) {
+}
+
+I2CTransportDev::I2CTransportDev() : _fd(-1) {
+}
+
+I2CTransportDev::I2CTransportDev(const std::string &path) : _fd(-1) {
+  _fd = open(path.c_str(), O_RDWR);
+
+  if(_fd < 0) {
+    std::cerr << __func__ << ": Failed to open " << path << std::endl;
+  }
+}
+
+I2CTransportDev::~I2CTransportDev() {
+  if(_fd >= 0) {
+    close(_fd);
+  }
+}
+
+bool I2CTransportDev::execute(uint8_t address, I2CTransaction &transaction) {
+  const std::vector<I2CTransaction::Message> &messages = transaction.messages();
+  struct i2c_msg transfers[I2C_RDWR_IOCTL_MAX_MSGS];
+  size_t count = 0;
+
+  if(!sendable(transaction)) {
+    return false;
+  }
+
+  // Check each group fits in a single transfer before anything is sent
+  for(size_t i = 0; i < messages.size(); i++) {
+    count++;
+
+    if(count > I2C_RDWR_IOCTL_MAX_MSGS) {
+      std::cerr << __func__ << ": Too many messages joined by repeated starts" << std::endl;
+      return false;
+    }
+
+    if(!messages[i].repeatedStart) {
+      count = 0;
+    }
+  }
+
+  count = 0;
+
+  for(size_t i = 0; i < messages.size(); i++) {
+    const I2CTransaction::Message &message = messages[i];
+
+    transfers[count].addr = address;
+    transfers[count].flags = message.read ? I2C_M_RD : 0;
+    transfers[count].len = message.length;
+    transfers[count].buf = (__u8 *)(message.read ? message.buffer : transaction.data(message));
+    count++;
+
+    // Send the group once we reach a stop
+    if(!message.repeatedStart || i + 1 == messages.size()) {
+      if(!transfer(transfers, count)) {
+        return false;
+      }
+
+      count = 0;
+    }
+  }
+
+  return true;
+}
+
+bool I2CTransportDev::transfer(struct i2c_msg *messages, size_t count) {
+  struct i2c_rdwr_ioctl_data data;
+
+  data.msgs = messages;
+  data.nmsgs = count;
+
+  return (_fd >= 0 && ioctl(_fd, I2C_RDWR, &data) >= 0);
+}
+
+}
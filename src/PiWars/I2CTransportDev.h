@@ -0,0 +1,58 @@
+/**
+ * Provides access to an I2C bus directly through the kernel's i2c-dev
+ * interface (/dev/i2c-N), avoiding the round trip to the pigpio daemon.
+ */
+
+#ifndef _PIWARS_I2CTRANSPORTDEV_H
+#define _PIWARS_I2CTRANSPORTDEV_H
+
+#include <string>
+
+#include "I2CTransport.h"
+
+// Forward declarations
+struct i2c_msg;
+
+namespace PiWars {
+
+  class I2CTransportDev : public I2CTransport {
+    public:
+      // Opens the specified I2C bus
+      //
+      // @param bus The I2C bus to open (e.g. 1 for /dev/i2c-1)
+      I2CTransportDev(uint32_t bus);
+
+      // Opens the I2C bus at the specified path. Useful for testing against
+      // the i2c-stub kernel module
+      //
+      // @param path The path of the i2c-dev device node
+      I2CTransportDev(const std::string &path);
+      virtual ~I2CTransportDev();
+
+      // Sends the transaction using I2C_RDWR, with each group of messages
+      // joined by repeated starts sent as a single combined transfer.
+      // A group too big for a single transfer can't be sent without
+      // breaking the repeated start, so the transaction is rejected.
+      bool execute(uint8_t address, I2CTransaction &transaction);
+
+    protected:
+      // Creates a transport without opening a bus, for a fake device
+      // that overrides transfer()
+      I2CTransportDev();
+
+      // Performs a single combined transfer. Overridden to allow
+      // testing against a fake in-process device.
+      //
+      // @param messages The messages to send
+      // @param count Number of messages
+      //
+      // @returns true if the transfer completed
+      virtual bool transfer(struct i2c_msg *messages, size_t count);
+
+    private:
+      int _fd; //<! The file descriptor of the opened i2c-dev device
+  };
+
+}
+
+#endif
@@ -0,0 +1,140 @@
+/**
+ * Provides access to one of the Raspberry Pi's hardware I2C buses via
+ * the pigpio daemon.
+ */
+
+#include "I2CTransportPigpiod.h"
+
+// The pigpiod_if header file doesn't protect itself when included from
+// C++, so force it to be treated as 'C' here.
+extern "C" {
+#include "pigpiod_if.h"
+}
+
+#include <iostream>
+#include "string.h"
+
+namespace PiWars
+{
+
+// The largest command and response buffers we pass to i2c_zip
+const static size_t ZIP_COMMAND_MAX = 256;
+const static size_t ZIP_RESPONSE_MAX = 256;
+
+// The i2c_zip commands
+const static char ZIP_END = 0x00;
+const static char ZIP_COMBINED_ON = 0x02;
+const static char ZIP_COMBINED_OFF = 0x03;
+const static char ZIP_ADDRESS = 0x04;
+const static char ZIP_READ = 0x06;
+const static char ZIP_WRITE = 0x07;
+
+I2CTransportPigpiod::I2CTransportPigpiod(uint32_t bus) : _i2cHandle(-1) {
+  // The address is set by each transaction, so the one we open
+  // with doesn't matter
+  _i2cHandle = i2c_open(bus, 0, 0);
+
+  if(_i2cHandle < 0) {
+    std::cerr << __func__ << ": Failed to open I2C bus " << bus << std::endl;
+  }
+}
+
+I2CTransportPigpiod::~I2CTransportPigpiod() {
+  if(_i2cHandle >= 0) {
+    i2c_close(_i2cHandle);
+  }
+}
+
+bool I2CTransportPigpiod::execute(uint8_t address, I2CTransaction &transaction) {
+  const std::vector<I2CTransaction::Message> &messages = transaction.messages();
+  size_t first = 0;
+
+  if(!sendable(transaction) || _i2cHandle < 0) {
+    return false;
+  }
+
+  // Send as many messages as will fit in each i2c_zip call. Normally
+  // this will be the whole transaction in one go.
+  while(first < messages.size()) {
+    char command[ZIP_COMMAND_MAX];
+    char response[ZIP_RESPONSE_MAX];
+    size_t commandLength = 0, responseLength = 0;
+    size_t last = first;
+    int read;
+
+    command[commandLength++] = ZIP_ADDRESS;
+    command[commandLength++] = address;
+
+    while(last < messages.size()) {
+      size_t groupEnd = last, groupCommandLength = 2, groupResponseLength = 0;
+
+      // Messages joined by a repeated start have to be sent together,
+      // so work out how much space the whole group needs
+      do {
+        const I2CTransaction::Message &message = messages[groupEnd];
+
+        // Read/Write, length and any bytes to write
+        groupCommandLength += 2 + (message.read ? 0 : message.length);
+        groupResponseLength += (message.read ? message.length : 0);
+      } while(messages[groupEnd++].repeatedStart && groupEnd < messages.size());
+
+      // Leave room for the 'End' command
+      if(commandLength + groupCommandLength + 1 > ZIP_COMMAND_MAX ||
+         responseLength + groupResponseLength > ZIP_RESPONSE_MAX) {
+        break;
+      }
+
+      // Turn on the combined flag so the group is sent with
+      // repeated starts
+      command[commandLength++] = ZIP_COMBINED_ON;
+
+      for(size_t i = last; i < groupEnd; i++) {
+        const I2CTransaction::Message &message = messages[i];
+
+        if(message.read) {
+          command[commandLength++] = ZIP_READ;
+          command[commandLength++] = (char)message.length;
+          responseLength += message.length;
+        }
+        else {
+          command[commandLength++] = ZIP_WRITE;
+          command[commandLength++] = (char)message.length;
+          memcpy(&command[commandLength], transaction.data(message), message.length);
+          commandLength += message.length;
+        }
+      }
+
+      command[commandLength++] = ZIP_COMBINED_OFF;
+      last = groupEnd;
+    }
+
+    // Is a single group of messages too large to send?
+    if(last == first) {
+      std::cerr << __func__ << ": I2C transaction too large" << std::endl;
+      return false;
+    }
+
+    command[commandLength++] = ZIP_END;
+
+    // Check we read in all the requested bytes
+    read = i2c_zip(_i2cHandle, command, commandLength, response, responseLength);
+    if(read < 0 || responseLength != (size_t)read) {
+      return false;
+    }
+
+    // and copy them out to where they were requested
+    responseLength = 0;
+    for(size_t i = first; i < last; i++) {
+      if(messages[i].read) {
+        memcpy(messages[i].buffer, &response[responseLength], messages[i].length);
+        responseLength += messages[i].length;
+      }
+    }
+
+    first = last;
+  }
+
+  return true;
+}
+
+}
@@ -0,0 +1,31 @@
+/**
+ * Provides access to one of the Raspberry Pi's hardware I2C buses via
+ * the pigpio daemon.
+ */
+
+#ifndef _PIWARS_I2CTRANSPORTPIGPIOD_H
+#define _PIWARS_I2CTRANSPORTPIGPIOD_H
+
+#include "I2CTransport.h"
+
+namespace PiWars {
+
+  class I2CTransportPigpiod : public I2CTransport {
+    public:
+      // Opens the specified I2C bus via pigpiod
+      // Note: The connection to pigpiod must already have been established
+      //
+      // @param bus The I2C bus to open (e.g. 1 for /dev/i2c-1)
+      I2CTransportPigpiod(uint32_t bus);
+      ~I2CTransportPigpiod();
+
+      // Sends the transaction as a single i2c_zip command list
+      bool execute(uint8_t address, I2CTransaction &transaction);
+
+    private:
+      int _i2cHandle; //<! Handle used by pigpiod to perform I2C communication
+  };
+
+}
+
+#endif
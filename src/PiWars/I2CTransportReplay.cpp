@@ -0,0 +1,108 @@
+/**
+ * The I2CTransportReplay plays back the transactions recorded in an I2C
+ * trace, so the responses the devices gave during a run can be fed back
+ * through the I2C classes without any hardware. Each transaction sent is
+ * matched against the next one recorded for the same device, and given
+ * the same response and result.
+ */
+
+#include "I2CTransportReplay.h"
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include "string.h"
+
+namespace PiWars
+{
+
+I2CTransportReplay::I2CTransportReplay(const std::string &path, uint8_t bus, bool realTime)
+  : _realTime(realTime)
+  , _skipped(0)
+  , _unmatched(0)
+{
+  I2CTraceReader reader;
+  I2CTraceEntry entry;
+
+  if(reader.open(path)) {
+    while(reader.next(entry)) {
+      if(entry.bus == bus) {
+        _entries[entry.address].push_back(entry);
+      }
+    }
+  }
+}
+
+I2CTransportReplay::~I2CTransportReplay() {
+}
+
+bool I2CTransportReplay::execute(uint8_t address, I2CTransaction &transaction) {
+  std::deque<I2CTraceEntry> &entries = _entries[address];
+  const std::vector<I2CTransaction::Message> &messages = transaction.messages();
+
+  // Skip anything the code no longer sends
+  for(size_t i = 0; i < entries.size(); i++) {
+    if(!matches(entries[i], transaction)) {
+      continue;
+    }
+
+    const I2CTraceEntry &entry = entries[i];
+
+    // Give the same response
+    for(size_t j = 0; j < messages.size(); j++) {
+      if(messages[j].read) {
+        memcpy(messages[j].buffer, entry.messages[j].data.data(), messages[j].length);
+      }
+    }
+
+    if(_realTime) {
+      std::this_thread::sleep_for(std::chrono::nanoseconds(entry.duration));
+    }
+
+    bool result = entry.result;
+
+    _skipped += i;
+    entries.erase(entries.begin(), entries.begin() + i + 1);
+
+    return result;
+  }
+
+  _unmatched++;
+  return false;
+}
+
+size_t I2CTransportReplay::remaining() const {
+  size_t count = 0;
+
+  for(auto &entries : _entries) {
+    count += entries.second.size();
+  }
+
+  return count;
+}
+
+bool I2CTransportReplay::matches(const I2CTraceEntry &entry, const I2CTransaction &transaction) {
+  const std::vector<I2CTransaction::Message> &messages = transaction.messages();
+
+  if(entry.messages.size() != messages.size()) {
+    return false;
+  }
+
+  for(size_t i = 0; i < messages.size(); i++) {
+    const I2CTraceEntry::Message &recorded = entry.messages[i];
+
+    if(recorded.read != messages[i].read ||
+       recorded.repeatedStart != messages[i].repeatedStart ||
+       recorded.data.size() != messages[i].length) {
+      return false;
+    }
+
+    if(!messages[i].read && 0 != memcmp(recorded.data.data(), transaction.data(messages[i]), messages[i].length)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+}
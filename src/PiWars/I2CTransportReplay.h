@@ -0,0 +1,74 @@
+/**
+ * The I2CTransportReplay plays back the transactions recorded in an I2C
+ * trace, so the responses the devices gave during a run can be fed back
+ * through the I2C classes without any hardware. Each transaction sent is
+ * matched against the next one recorded for the same device, and given
+ * the same response and result.
+ */
+
+#ifndef _PIWARS_I2CTRANSPORTREPLAY_H
+#define _PIWARS_I2CTRANSPORTREPLAY_H
+
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <map>
+#include <string>
+
+#include "I2CTrace.h"
+#include "I2CTransport.h"
+
+namespace PiWars {
+
+  class I2CTransportReplay : public I2CTransport {
+    public:
+      // Loads the transactions recorded on a bus from a trace file
+      //
+      // @param path The trace file
+      // @param bus The bus whose transactions should be replayed
+      // @param realTime true if each transaction should take as long as it
+      //                 did when recorded
+      I2CTransportReplay(const std::string &path, uint8_t bus, bool realTime = false);
+      ~I2CTransportReplay();
+
+      // Finds the next recorded transaction to the device that matches
+      // this one, skipping any that don't, and gives the same response
+      //
+      // @returns the recorded result, or false if there's no match
+      bool execute(uint8_t address, I2CTransaction &transaction);
+
+      // Returns the number of recorded transactions that have been
+      // skipped because they didn't match what was sent
+      //
+      // @returns the number of transactions
+      uint64_t skipped() const { return _skipped; }
+
+      // Returns the number of transactions sent that had no match
+      //
+      // @returns the number of transactions
+      uint64_t unmatched() const { return _unmatched; }
+
+      // Returns the number of recorded transactions not yet replayed
+      //
+      // @returns the number of transactions
+      size_t remaining() const;
+
+    private:
+      // Checks if a recorded transaction matches one being sent. The same
+      // bytes must be written, and the same number of bytes read.
+      //
+      // @param entry The recorded transaction
+      // @param transaction The transaction being sent
+      //
+      // @returns true if they match
+      static bool matches(const I2CTraceEntry &entry, const I2CTransaction &transaction);
+
+      bool _realTime; //<! Should transactions take as long as they were recorded taking?
+      std::map<uint8_t, std::deque<I2CTraceEntry>> _entries; //<! The recorded transactions for each device
+      uint64_t _skipped; //<! Recorded transactions skipped over
+      uint64_t _unmatched; //<! Transactions with no match
+  };
+
+}
+
+#endif
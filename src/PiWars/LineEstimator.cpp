@@ -0,0 +1,118 @@
+/**
+ * The LineEstimator class turns the readings of a line sensor into a
+ * continuous estimate of where the line is, how sure it is of that, and
+ * how quickly the line is moving across the sensor.
+ *
+ * Each sensor's reading has already been scaled between the lightest and
+ * darkest readings it was calibrated with, by the line sensor itself, so
+ * sensors that read a little differently to their neighbours don't pull
+ * the estimate towards them. Here they're only normalised to 0.0 - 1.0.
+ * The position is then the centroid of the strongest sensor and its
+ * neighbours, giving a resolution much finer than the sensor spacing.
+ */
+
+#include "LineEstimator.h"
+
+#include <algorithm>
+
+namespace PiWars
+{
+
+// How much darker than the surface the line has to look to be followed
+static const float LOST_CONFIDENCE = 0.3f;
+
+// How much of each new velocity to take, smoothing out the noise of
+// differentiating the position
+static const float VELOCITY_SMOOTHING = 0.3f;
+
+LineEstimator::LineEstimator(uint16_t fullScale)
+  : _fullScale(fullScale)
+{
+  reset();
+}
+
+void LineEstimator::reset() {
+  _estimate.position = 0.0f;
+  _estimate.confidence = 0.0f;
+  _estimate.velocity = 0.0f;
+  _estimate.lost = true;
+  _lastSequence = 0;
+  _seen = false;
+}
+
+float LineEstimator::normalise(uint16_t value) const {
+  return (float)std::min(value, _fullScale) / (float)_fullScale;
+}
+
+const LineEstimator::Estimate &LineEstimator::update(const SensorLine::LineSamples::Sample &sample) {
+  float values[SENSOR_COUNT];
+  size_t peak = 0;
+  float floor = 1.0f;
+
+  // Nothing new to go on
+  if(sample.sequence == _lastSequence) {
+    return _estimate;
+  }
+  _lastSequence = sample.sequence;
+
+  for(size_t i = 0; i < SENSOR_COUNT; i++) {
+    values[i] = normalise(sample.value.values[i]);
+
+    if(values[i] > values[peak]) {
+      peak = i;
+    }
+    floor = std::min(floor, values[i]);
+  }
+
+  // The line stands out from the surface around it, if it's there at all
+  _estimate.confidence = values[peak] - floor;
+
+  if(_estimate.confidence < LOST_CONFIDENCE) {
+    // Assume it's off whichever edge it was last seen nearest
+    if(_seen) {
+      _estimate.position = (_estimate.position < 0.0f) ? -1.0f : 1.0f;
+    }
+    _estimate.velocity = 0.0f;
+    _estimate.lost = true;
+
+    return _estimate;
+  }
+
+  // Take the centroid of the strongest sensor and its neighbours, so
+  // stray marks elsewhere under the sensor don't drag the line over
+  size_t first = (peak > 0) ? peak - 1 : peak;
+  size_t last = (peak < SENSOR_COUNT - 1) ? peak + 1 : peak;
+  float weighted = 0.0f, total = 0.0f;
+
+  for(size_t i = first; i <= last; i++) {
+    float weight = values[i] - floor;
+
+    weighted += weight * i;
+    total += weight;
+  }
+
+  float position = ((weighted / total) / (SENSOR_COUNT - 1)) * 2.0f - 1.0f;
+
+  // Only track how fast it's moving while it's been in view
+  if(_seen && !_estimate.lost) {
+    float elapsed = std::chrono::duration<float>(sample.timestamp - _lastTime).count();
+
+    if(elapsed > 0.0f) {
+      float velocity = (position - _estimate.position) / elapsed;
+
+      _estimate.velocity += VELOCITY_SMOOTHING * (velocity - _estimate.velocity);
+    }
+  }
+  else {
+    _estimate.velocity = 0.0f;
+  }
+
+  _estimate.position = position;
+  _estimate.lost = false;
+  _lastTime = sample.timestamp;
+  _seen = true;
+
+  return _estimate;
+}
+
+}
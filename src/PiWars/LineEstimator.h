@@ -0,0 +1,76 @@
+/**
+ * The LineEstimator class turns the readings of a line sensor into a
+ * continuous estimate of where the line is, how sure it is of that, and
+ * how quickly the line is moving across the sensor.
+ *
+ * Each sensor's reading has already been scaled between the lightest and
+ * darkest readings it was calibrated with, by the line sensor itself, so
+ * sensors that read a little differently to their neighbours don't pull
+ * the estimate towards them. Here they're only normalised to 0.0 - 1.0.
+ * The position is then the centroid of the strongest sensor and its
+ * neighbours, giving a resolution much finer than the sensor spacing.
+ */
+
+#ifndef _PIWARS_LINEESTIMATOR_H
+#define _PIWARS_LINEESTIMATOR_H
+
+#include <cstdint>
+#include <cstddef>
+
+#include "SensorLine.h"
+
+namespace PiWars {
+
+class LineEstimator {
+  public:
+    static const size_t SENSOR_COUNT = SensorLine::SENSOR_COUNT;
+
+    // The estimate of where the line is
+    struct Estimate {
+      float position; //<! Where the line is, from -1.0 (under the first sensor) to 1.0 (under the last)
+      float confidence; //<! How sure the estimate is, from 0.0 (nothing seen) to 1.0 (a clear line)
+      float velocity; //<! How quickly the line is moving across the sensor, in positions per second
+      bool lost; //<! Has the line been lost? If so position is the edge it was last seen nearest
+    };
+
+    // Creates an estimator, with each sensor's calibrated reading going
+    // from 0 (white) to fullScale (black)
+    //
+    // @param fullScale The reading of a sensor over the line
+    LineEstimator(uint16_t fullScale = 1000);
+
+    // Forgets where the line was, ready to start following a new one
+    void reset();
+
+    // Updates the estimate with a new reading. Readings that have already
+    // been seen are ignored.
+    //
+    // @param sample The reading, as published by the sensor
+    //
+    // @returns The updated estimate
+    const Estimate &update(const SensorLine::LineSamples::Sample &sample);
+
+    // Returns the current estimate
+    //
+    // @returns The estimate
+    const Estimate &estimate() const { return _estimate; }
+
+  private:
+    // Normalises a calibrated reading
+    //
+    // @param value The reading
+    //
+    // @returns The reading, from 0.0 (lightest) to 1.0 (darkest)
+    float normalise(uint16_t value) const;
+
+    uint16_t _fullScale; //<! The calibrated reading of a sensor over the line
+
+    Estimate _estimate; //<! The current estimate
+    uint64_t _lastSequence; //<! The last reading used, 0 if none yet
+    SensorLine::LineSamples::clock::time_point _lastTime; //<! When the last reading with the line in view was taken
+    bool _seen; //<! Has the line been seen since reset()?
+};
+
+}
+
+#endif
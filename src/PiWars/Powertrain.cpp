@@ -1,34 +1,215 @@
 /**
  * The Powertrain represents the Engine, gearbox, drive and wheels of the robot.
  * Altogether this allows the robot to be driven around and moved.
+ *
+ * Commands are posted to a single slot mailbox and sent to the motors by
+ * a dedicated thread, so the caller never waits on the bus. Only the
+ * newest command is kept, and commands are sent no more often than the
+ * motors can usefully act on them. Unchanged commands are only sent again
+ * periodically, so the motors start again after the MotorDriver has
+ * stopped them for an overload.
+ *
+ * The thread ramps the power of each motor towards the power asked for,
+ * on its own timer, limiting the acceleration and jerk. This stops the
+ * motors pulling too much current, or the wheels slipping, when the
+ * power jumps.
+ *
+ * Each motor has an encoder, counted by the MotorDriver, so how far each
+ * wheel has gone, and how fast it's going, can be read back. The
+ * MotorDriver can also use them to hold each wheel at a velocity, so the
+ * robot goes at the same speed whatever the battery level or floor.
  */
 #include "Powertrain.h"
 #include "InputDevice.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <iostream>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/poll.h>
 
 namespace PiWars
 {
 
-Powertrain::Powertrain() : I2CExternal(0x07), _powerLeft(0.0f), _powerRight(0.0f), _powerLimiter(1.0f) {
+// The commands understood by the MotorDriver
+static const uint8_t COMMAND_PING = 0x10;
+static const uint8_t COMMAND_STOP = 0x11;
+static const uint8_t COMMAND_SET_POWER = 0x12;
+static const uint8_t COMMAND_READ_ENCODERS = 0x13;
+static const uint8_t COMMAND_SET_VELOCITY = 0x14;
+
+// The command, both encoder counts and when they were read
+static const size_t ENCODER_RESPONSE_LENGTH = 13;
+
+// Each turn of a wheel is 64 encoder edges for each turn of the motor,
+// through its 30:1 gearbox
+static const float ENCODER_COUNTS_PER_REVOLUTION = 64.0f * 30.0f;
+
+// The diameter of the wheels, in metres
+static const float WHEEL_DIAMETER = 0.09f;
+
+// How far the robot travels for each encoder count, in metres
+static const float METRES_PER_COUNT = (3.14159265f * WHEEL_DIAMETER) / ENCODER_COUNTS_PER_REVOLUTION;
+
+// How fast the encoders count with the motors at full power, which is
+// also the fastest velocity that can be held
+static const float FULL_SPEED_COUNTS = 11200.0f;
+
+// The shortest time the speed is measured over, in us. Any shorter and
+// a single count makes a big difference.
+static const uint32_t speedWindow = 20000;
+
+// How often the power is stepped while ramping, which is also the
+// shortest time between power commands being sent. Anything posted in
+// between replaces the command waiting to be sent.
+static const std::chrono::milliseconds rampInterval(10);
+
+// The longest step taken, should the thread be held up
+static const std::chrono::milliseconds maximumRampStep(50);
+
+// How often the command is sent again, even if it hasn't changed. The
+// MotorDriver brakes both motors after an overload, and only releases
+// them when it's next told what to do.
+static const std::chrono::milliseconds resendInterval(100);
+
+// By default full power is reached in a little over half a second, and
+// stopped from in a little over a quarter
+static const PowertrainRamp defaultRamp = { 2.0f, 20.0f, 4.0f, 40.0f };
+
+// The state of a single motor while ramping
+struct RampedMotor {
+  float power; //<! The power being sent
+  float rate; //<! How quickly the power is changing, per second
+  float target; //<! The power asked for
+};
+
+// Moves a motor's power towards its target, no faster than the ramp allows.
+// The rate is eased in and out within the jerk limit, so it comes to
+// rest on the target without overshooting it.
+//
+// @param motor The motor
+// @param ramp The limits
+// @param step How long since the last step, in seconds
+static void rampMotor(RampedMotor &motor, const PowertrainRamp &ramp, float step) {
+  float error = motor.target - motor.power;
+
+  // Moving away from zero is accelerating, moving towards it decelerating
+  bool accelerating = (0.0f == motor.power) || ((error > 0.0f) == (motor.power > 0.0f));
+  float limit = accelerating ? ramp.acceleration : ramp.deceleration;
+  float jerk = accelerating ? ramp.accelerationJerk : ramp.decelerationJerk;
+
+  if(limit <= 0.0f) {
+    motor.power = motor.target;
+    motor.rate = 0.0f;
+    return;
+  }
+
+  // The fastest it can go while still being able to ease off in time
+  float rate = std::min(limit, (jerk > 0.0f) ? std::sqrt(2.0f * jerk * std::fabs(error)) : limit);
+  rate = std::copysign(rate, error);
+
+  if(jerk > 0.0f) {
+    float change = jerk * step;
+
+    motor.rate = std::max(motor.rate - change, std::min(motor.rate + change, rate));
+  }
+  else {
+    motor.rate = rate;
+  }
+
+  motor.power += motor.rate * step;
+
+  // Stop once it's there
+  if((motor.target - motor.power > 0.0f) != (error > 0.0f)) {
+    motor.power = motor.target;
+    motor.rate = 0.0f;
+  }
+}
+
+// Works out how long poll() should wait until a time. It's rounded up, so
+// the thread isn't woken just short of it and left spinning until it's due.
+//
+// @param when The time to wake at
+//
+// @returns The timeout, in ms
+static int timeoutUntil(std::chrono::steady_clock::time_point when) {
+  auto wait = when - std::chrono::steady_clock::now();
+
+  if(wait <= std::chrono::steady_clock::duration::zero()) {
+    return 0;
+  }
+
+  return std::chrono::duration_cast<std::chrono::milliseconds>(wait + std::chrono::milliseconds(1) - std::chrono::steady_clock::duration(1)).count();
+}
+
+// Commands are packed into the mailbox as the command, then the left and
+// right power, so they can be swapped in and out atomically. An empty
+// mailbox holds 0.
+static uint64_t packCommand(uint8_t command, int16_t left = 0, int16_t right = 0) {
+  return ((uint64_t)command << 32) | ((uint64_t)(uint16_t)left << 16) | (uint16_t)right;
+}
+
+Powertrain::Powertrain()
+  : I2CExternal(0x07)
+  , _powerLeft(0.0f)
+  , _powerRight(0.0f)
+  , _velocityLeft(0.0f)
+  , _velocityRight(0.0f)
+  , _velocityControl(false)
+  , _powerLimiter(1.0f)
+  , _ramp(defaultRamp)
+  , _mailbox(0)
+  , _quit(false)
+  , _fd(eventfd(0, EFD_NONBLOCK))
+  , _actuatorThread(nullptr)
+  , _haveCounts(false)
+  , _speedTime(0)
+{
+  for(int i = 0; i < 2; i++) {
+    _counts[i] = 0;
+    _totals[i] = 0;
+    _speedCounts[i] = 0;
+    _speeds[i] = 0.0f;
+  }
+
+  // Motor commands take priority over everything else on the bus
+  setPriority(I2CPriority::ACTUATOR);
+
+  // Check the MotorDriver is there with a command it ignores, so it
+  // never upsets a motor command or its response
+  const char ping = COMMAND_PING;
+  setProbe(&ping, 1);
+
+  _actuatorThread = new std::thread(actuatorThread, this);
 }
 
 Powertrain::~Powertrain() {
   // Stop the motors
   stop();
+
+  // Tell the thread to exit, once it's sent the stop
+  _quit = true;
+  post(0);
+
+  _actuatorThread->join();
+  delete _actuatorThread;
+  _actuatorThread = nullptr;
+
+  close(_fd);
 }
 
 void Powertrain::stop() {
-  if(exists()) {
-    if(!writeBytes((const char *)"\x11", 1)) {
-      std::cerr << __func__ << ": Failed to send stop!" << std::endl;
-    }
-    else {
-      _powerLeft = 0.0f;
-      _powerRight = 0.0f;    
-    }
-    
-  }
+  _powerLeft = 0.0f;
+  _powerRight = 0.0f;
+  _velocityLeft = 0.0f;
+  _velocityRight = 0.0f;
+  _velocityControl = false;
+
+  // Always send the stop, even if the MotorDriver seems to have gone.
+  // If it's still there after all, it mustn't be left driving.
+  post(packCommand(COMMAND_STOP));
 }
 
 bool Powertrain::setPower(float left, float right) {
@@ -38,37 +219,285 @@ bool Powertrain::setPower(float left, float right) {
   if(left >= -1.0f && left <= 1.0f && right >= -1.0f && right <= 1.0f) {
     _powerLeft = left;
     _powerRight = right;
+    _velocityControl = false;
+
+    // Convert the floats into a -100 to 100 range
+    int16_t powerLeft = 100 * _powerLeft * _powerLimiter;
+    int16_t powerRight = 100 * _powerRight * _powerLimiter;
+
+    // Posted whether or not the MotorDriver is there, as the actuator
+    // thread copes with it failing to send
+    post(packCommand(COMMAND_SET_POWER, powerLeft, powerRight));
+
+    result = true;
+  }
+
+  return result;
+}
+
+bool Powertrain::setVelocity(float left, float right) {
+  bool result = false;
+  float maximum = FULL_SPEED_COUNTS * METRES_PER_COUNT;
+
+  // Check the inputs are valid
+  if(left >= -maximum && left <= maximum && right >= -maximum && right <= maximum) {
+    _velocityLeft = left;
+    _velocityRight = right;
+    _velocityControl = true;
+
+    // Convert into encoder counts per second
+    int16_t countsLeft = std::round((_velocityLeft * _powerLimiter) / METRES_PER_COUNT);
+    int16_t countsRight = std::round((_velocityRight * _powerLimiter) / METRES_PER_COUNT);
+
+    post(packCommand(COMMAND_SET_VELOCITY, countsLeft, countsRight));
+
+    result = true;
+  }
+
+  return result;
+}
+
+void Powertrain::post(uint64_t command) {
+  uint64_t value = 1;
+
+  // Replace whatever is waiting, then wake the thread
+  if(command) {
+    _mailbox.store(command);
+  }
+  write(_fd, &value, sizeof(value));
+}
+
+bool Powertrain::send(uint64_t command) {
+  char message[5];
+  size_t length = 0;
+
+  message[length++] = (command >> 32) & 0xFF;
+
+  if(COMMAND_SET_POWER == message[0] || COMMAND_SET_VELOCITY == message[0]) {
+    message[length++] = (command >> 24) & 0xFF;
+    message[length++] = (command >> 16) & 0xFF;
+    message[length++] = (command >> 8) & 0xFF;
+    message[length++] = command & 0xFF;
+  }
+
+  // The bus retries it if it fails, so if it still fails there's no
+  // point trying again here
+  if(!writeBytes(message, length)) {
+    std::cerr << __func__ << ": Failed to send " << ((COMMAND_STOP == message[0]) ? "stop" : (COMMAND_SET_POWER == message[0]) ? "power" : "velocity") << "!" << std::endl;
+    return false;
+  }
 
-    // Check if the motor is actually connected/powered up
-    if(exists()) {
-      char message[5];
-      // Convert the floats into a -100 to 100 range
-      int16_t powerLeft = 100 * _powerLeft * _powerLimiter;
-      int16_t powerRight = 100 * _powerRight * _powerLimiter;
-
-      // Prepare the message for sending
-      message[0] = '\x12';
-      message[1] = (powerLeft >> 8) & 0xFF;
-      message[2] = (powerLeft) & 0xFF;
-      message[3] = (powerRight >> 8) & 0xFF;
-      message[4] = (powerRight) & 0xFF;
-
-      // And send itS
-      if(writeBytes(message, 5) < 0 ) {
-        // TODO: Should we try to resend?
-        std::cerr << __func__ << ": Failed to send power!" << std::endl;
+  return true;
+}
+
+void Powertrain::actuatorThread(Powertrain *powertrain) {
+  std::chrono::steady_clock::time_point lastStep = std::chrono::steady_clock::now();
+  std::chrono::steady_clock::time_point lastSendTime = lastStep;
+  RampedMotor motors[2] = { { 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 0.0f } };
+  uint64_t lastSent = 0, current = 0;
+  uint8_t mode = 0;
+  struct pollfd fd;
+
+  // Is there anything left to send? Either the power, or velocity, is
+  // still ramping, or it's switched between the two
+  auto stepping = [&]() {
+    return (COMMAND_SET_POWER == mode || COMMAND_SET_VELOCITY == mode) &&
+           (motors[0].power != motors[0].target || motors[1].power != motors[1].target ||
+            mode != ((lastSent >> 32) & 0xFF));
+  };
+
+  // Should the command be sent again? Either the motors are meant to be
+  // moving, or the last command failed to send. Once stopped, or set to
+  // zero, there's nothing to keep alive.
+  auto resending = [&]() {
+    return current && (current != lastSent || 0.0f != motors[0].target || 0.0f != motors[1].target);
+  };
+
+  // Sends a command if it's changed, or it's time to send it again
+  auto update = [&](uint64_t command, std::chrono::steady_clock::time_point now) {
+    current = command;
+
+    if(command != lastSent || now >= lastSendTime + resendInterval) {
+      lastSendTime = now;
+
+      if(powertrain->send(command)) {
+        lastSent = command;
+      }
+    }
+  };
+
+  fd.fd = powertrain->_fd;
+  fd.events = POLLIN;
+
+  while(true) {
+    bool ramping = stepping();
+    int timeout = -1;
+    uint64_t value;
+
+    // Wait for a command to be posted, the next step if ramping, or for
+    // the command to be sent again
+    if(ramping) {
+      timeout = timeoutUntil(lastStep + rampInterval);
+    }
+
+    if(resending()) {
+      int resend = timeoutUntil(lastSendTime + resendInterval);
+
+      timeout = (-1 == timeout) ? resend : std::min(timeout, resend);
+    }
+
+    if(poll(&fd, 1, timeout) > 0) {
+      read(powertrain->_fd, &value, sizeof(value));
+    }
+
+    bool quit = powertrain->_quit.load();
+    uint64_t command = powertrain->_mailbox.exchange(0);
+    auto now = std::chrono::steady_clock::now();
+
+    if(command) {
+      mode = (command >> 32) & 0xFF;
+
+      if(COMMAND_STOP == mode) {
+        // Stop straight away
+        for(auto &motor : motors) {
+          motor.power = motor.rate = motor.target = 0.0f;
+        }
+
+        update(command, now);
       }
       else {
-        // IMPROVE: Is this necessary? We don't want to flood the I2C
-        // bus with too many messages
-        //std::this_thread::sleep_for (std::chrono::milliseconds(100));
+        // Velocities are ramped as a fraction of full speed, so the
+        // same limits apply as for the power
+        float scale = (COMMAND_SET_VELOCITY == mode) ? FULL_SPEED_COUNTS : 100.0f;
+
+        motors[0].target = (int16_t)((command >> 16) & 0xFFFF) / scale;
+        motors[1].target = (int16_t)(command & 0xFFFF) / scale;
+
+        // Start ramping straight away, if it's been long enough since
+        // the last step
+        if(!ramping) {
+          lastStep = std::max(lastStep, now - rampInterval);
+        }
+      }
+    }
+
+    if(stepping() && now >= lastStep + rampInterval) {
+      PowertrainRamp ramp = powertrain->ramp();
+      float step = std::chrono::duration<float>(std::min(now - lastStep, std::chrono::steady_clock::duration(maximumRampStep))).count();
+      float scale = (COMMAND_SET_VELOCITY == mode) ? FULL_SPEED_COUNTS : 100.0f;
+
+      lastStep = now;
 
-        result = true;
+      for(auto &motor : motors) {
+        rampMotor(motor, ramp, step);
       }
+
+      command = packCommand(mode, std::round(motors[0].power * scale), std::round(motors[1].power * scale));
+
+      update(command, now);
+    }
+    else if(resending() && now >= lastSendTime + resendInterval) {
+      update(current, now);
+    }
+
+    if(quit) {
+      break;
     }
   }
+}
 
-  return result;
+void Powertrain::setRamp(const PowertrainRamp &ramp) {
+  std::unique_lock<std::mutex> lock(_rampMutex);
+
+  _ramp = ramp;
+}
+
+PowertrainRamp Powertrain::ramp() {
+  std::unique_lock<std::mutex> lock(_rampMutex);
+
+  return _ramp;
+}
+
+bool Powertrain::readEncoders() {
+  const char command = COMMAND_READ_ENCODERS;
+  char response[ENCODER_RESPONSE_LENGTH];
+  uint32_t values[3];
+  I2CTransaction read;
+
+  // The MotorDriver answers straight away
+  read.writeRead(&command, sizeof(command), response, sizeof(response));
+
+  if(!execute(read) || COMMAND_READ_ENCODERS != response[0]) {
+    std::cerr << __func__ << ": Failed to read the encoders" << std::endl;
+    return false;
+  }
+
+  // The left and right counts, then the time, each as 32 bits
+  for(int i = 0; i < 3; i++) {
+    const uint8_t *bytes = (const uint8_t *)&response[1 + (i * 4)];
+
+    values[i] = ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | bytes[3];
+  }
+
+  uint32_t time = values[2];
+
+  if(!_haveCounts) {
+    _speedCounts[0] = values[0];
+    _speedCounts[1] = values[1];
+    _speedTime = time;
+    _haveCounts = true;
+  }
+  else {
+    // The counts and the time wrap around, which the differences allow for
+    uint32_t elapsed = time - _speedTime;
+
+    for(int i = 0; i < 2; i++) {
+      _totals[i] += (int32_t)(values[i] - _counts[i]);
+    }
+
+    if(elapsed >= speedWindow) {
+      for(int i = 0; i < 2; i++) {
+        _speeds[i] = ((int32_t)(values[i] - _speedCounts[i]) * 1000000.0f) / elapsed;
+        _speedCounts[i] = values[i];
+      }
+      _speedTime = time;
+    }
+  }
+
+  _counts[0] = values[0];
+  _counts[1] = values[1];
+
+  return true;
+}
+
+bool Powertrain::getOdometry(PowertrainOdometry &odometry) {
+  std::unique_lock<std::mutex> lock(_odometryMutex);
+
+  if(!readEncoders()) {
+    return false;
+  }
+
+  odometry.left = _totals[0] * METRES_PER_COUNT;
+  odometry.right = _totals[1] * METRES_PER_COUNT;
+  odometry.distance = (odometry.left + odometry.right) / 2.0f;
+  odometry.leftSpeed = _speeds[0] * METRES_PER_COUNT;
+  odometry.rightSpeed = _speeds[1] * METRES_PER_COUNT;
+
+  return true;
+}
+
+bool Powertrain::resetOdometry() {
+  std::unique_lock<std::mutex> lock(_odometryMutex);
+
+  // Read them first, so anything travelled up until now is dropped
+  if(!readEncoders()) {
+    return false;
+  }
+
+  _totals[0] = 0;
+  _totals[1] = 0;
+
+  return true;
 }
 
 void Powertrain::getPower(float &left, float &right) {
@@ -87,9 +516,14 @@ bool Powertrain::setLimiter(float limiter) {
     if(limiter != _powerLimiter) {
       _powerLimiter = limiter;
 
-      // Re-set the power, to cause it to recalculate levels based on
-      // the new limiter level
-      setPower(_powerLeft, _powerRight);
+      // Re-set the power, or velocity, to cause it to recalculate
+      // levels based on the new limiter level
+      if(_velocityControl) {
+        setVelocity(_velocityLeft, _velocityRight);
+      }
+      else {
+        setPower(_powerLeft, _powerRight);
+      }
     }
   }
 
@@ -1,18 +1,58 @@
 /**
  * The Powertrain represents the Engine, gearbox, drive and wheels of the robot.
  * Altogether this allows the robot to be driven around and moved.
+ *
+ * Commands are posted to a single slot mailbox and sent to the motors by
+ * a dedicated thread, so the caller never waits on the bus. Only the
+ * newest command is kept, and commands are sent no more often than the
+ * motors can usefully act on them. Unchanged commands are only sent again
+ * periodically, so the motors start again after the MotorDriver has
+ * stopped them for an overload.
+ *
+ * The thread ramps the power of each motor towards the power asked for,
+ * on its own timer, limiting the acceleration and jerk. This stops the
+ * motors pulling too much current, or the wheels slipping, when the
+ * power jumps.
+ *
+ * Each motor has an encoder, counted by the MotorDriver, so how far each
+ * wheel has gone, and how fast it's going, can be read back. The
+ * MotorDriver can also use them to hold each wheel at a velocity, so the
+ * robot goes at the same speed whatever the battery level or floor.
  */
 
 #ifndef _PIWARS_POWERTRAIN_H
 #define _PIWARS_POWERTRAIN_H
 
+#include <atomic>
 #include <cstdint>
+#include <mutex>
+#include <thread>
 #include "I2C.h"
 
 namespace PiWars {
   // Forward declaration
   class InputDevice;
 
+  // How quickly the power of the motors is allowed to change, as a
+  // fraction of full power. A limit of 0 allows the power to change
+  // straight away.
+  struct PowertrainRamp {
+    float acceleration; //!< Fastest the power can rise away from zero, per second
+    float accelerationJerk; //!< Fastest the acceleration can change, per second squared
+    float deceleration; //!< Fastest the power can fall back towards zero, per second
+    float decelerationJerk; //!< Fastest the deceleration can change, per second squared
+  };
+
+  // How far, and how fast, the wheels have travelled, as measured by the
+  // encoders. Distances are positive going forwards.
+  struct PowertrainOdometry {
+    float left; //!< How far the left wheel has travelled since the odometry was reset, in metres
+    float right; //!< How far the right wheel has travelled since the odometry was reset, in metres
+    float distance; //!< How far the middle of the robot has travelled, in metres
+    float leftSpeed; //!< How fast the left wheel is going, in metres per second
+    float rightSpeed; //!< How fast the right wheel is going, in metres per second
+  };
+
   // A Powertrain represents one or more motors with the ability to turn
   // left or right, either via tank track driving, or with a steering column.
   class Powertrain : public I2CExternal {
@@ -20,17 +60,34 @@ namespace PiWars {
       Powertrain();
       ~Powertrain();
 
-      // Stop the robot
+      // Stop the robot straight away, without ramping down
       void stop();
 
-      // Explicitly set the power of the motors
+      // Explicitly set the power of the motors. This can be called as
+      // often as needed, without checking if the power has changed.
+      // The motors are ramped to the new power within the ramp's limits.
+      //
       // @param left Power applied to the 'left wheel' from -1.0 to 1.0
       // @param right Power applied to the 'right wheel' from -1.0 to 1.0
       //
       // @returns true if power was set
-      //          false if input range invalid, or request wasn't passed to the Engine
+      //          false if input range invalid
       bool setPower(float left, float right);
 
+      // Sets how fast the wheels should turn, which the MotorDriver then
+      // holds them at, using the encoders. This can be called as often
+      // as needed, without checking if the velocity has changed.
+      // The velocity is ramped within the ramp's limits, taking full
+      // power as full speed.
+      //
+      // @param left Velocity of the 'left wheel' in metres per second,
+      //             forwards if positive
+      // @param right Velocity of the 'right wheel' in metres per second
+      //
+      // @returns true if the velocity was set
+      //          false if faster than the motors can go
+      bool setVelocity(float left, float right);
+
       // Get the current power levels
       //
       // @param left Filled in with the power for the 'left' motor
@@ -43,7 +100,8 @@ namespace PiWars {
       // of the system be altered in a single place.
       // e.g. if the limiter is set to '0.5' then a power level
       // of '1.0' will be reduced to '0.5' and a power level
-      // of '0.5' will be reduced to '0.25'
+      // of '0.5' will be reduced to '0.25'. Velocities are reduced
+      // the same way.
       //
       // @param limiter The new limiter value
       //
@@ -51,6 +109,28 @@ namespace PiWars {
       //          false if limiter range is invalid
       bool setLimiter(float limiter);
 
+      // Sets how quickly the power of the motors can change
+      //
+      // @param ramp The limits
+      void setRamp(const PowertrainRamp &ramp);
+
+      // Returns how quickly the power of the motors can change
+      //
+      // @returns The limits
+      PowertrainRamp ramp();
+
+      // Reads how far, and how fast, the wheels have travelled
+      //
+      // @param odometry Filled in with the odometry
+      //
+      // @returns true if the encoders were read
+      bool getOdometry(PowertrainOdometry &odometry);
+
+      // Starts measuring the distance travelled from here
+      //
+      // @returns true if the encoders were read
+      bool resetOdometry();
+
       // Allows connecting an InputDevice to allow manual control
       // of the Powertrain
       //
@@ -63,10 +143,52 @@ namespace PiWars {
       bool setInputDevice(InputDevice &device, uint32_t leftAxis, uint32_t rightAxis);
 
     private:
+      // Posts a command for the actuator thread to send, replacing any
+      // that hasn't been sent yet
+      //
+      // @param command The command
+      void post(uint64_t command);
+
+      // Sends a command to the motors
+      //
+      // @param command The command
+      //
+      // @returns true if it was sent
+      bool send(uint64_t command);
+
+      static void actuatorThread(Powertrain *powertrain); //!< Sends the posted commands
+
+      // Reads the encoders, adding how far they've turned since they
+      // were last read to the totals. Must be called with the odometry
+      // mutex held.
+      //
+      // @returns true if the encoders were read
+      bool readEncoders();
+
       float _powerLeft; //!< Amount of power to apply to the left motor
       float _powerRight; //!< Amount of power to apply to the right motor
 
+      float _velocityLeft; //!< Velocity to hold the left wheel at, in metres per second
+      float _velocityRight; //!< Velocity to hold the right wheel at, in metres per second
+      bool _velocityControl; //!< Was a velocity set more recently than the power?
+
       float _powerLimiter; //!< What to limit the power range to
+
+      PowertrainRamp _ramp; //!< How quickly the power can change
+      std::mutex _rampMutex; //!< Protects the ramp
+
+      std::atomic<uint64_t> _mailbox; //!< The newest command not yet sent, or 0 if none
+      std::atomic<bool> _quit; //!< Used to tell the actuator thread to exit
+      int _fd; //!< eventfd signalled when a command is posted
+      std::thread *_actuatorThread; //!< Sends the posted commands
+
+      std::mutex _odometryMutex; //!< Protects the odometry
+      bool _haveCounts; //!< Have the encoders been read yet?
+      uint32_t _counts[2]; //!< The encoder counts when last read
+      int64_t _totals[2]; //!< How far each encoder has turned since the odometry was reset
+      uint32_t _speedCounts[2]; //!< The encoder counts the speed was last measured from
+      uint32_t _speedTime; //!< When the speed was last measured from, on the MotorDriver's clock in us
+      float _speeds[2]; //!< How fast each encoder is turning, in counts per second
   };
 
 }
@@ -0,0 +1,180 @@
+/**
+ * SampleRing
+ *
+ * A ring of timestamped samples, written by a single thread (e.g. a
+ * sensor's reader) and read by any number of others without locking.
+ * Each slot is versioned like a seqlock: the writer marks the slot as
+ * busy, fills it in, then publishes it, and readers retry if the slot
+ * changed while they were copying it. This means a reader always gets
+ * a whole sample, never a mix of two, and the writer never waits.
+ *
+ * Samples are numbered from 1, so readers can ask for everything since
+ * the last sample they saw. Once the ring wraps the oldest samples are
+ * lost, so readers should keep up to within N - 1 samples.
+ *
+ * Note: T must be trivially copyable, as it is copied while the writer
+ *       may be changing it (the copy is thrown away if so).
+ */
+#ifndef _PIWARS_SAMPLERING_H
+#define _PIWARS_SAMPLERING_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+namespace PiWars {
+
+template <class T, size_t N = 64> class SampleRing {
+  public:
+    typedef std::chrono::steady_clock clock;
+
+    // A single sample
+    struct Sample {
+      uint64_t sequence; //<! The number of the sample, starting from 1
+      clock::time_point timestamp; //<! When the sample was taken
+      T value; //<! The sample itself
+    };
+
+    SampleRing() : _latest(0) {
+      for(size_t i = 0; i < N; i++) {
+        _slots[i].version.store(0, std::memory_order_relaxed);
+        _slots[i].sample.sequence = 0;
+      }
+    }
+
+    // Adds a sample. Must only be called from one thread.
+    //
+    // @param value The sample
+    // @param timestamp When the sample was taken
+    //
+    // @returns The sequence number of the sample
+    uint64_t push(const T &value, clock::time_point timestamp = clock::now()) {
+      uint64_t sequence = _latest.load(std::memory_order_relaxed) + 1;
+      Slot &slot = _slots[sequence % N];
+      uint64_t version = slot.version.load(std::memory_order_relaxed);
+
+      // Mark the slot as being written (odd), fill it in, then publish it
+      slot.version.store(version + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+
+      slot.sample.sequence = sequence;
+      slot.sample.timestamp = timestamp;
+      slot.sample.value = value;
+
+      slot.version.store(version + 2, std::memory_order_release);
+      _latest.store(sequence, std::memory_order_release);
+
+      return sequence;
+    }
+
+    // Returns the sequence number of the latest sample
+    //
+    // @returns The sequence number, or 0 if there are no samples
+    uint64_t sequence() const { return _latest.load(std::memory_order_acquire); }
+
+    // Reads the latest sample
+    //
+    // @param sample Filled in with the sample
+    //
+    // @returns true if there is a sample
+    bool latest(Sample &sample) const {
+      while(true) {
+        uint64_t sequence = _latest.load(std::memory_order_acquire);
+
+        if(0 == sequence) {
+          return false;
+        }
+
+        // If the writer has lapped us, try again with the new latest
+        if(read(sequence, sample)) {
+          return true;
+        }
+      }
+    }
+
+    // Reads up to the last count samples, oldest first
+    //
+    // @param samples Filled in with the samples
+    // @param count The maximum number of samples to read
+    //
+    // @returns The number of samples read
+    size_t last(Sample *samples, size_t count) const {
+      uint64_t latest = _latest.load(std::memory_order_acquire);
+
+      if(count > latest) {
+        count = latest;
+      }
+
+      return since(latest - count, samples, count);
+    }
+
+    // Reads the samples after a sequence number, oldest first. Any that
+    // have already been overwritten are skipped.
+    //
+    // @param sequence The sequence number of the last sample already seen
+    // @param samples Filled in with the samples
+    // @param count The maximum number of samples to read
+    //
+    // @returns The number of samples read
+    size_t since(uint64_t sequence, Sample *samples, size_t count) const {
+      uint64_t latest = _latest.load(std::memory_order_acquire);
+      uint64_t first = sequence + 1;
+      size_t read = 0;
+
+      // The slot after the latest may be being written, so at most
+      // N - 1 samples can be read
+      if(latest >= N && first < latest - (N - 2)) {
+        first = latest - (N - 2);
+      }
+
+      for(uint64_t i = first; i <= latest && read < count; i++) {
+        // The oldest samples may be overwritten as we go, so skip them
+        if(this->read(i, samples[read])) {
+          read++;
+        }
+      }
+
+      return read;
+    }
+
+  private:
+    // A single slot in the ring
+    struct Slot {
+      std::atomic<uint64_t> version; //<! Odd while the slot is being written
+      Sample sample; //<! The sample in the slot
+    };
+
+    // Reads a single sample
+    //
+    // @param sequence The sequence number of the sample
+    // @param sample Filled in with the sample
+    //
+    // @returns false if the sample has been overwritten
+    bool read(uint64_t sequence, Sample &sample) const {
+      const Slot &slot = _slots[sequence % N];
+
+      while(true) {
+        uint64_t before = slot.version.load(std::memory_order_acquire);
+
+        // Wait for the writer to finish
+        if(before & 1) {
+          continue;
+        }
+
+        sample = slot.sample;
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(slot.version.load(std::memory_order_relaxed) == before) {
+          return sample.sequence == sequence;
+        }
+      }
+    }
+
+    Slot _slots[N]; //<! The samples
+    std::atomic<uint64_t> _latest; //<! Sequence number of the latest sample
+};
+
+}
+
+#endif
@@ -2,25 +2,34 @@
  * The Sensor class represents a variety of sensors that can be attached
  * to a robot, allowing for a base set of APIs that make them
  * easier to use.
+ *
+ * Sensors publish their readings through a SampleRing, so they can be
+ * read from any thread, along with when they were taken.
  */
 
 #ifndef _PIWARS_SENSOR_H
 #define _PIWARS_SENSOR_H
 
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
 #include <cstddef>
+#include <mutex>
 #include <unistd.h>
 #include <sys/eventfd.h>
+#include <vector>
+
+#include "SampleRing.h"
 
 namespace PiWars {
 
 class Sensor {
   public:
     // Initialize the base Sensor class
-    Sensor() : _enabled(false) {
+    Sensor() : _enabled(false), _sequence(0) {
       _fd =  eventfd(0, EFD_NONBLOCK);
     }
-    ~Sensor() {
+    virtual ~Sensor() {
       close(_fd);
     }
 
@@ -30,6 +39,30 @@ class Sensor {
     // @returns The File descriptor a thread can block on
     int getFD() { return _fd; };
 
+    // Returns how many times the sensor data has changed, so a waiter can
+    // tell if it has missed any changes
+    //
+    // @returns The number of changes
+    uint64_t sequence() const { return _sequence.load(); }
+
+    // Adds an eventfd to be signalled each time the sensor data changes,
+    // so each thread waiting on the sensor can have its own and they're
+    // all woken, rather than only the first to read getFD()
+    //
+    // @param fd The eventfd to signal
+    void addWaiter(int fd) {
+      std::lock_guard<std::mutex> lock(_waitersMutex);
+      _waiters.push_back(fd);
+    }
+
+    // Stops signalling an eventfd added by addWaiter()
+    //
+    // @param fd The eventfd to stop signalling
+    void removeWaiter(int fd) {
+      std::lock_guard<std::mutex> lock(_waitersMutex);
+      _waiters.erase(std::remove(_waiters.begin(), _waiters.end(), fd), _waiters.end());
+    }
+
     // Returns if the sensor has been enabled
     //
     // @returns True is the sensor has been enabled
@@ -49,22 +82,36 @@ class Sensor {
     // we're ready to use them
     //
     // @returns true if successfully enabled
-    bool enable() { _enabled = true; return true; }
+    virtual bool enable() { _enabled = true; return true; }
 
     // Disable a sensor, potentially reducing power or CPU usage
-    void disable() { _enabled = false; }
+    virtual void disable() { _enabled = false; }
+
+    // Takes a single reading. Called by the SensorScheduler at the
+    // sensor's rate while it is enabled, so must not block for long.
+    virtual void sample() {}
 
   protected:
     // Called when the sensor data is changed, allowing any sleeping threads
     // to be awoken
     void changed() {
+      std::lock_guard<std::mutex> lock(_waitersMutex);
       uint64_t value = 1;
+
+      _sequence++;
       write(_fd, &value, sizeof(value));
+
+      for(auto fd : _waiters) {
+        write(fd, &value, sizeof(value));
+      }
     }
 
   private:
     bool _enabled; //<! Used to indicate if a sensor is currently enabled
     int _fd; //<! The eventfd file descriptor
+    std::atomic<uint64_t> _sequence; //<! The number of times the data has changed
+    std::vector<int> _waiters; //<! The eventfds of the threads waiting on the sensor
+    std::mutex _waitersMutex; //<! Protects the waiters
 };
 
 }
@@ -0,0 +1,30 @@
+/**
+ * The SensorLine class is the common interface to the line sensors, so
+ * the line follower doesn't need to know whether the QTR-8RC is read by
+ * the Arduino over I2C, or directly from the Pi's GPIO pins.
+ *
+ * Each reading is published through a SampleRing, along with when it was
+ * taken, as well as being returned by readLine().
+ */
+
+#include "SensorLine.h"
+#include "SensorQTR8RC.h"
+#include "SensorQTR8RCGPIO.h"
+
+#include <cstdlib>
+#include "string.h"
+
+namespace PiWars
+{
+
+SensorLine *SensorLine::create() {
+  const char *selected = getenv("PIWARS_LINE_SENSOR");
+
+  if(selected && 0 == strcmp(selected, "gpio")) {
+    return new SensorQTR8RCGPIO();
+  }
+
+  return new SensorQTR8RC();
+}
+
+}
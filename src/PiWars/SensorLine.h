@@ -0,0 +1,96 @@
+/**
+ * The SensorLine class is the common interface to the line sensors, so
+ * the line follower doesn't need to know whether the QTR-8RC is read by
+ * the Arduino over I2C, or directly from the Pi's GPIO pins.
+ *
+ * Each reading is published through a SampleRing, along with when it was
+ * taken, as well as being returned by readLine().
+ */
+
+#ifndef _PIWARS_SENSORLINE_H
+#define _PIWARS_SENSORLINE_H
+
+#include <cstdint>
+#include <cstddef>
+
+#include "Sensor.h"
+
+namespace PiWars {
+
+class SensorLine : public Sensor {
+  public:
+    static const size_t SENSOR_COUNT = 8; //!< The number of sensors in the array
+
+    // A single reading of the array
+    struct Line {
+      uint16_t values[SENSOR_COUNT]; //<! The reading of each sensor, from 0 (white) to 1000 (black) once calibrated
+      uint16_t position; //<! Where the line is, from 0 (under the first sensor) to 7000 (under the last)
+    };
+
+    typedef SampleRing<Line> LineSamples;
+
+    SensorLine() : Sensor() {}
+    virtual ~SensorLine() {}
+
+    // Asks the sensor to take a reading, without waiting for it. The
+    // reading is collected by the next call to readLine(). Sensors that
+    // are constantly taking readings have nothing to do.
+    //
+    // @param notify true if the sensor should signal once the reading
+    //               has been collected, if it supports it
+    //
+    // @returns true if the request was queued up
+    virtual bool requestLine(bool notify = false) { return true; }
+
+    // Returns the next sensor reading and position, waiting for it
+    // if needed.
+    //
+    // @param sensorDiff Filled in with the reading of each sensor
+    // @param position Filled in with an estimate of where the line is
+    //
+    // @returns True if sensor results read in
+    //          false otherwise
+    virtual bool readLine(uint16_t (&sensorDiff)[SENSOR_COUNT], uint16_t &position) = 0;
+
+    // Forgets any previous calibration, and starts calibrating. The
+    // sensor should be swept across the line and the surface around it
+    // until stopCalibration() is called.
+    //
+    // @returns true if calibration started
+    virtual bool startCalibration() = 0;
+
+    // Stops calibrating, using the lightest and darkest readings seen
+    // since startCalibration() from now on
+    //
+    // @returns true if calibration stopped
+    virtual bool stopCalibration() = 0;
+
+    // Returns the readings taken, along with when they were taken
+    //
+    // @returns The readings
+    const LineSamples &lines() { return _lines; }
+
+    // Creates the line sensor the robot is using. This is the QTR-8RC
+    // read by the Arduino over I2C, unless the PIWARS_LINE_SENSOR
+    // environment variable is set to 'gpio', in which case it is read
+    // directly from the GPIO pins.
+    //
+    // @returns The line sensor
+    static SensorLine *create();
+
+  protected:
+    // Publishes a reading, waking anyone waiting for one
+    //
+    // @param line The reading
+    void publish(const Line &line) {
+      _lines.push(line);
+      changed();
+    }
+
+  private:
+    LineSamples _lines; //<! The readings taken
+};
+
+}
+
+#endif
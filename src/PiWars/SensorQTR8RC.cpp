@@ -1,22 +1,68 @@
 /**
  * The SensorQTR8RC class initialises and controls access to
- * the SparkFun VL6180 Range sensor.
- * https://cdn.sparkfun.com/assets/learn_tutorials/2/5/7/VL6180_ApplicationNote.pdf
+ * the Pololu QTR-8RC Reflectance Sensor Array, via the Arduino
+ * running the LineFollower firmware.
+ * https://www.pololu.com/product/961
+ *
+ * The Arduino's calibration is read back once it's been calibrated and
+ * stored on the Pi, then written back to the Arduino each time the
+ * sensor is enabled, so it's ready to go straight away.
  */
 
 #include "SensorQTR8RC.h"
 
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <string>
 #include <thread>
 
 namespace PiWars
 {
 
+// Where the calibration is stored, unless PIWARS_LINE_CALIBRATION says
+// otherwise
+static const char *defaultCalibrationPath = "/etc/PiWarsQTR8RC.cal";
 
-SensorQTR8RC::SensorQTR8RC() : Sensor(), I2CExternal(0x8), _initialised(false) {
+// How long to sweep the sensor across the line if there's no stored
+// calibration
+static const std::chrono::seconds calibrationTime(5);
+
+// How long the Arduino needs to finish calibrating once asked to stop
+static const std::chrono::milliseconds calibrationStopTime(50);
+
+// The command the LineFollower ignores, used to check it's there
+static const char pingCommand = 0x10;
+
+// The calibration is sent in chunks, each holding the minimum or
+// maximum reading of every sensor
+enum {
+  CALIBRATION_MINIMUM = 0,
+  CALIBRATION_MAXIMUM = 1,
+  CALIBRATION_CHUNKS = 2
+};
+
+SensorQTR8RC::SensorQTR8RC()
+  : SensorLine()
+  , I2CExternal(0x8)
+  , _initialised(false)
+  , _haveCounter(false)
+  , _lastCounter(0)
+{
+  // The line follower's control loop waits on our readings
+  setPriority(I2CPriority::CONTROL);
+
+  // The quicker the readings come in the better, so let the clock find
+  // how fast the Arduino can be talked to
+  setAdaptiveClock(STANDARD_MODE_BAUD, FAST_MODE_BAUD);
+
+  // Check the Arduino is there without disturbing a reading
+  setProbe(&pingCommand, 1);
 }
 
 SensorQTR8RC::~SensorQTR8RC() {
+  // Don't leave the bus reading into the response once we're gone
+  _lineRead.wait();
 }
 
 bool SensorQTR8RC::exists() {
@@ -25,17 +71,20 @@ bool SensorQTR8RC::exists() {
 
 bool SensorQTR8RC::enable() {
   if(!isEnabled()) {
-    uint8_t byte;
-
-    // Perform calibration here
+    Calibration calibration;
 
-    if(writeByte('\x11')) {
+    // Use the last calibration if there is one, so we're ready to go
+    // straight away
+    if(loadCalibration(calibration) && writeCalibration(calibration)) {
+      std::cout << "Calibration restored" << std::endl;
+    }
+    else if(startCalibration()) {
       std::cout << "Calibration started" << std::endl;
 
       // Allow 5 seconds for calibration
-      //std::this_thread::sleep_for (std::chrono::seconds(5));
+      std::this_thread::sleep_for(calibrationTime);
 
-      if(writeByte('\x12')) {
+      if(stopCalibration()) {
         std::cout << "Calibration complete" << std::endl;
       }
     }
@@ -55,36 +104,201 @@ void SensorQTR8RC::disable() {
   }
 }
 
-bool SensorQTR8RC::readLine(uint16_t (&sensorDiff)[8], uint16_t &position) {
-  bool success = false;
+bool SensorQTR8RC::startCalibration() {
+  return writeByte('\x11');
+}
 
-  // Attempt to read from the sensor
-  if(writeByte('\x13')) {
-    char i2cResponse[32];
-    size_t read, i2cResponseArg = 0;
+bool SensorQTR8RC::stopCalibration() {
+  Calibration calibration;
 
-    // Allow the Arduino time to take a reading
-    std::this_thread::sleep_for (std::chrono::milliseconds(5));
+  if(!writeByte('\x12')) {
+    return false;
+  }
 
-    // and read in the results
-    read = readBytes(i2cResponse, 19);
+  // Keep it for next time
+  std::this_thread::sleep_for(calibrationStopTime);
 
-    // Check its a valid result
-    if(19 == read && 0x13 == i2cResponse[i2cResponseArg++]) {
-      // and process the results
-      for(size_t i = 0; i < 8; i++) {
-        sensorDiff[i] = ((i2cResponse[i2cResponseArg++] << 8) | i2cResponse[i2cResponseArg++]);
-      }
+  if(readCalibration(calibration)) {
+    saveCalibration(calibration);
+  }
 
-      position = (i2cResponse[i2cResponseArg++] << 8) | i2cResponse[i2cResponseArg++];
+  return true;
+}
+
+bool SensorQTR8RC::readCalibration(Calibration &calibration) {
+  for(uint8_t chunk = 0; chunk < CALIBRATION_CHUNKS; chunk++) {
+    const char command[] = { 0x14, (char)chunk };
+    char response[CALIBRATION_RESPONSE_LENGTH];
+    uint16_t *readings = (CALIBRATION_MINIMUM == chunk) ? calibration.minimum : calibration.maximum;
+    I2CTransaction read;
+
+    // The Arduino answers straight away
+    read.writeRead(command, sizeof(command), response, sizeof(response));
+
+    if(!execute(read) || 0x14 != response[0] || chunk != response[1]) {
+      std::cerr << __func__ << ": Failed to read in the calibration" << std::endl;
+      return false;
+    }
 
-      success = true;
+    // Nothing to read back if it's not been calibrated
+    if(!response[2]) {
+      return false;
     }
-    else {
-      std::cerr << __func__ << "Failed to read in data from i2c. Got " << read << std::endl;
+
+    for(size_t i = 0; i < SENSOR_COUNT; i++) {
+      readings[i] = ((uint8_t)response[3 + (i * 2)] << 8) | (uint8_t)response[4 + (i * 2)];
+    }
+  }
+
+  // Only worth keeping if every sensor saw both the line and the
+  // surface around it
+  for(size_t i = 0; i < SENSOR_COUNT; i++) {
+    if(calibration.maximum[i] <= calibration.minimum[i]) {
+      std::cerr << __func__ << ": Sensor " << i << " wasn't calibrated" << std::endl;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool SensorQTR8RC::writeCalibration(const Calibration &calibration) {
+  for(uint8_t chunk = 0; chunk < CALIBRATION_CHUNKS; chunk++) {
+    const uint16_t *readings = (CALIBRATION_MINIMUM == chunk) ? calibration.minimum : calibration.maximum;
+    char command[2 + (SENSOR_COUNT * 2)];
+    size_t length = 0;
+
+    command[length++] = 0x15;
+    command[length++] = chunk;
+
+    for(size_t i = 0; i < SENSOR_COUNT; i++) {
+      command[length++] = (readings[i] >> 8) & 0xFF;
+      command[length++] = readings[i] & 0xFF;
+    }
+
+    if(!writeBytes(command, length)) {
+      std::cerr << __func__ << ": Failed to write the calibration" << std::endl;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Returns where the calibration is stored
+static const char *calibrationPath() {
+  const char *path = getenv("PIWARS_LINE_CALIBRATION");
+
+  return path ? path : defaultCalibrationPath;
+}
+
+bool SensorQTR8RC::loadCalibration(Calibration &calibration) {
+  std::ifstream file(calibrationPath());
+  std::string name;
+
+  if(!file) {
+    return false;
+  }
+
+  // Stored as a line of minimums then a line of maximums
+  file >> name;
+  for(size_t i = 0; file && "minimum" == name && i < SENSOR_COUNT; i++) {
+    file >> calibration.minimum[i];
+  }
+
+  file >> name;
+  for(size_t i = 0; file && "maximum" == name && i < SENSOR_COUNT; i++) {
+    file >> calibration.maximum[i];
+  }
+
+  if(!file || "maximum" != name) {
+    std::cerr << __func__ << ": Ignoring invalid calibration in " << calibrationPath() << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+bool SensorQTR8RC::saveCalibration(const Calibration &calibration) {
+  std::ofstream file(calibrationPath(), std::ios::trunc);
+
+  file << "minimum";
+  for(size_t i = 0; i < SENSOR_COUNT; i++) {
+    file << " " << calibration.minimum[i];
+  }
+  file << std::endl;
+
+  file << "maximum";
+  for(size_t i = 0; i < SENSOR_COUNT; i++) {
+    file << " " << calibration.maximum[i];
+  }
+  file << std::endl;
+
+  if(!file) {
+    std::cerr << __func__ << ": Failed to save the calibration to " << calibrationPath() << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+bool SensorQTR8RC::requestLine(bool notify) {
+  const char command = 0x13;
+  I2CTransaction read;
+
+  // Only one reading can be outstanding at a time
+  if(_lineRead.valid()) {
+    return true;
+  }
+
+  // The Arduino answers with its latest reading straight away, so it
+  // can be asked for and read back in the one transaction
+  read.writeRead(&command, 1, _lineResponse, LINE_RESPONSE_LENGTH);
+  _lineRead = submit(read, std::chrono::microseconds(0), notify);
+
+  return true;
+}
+
+bool SensorQTR8RC::readLine(uint16_t (&sensorDiff)[8], uint16_t &position) {
+  const uint8_t *response = (const uint8_t *)_lineResponse;
+  bool success = false;
+  Line line;
+
+  // Ask for a reading if one is not already on its way
+  requestLine();
+
+  // Attempt to read from the sensor, and wait for the results
+  if(_lineRead.wait() && 0x13 == response[0]) {
+    size_t i2cResponseArg = 1;
+    uint16_t counter = (response[i2cResponseArg] << 8) | response[i2cResponseArg + 1];
+    i2cResponseArg += 2;
+
+    // Process the results
+    for(size_t i = 0; i < 8; i++) {
+      sensorDiff[i] = (response[i2cResponseArg] << 8) | response[i2cResponseArg + 1];
+      line.values[i] = sensorDiff[i];
+      i2cResponseArg += 2;
     }
 
+    position = (response[i2cResponseArg] << 8) | response[i2cResponseArg + 1];
+    line.position = position;
+
+    success = true;
+
+    // If we've asked again before the Arduino has taken another
+    // reading, it's the same one as last time
+    if(!_haveCounter || counter != _lastCounter) {
+      _haveCounter = true;
+      _lastCounter = counter;
+      publish(line);
+    }
+  }
+  else {
+    std::cerr << __func__ << ": Failed to read in data from i2c" << std::endl;
   }
+
+  _lineRead.reset();
+
   return success;
 }
 
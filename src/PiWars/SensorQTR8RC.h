@@ -1,7 +1,12 @@
 /**
  * The SensorQTR8RC class initialises and controls access to
- * the SparkFun VL6180 Range sensor.
- * https://cdn.sparkfun.com/assets/learn_tutorials/2/5/7/VL6180_ApplicationNote.pdf
+ * the Pololu QTR-8RC Reflectance Sensor Array, via the Arduino
+ * running the LineFollower firmware.
+ * https://www.pololu.com/product/961
+ *
+ * The Arduino's calibration is read back once it's been calibrated and
+ * stored on the Pi, then written back to the Arduino each time the
+ * sensor is enabled, so it's ready to go straight away.
  */
 
 #ifndef _PIWARS_SENSORQTR8RC_H
@@ -12,13 +17,20 @@
 #include <cstdint>
 #include <cstddef>
 
-#include "Sensor.h"
+#include "SensorLine.h"
 #include "I2C.h"
 
 namespace PiWars {
 
-class SensorQTR8RC : public Sensor, public I2CExternal {
+class SensorQTR8RC : public SensorLine, public I2CExternal {
   public:
+    // The lightest and darkest readings of each sensor, which the
+    // Arduino scales each reading between
+    struct Calibration {
+      uint16_t minimum[SENSOR_COUNT]; //<! The lightest reading of each sensor
+      uint16_t maximum[SENSOR_COUNT]; //<! The darkest reading of each sensor
+    };
+
     // Initialize the VL6180 ready for use
     SensorQTR8RC();
     ~SensorQTR8RC();
@@ -30,10 +42,9 @@ class SensorQTR8RC : public Sensor, public I2CExternal {
     // @returns true if the sensor exists
     bool exists();
 
-    // Enables the sensor ready for use.
-    // Some sensors use additional power or CPU resources
-    // when running, so we only want to enable them when
-    // we're ready to use them
+    // Enables the sensor ready for use, restoring the stored calibration.
+    // If there isn't one, the Arduino is calibrated for a few seconds,
+    // while the sensor is swept across the line.
     //
     // @returns true if successfully enabled
     bool enable();
@@ -41,7 +52,28 @@ class SensorQTR8RC : public Sensor, public I2CExternal {
     // Disable a sensor, potentially reducing power or CPU usage
     void disable();
 
-    // Returns the current sensor reading and position
+    // Asks the Arduino for its latest reading, without waiting for it.
+    // The Arduino is constantly taking readings, so has one ready to
+    // send straight away. The reading is collected by the next call to
+    // readLine(), allowing the caller to get on with something else
+    // while it's sent.
+    //
+    // @param notify true if getLineFD() should be signalled once the reading
+    //               has been collected
+    //
+    // @returns true if the request was queued up
+    bool requestLine(bool notify = false);
+
+    // Returns the FD signalled once the reading asked for by
+    // requestLine(true) has been collected
+    //
+    // @returns The file descriptor, or -1 if there isn't one
+    int getLineFD() const { return _lineRead.getFD(); }
+
+    // Returns the current sensor reading and position. If a reading
+    // hasn't already been requested, one is requested and waited for.
+    // Readings are only published if the Arduino has taken a new one
+    // since the last.
     //
     // @param sensorDiff Filled in with the reading of each sensor
     // @param positoin Filled in with an estimate of where the line is
@@ -50,10 +82,46 @@ class SensorQTR8RC : public Sensor, public I2CExternal {
     //          false otherwise
     bool readLine(uint16_t (&sensorDiff)[8], uint16_t &position);
 
+    // Asks the Arduino to start and stop calibrating. Once stopped, the
+    // calibration is read back and stored for next time.
+    bool startCalibration();
+    bool stopCalibration();
+
+    // Reads back the Arduino's calibration
+    //
+    // @param calibration Filled in with the calibration
+    //
+    // @returns true if the Arduino has been calibrated
+    bool readCalibration(Calibration &calibration);
+
+    // Replaces the Arduino's calibration
+    //
+    // @param calibration The calibration to use
+    //
+    // @returns true if it was written
+    bool writeCalibration(const Calibration &calibration);
+
+    // Loads and saves the stored calibration. It's kept in
+    // /etc/PiWarsQTR8RC.cal unless the PIWARS_LINE_CALIBRATION
+    // environment variable gives another file.
+    //
+    // @param calibration The calibration
+    //
+    // @returns true if it was loaded or saved
+    static bool loadCalibration(Calibration &calibration);
+    static bool saveCalibration(const Calibration &calibration);
+
   private:
+    static const size_t LINE_RESPONSE_LENGTH = 21; //<! Length of the response to a read
+    static const size_t CALIBRATION_RESPONSE_LENGTH = 19; //<! Length of the response to a calibration read
+
     void init(); //<! Initialise the range sensor
 
     bool _initialised; //<! Indicates if the sensor has been intialised
+    I2CCompletion _lineRead; //<! Asks the Arduino for a reading, and reads the response in to _lineResponse
+    char _lineResponse[LINE_RESPONSE_LENGTH]; //<! The response from the Arduino
+    bool _haveCounter; //<! Has a reading been seen yet?
+    uint16_t _lastCounter; //<! The Arduino's counter for the last reading seen
 };
 
 }
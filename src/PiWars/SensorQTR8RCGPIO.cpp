@@ -0,0 +1,334 @@
+/**
+ * The SensorQTR8RCGPIO class reads the Pololu QTR-8RC Reflectance Sensor
+ * Array directly from the Pi's GPIO pins, rather than via the Arduino.
+ * Each sensor's capacitor is charged, then timed as it discharges, the
+ * darker the surface the longer it takes.
+ * https://www.pololu.com/product/961
+ *
+ * Readings are taken by the SensorScheduler at a fixed rate, and are
+ * turned into values and a position the same way the Arduino's QTRSensors
+ * library does, so the two are interchangeable.
+ *
+ * As with the Arduino, the calibration is stored on the Pi once it's been
+ * calibrated, and restored each time the sensor is enabled.
+ */
+
+#include "SensorQTR8RCGPIO.h"
+#include "SensorScheduler.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+
+namespace PiWars
+{
+
+const unsigned SensorQTR8RCGPIO::SENSOR_PINS[SENSOR_COUNT] = { 17, 18, 19, 20, 21, 22, 26, 27 };
+
+// How often to take a reading. Each one takes a little over the timeout
+static const double QTR8RC_SAMPLE_RATE = 100.0;
+
+// How long to charge the capacitors for
+static const std::chrono::microseconds qtr8rcChargeTime(10);
+
+// How long to wait for the capacitors to discharge. Anything slower is as
+// dark as it gets. Matches the Arduino's qtr8RCTimeout
+static const std::chrono::microseconds qtr8rcTimeout(2500);
+
+// How long readLine() waits for a reading before giving up
+static const std::chrono::milliseconds qtr8rcReadTimeout(50);
+
+// Where the calibration is stored, unless PIWARS_LINE_GPIO_CALIBRATION
+// says otherwise. It's kept apart from the Arduino's, as the discharge
+// times seen through the Pi's GPIO pins don't match those it measures.
+static const char *defaultCalibrationPath = "/etc/PiWarsQTR8RCGPIO.cal";
+
+// How long to sweep the sensor across the line if there's no stored
+// calibration
+static const std::chrono::seconds calibrationTime(5);
+
+// Values above this mean the sensor is over the line
+static const uint16_t ON_LINE_VALUE = 200;
+
+// Values at or below this are treated as noise when finding the line
+static const uint16_t NOISE_VALUE = 50;
+
+SensorQTR8RCGPIO::SensorQTR8RCGPIO(GPIO *gpio)
+  : SensorLine()
+  , _gpio(gpio)
+  , _lastRead(0)
+  , _calibrating(false)
+  , _calibrated(false)
+  , _lastPosition(0)
+{
+}
+
+SensorQTR8RCGPIO::~SensorQTR8RCGPIO() {
+  disable();
+}
+
+bool SensorQTR8RCGPIO::exists() {
+  return (nullptr != _gpio);
+}
+
+bool SensorQTR8RCGPIO::enable() {
+  if(!isEnabled()) {
+    // Only return readings taken from now on
+    _lastRead = lines().sequence();
+
+    if(!SensorScheduler::instance().add(this, "QTR8RC", QTR8RC_SAMPLE_RATE)) {
+      return false;
+    }
+
+    // Use the last calibration if there is one, so we're ready to go
+    // straight away
+    if(loadCalibration()) {
+      std::cout << "Calibration restored" << std::endl;
+    }
+    else if(startCalibration()) {
+      std::cout << "Calibration started" << std::endl;
+
+      // Allow 5 seconds for calibration, while the readings are taken
+      std::this_thread::sleep_for(calibrationTime);
+
+      if(stopCalibration()) {
+        std::cout << "Calibration complete" << std::endl;
+      }
+    }
+
+    // Call the base class to perform any
+    // generic changes
+    Sensor::enable();
+  }
+
+  return isEnabled();
+}
+
+void SensorQTR8RCGPIO::disable() {
+  if(isEnabled()) {
+    // Stop taking readings, and make sure the LEDs are left off
+    SensorScheduler::instance().remove(this);
+    _gpio->write(EMITTER_PIN, false);
+
+    Sensor::disable();
+  }
+}
+
+void SensorQTR8RCGPIO::sample() {
+  uint32_t times[SENSOR_COUNT];
+  Line line;
+
+  // Light up the surface while the sensors are timed
+  _gpio->write(EMITTER_PIN, true);
+  bool timed = _gpio->timeDischarge(SENSOR_PINS, SENSOR_COUNT, qtr8rcChargeTime, qtr8rcTimeout, times);
+  _gpio->write(EMITTER_PIN, false);
+
+  if(!timed) {
+    return;
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    for(size_t i = 0; i < SENSOR_COUNT; i++) {
+      if(_calibrating) {
+        _minimum[i] = std::min(_minimum[i], times[i]);
+        _maximum[i] = std::max(_maximum[i], times[i]);
+      }
+
+      line.values[i] = value(i, times[i]);
+    }
+
+    line.position = position(line.values);
+
+    publish(line);
+  }
+
+  _sampled.notify_all();
+}
+
+bool SensorQTR8RCGPIO::readLine(uint16_t (&sensorDiff)[SENSOR_COUNT], uint16_t &position) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  LineSamples::Sample line;
+
+  if(!_sampled.wait_for(lock, qtr8rcReadTimeout, [this]() { return lines().sequence() > _lastRead; }) ||
+     !lines().latest(line)) {
+    std::cerr << __func__ << ": No reading from the sensor" << std::endl;
+    return false;
+  }
+
+  for(size_t i = 0; i < SENSOR_COUNT; i++) {
+    sensorDiff[i] = line.value.values[i];
+  }
+  position = line.value.position;
+  _lastRead = line.sequence;
+
+  return true;
+}
+
+bool SensorQTR8RCGPIO::startCalibration() {
+  std::unique_lock<std::mutex> lock(_mutex);
+
+  for(size_t i = 0; i < SENSOR_COUNT; i++) {
+    _minimum[i] = qtr8rcTimeout.count();
+    _maximum[i] = 0;
+  }
+
+  _calibrating = true;
+  _calibrated = false;
+
+  return true;
+}
+
+bool SensorQTR8RCGPIO::stopCalibration() {
+  bool calibrated = true;
+
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    if(!_calibrating) {
+      return true;
+    }
+
+    _calibrating = false;
+
+    // Only use it if readings were taken
+    for(size_t i = 0; i < SENSOR_COUNT; i++) {
+      if(_maximum[i] <= _minimum[i]) {
+        std::cerr << __func__ << ": Sensor " << i << " wasn't calibrated" << std::endl;
+        calibrated = false;
+      }
+    }
+
+    _calibrated = calibrated;
+  }
+
+  // Keep it for next time
+  if(calibrated) {
+    saveCalibration();
+  }
+
+  return true;
+}
+
+// Returns where the calibration is stored
+static const char *calibrationPath() {
+  const char *path = getenv("PIWARS_LINE_GPIO_CALIBRATION");
+
+  return path ? path : defaultCalibrationPath;
+}
+
+bool SensorQTR8RCGPIO::loadCalibration() {
+  std::ifstream file(calibrationPath());
+  uint32_t minimum[SENSOR_COUNT], maximum[SENSOR_COUNT];
+  std::string name;
+
+  if(!file) {
+    return false;
+  }
+
+  // Stored as a line of minimums then a line of maximums
+  file >> name;
+  for(size_t i = 0; file && "minimum" == name && i < SENSOR_COUNT; i++) {
+    file >> minimum[i];
+  }
+
+  file >> name;
+  for(size_t i = 0; file && "maximum" == name && i < SENSOR_COUNT; i++) {
+    file >> maximum[i];
+  }
+
+  if(!file || "maximum" != name) {
+    std::cerr << __func__ << ": Ignoring invalid calibration in " << calibrationPath() << std::endl;
+    return false;
+  }
+
+  for(size_t i = 0; i < SENSOR_COUNT; i++) {
+    if(maximum[i] <= minimum[i]) {
+      std::cerr << __func__ << ": Ignoring invalid calibration in " << calibrationPath() << std::endl;
+      return false;
+    }
+  }
+
+  std::unique_lock<std::mutex> lock(_mutex);
+
+  std::copy(std::begin(minimum), std::end(minimum), _minimum);
+  std::copy(std::begin(maximum), std::end(maximum), _maximum);
+  _calibrating = false;
+  _calibrated = true;
+
+  return true;
+}
+
+bool SensorQTR8RCGPIO::saveCalibration() {
+  std::unique_lock<std::mutex> lock(_mutex);
+  std::ofstream file(calibrationPath(), std::ios::trunc);
+
+  file << "minimum";
+  for(size_t i = 0; i < SENSOR_COUNT; i++) {
+    file << " " << _minimum[i];
+  }
+  file << std::endl;
+
+  file << "maximum";
+  for(size_t i = 0; i < SENSOR_COUNT; i++) {
+    file << " " << _maximum[i];
+  }
+  file << std::endl;
+
+  if(!file) {
+    std::cerr << __func__ << ": Failed to save the calibration to " << calibrationPath() << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+uint16_t SensorQTR8RCGPIO::value(size_t sensor, uint32_t time) {
+  // As with the QTRSensors library, without a calibration the raw
+  // time is used
+  if(!_calibrated) {
+    return time;
+  }
+
+  if(time <= _minimum[sensor]) {
+    return 0;
+  }
+  if(time >= _maximum[sensor]) {
+    return 1000;
+  }
+
+  return ((time - _minimum[sensor]) * 1000) / (_maximum[sensor] - _minimum[sensor]);
+}
+
+uint16_t SensorQTR8RCGPIO::position(const uint16_t (&values)[SENSOR_COUNT]) {
+  uint32_t weighted = 0, total = 0;
+  bool onLine = false;
+
+  // Take the average of the sensors' positions, weighted by their values
+  for(size_t i = 0; i < SENSOR_COUNT; i++) {
+    if(values[i] > ON_LINE_VALUE) {
+      onLine = true;
+    }
+
+    if(values[i] > NOISE_VALUE) {
+      weighted += (uint32_t)values[i] * (i * 1000);
+      total += values[i];
+    }
+  }
+
+  // If the line's been lost, assume it's off whichever edge it was last
+  // seen nearest
+  if(!onLine) {
+    return (_lastPosition < ((SENSOR_COUNT - 1) * 1000) / 2) ? 0 : (SENSOR_COUNT - 1) * 1000;
+  }
+
+  _lastPosition = weighted / total;
+
+  return _lastPosition;
+}
+
+}
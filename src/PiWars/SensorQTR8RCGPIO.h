@@ -0,0 +1,115 @@
+/**
+ * The SensorQTR8RCGPIO class reads the Pololu QTR-8RC Reflectance Sensor
+ * Array directly from the Pi's GPIO pins, rather than via the Arduino.
+ * Each sensor's capacitor is charged, then timed as it discharges, the
+ * darker the surface the longer it takes.
+ * https://www.pololu.com/product/961
+ *
+ * Readings are taken by the SensorScheduler at a fixed rate, and are
+ * turned into values and a position the same way the Arduino's QTRSensors
+ * library does, so the two are interchangeable.
+ *
+ * As with the Arduino, the calibration is stored on the Pi once it's been
+ * calibrated, and restored each time the sensor is enabled.
+ */
+
+#ifndef _PIWARS_SENSORQTR8RCGPIO_H
+#define _PIWARS_SENSORQTR8RCGPIO_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+
+#include "SensorLine.h"
+#include "GPIO.h"
+
+namespace PiWars {
+
+class SensorQTR8RCGPIO : public SensorLine {
+  public:
+    static const unsigned EMITTER_PIN = 16; //!< The GPIO pin controlling the IR LEDs
+    static const unsigned SENSOR_PINS[SENSOR_COUNT]; //!< The GPIO pin of each sensor
+
+    // Initialize the QTR-8RC ready for use
+    //
+    // @param gpio The GPIO pins the sensor is connected to
+    SensorQTR8RCGPIO(GPIO *gpio = GPIO::instance());
+    ~SensorQTR8RCGPIO();
+
+    // Checks if the sensor is present. The sensor can't be detected, so
+    // is assumed to be there if the GPIO pins are usable.
+    //
+    // @returns true if the sensor exists
+    bool exists();
+
+    // Enables the sensor ready for use, having the SensorScheduler
+    // constantly take readings. The stored calibration is restored, or
+    // if there isn't one the sensor is calibrated for a few seconds,
+    // while it's swept across the line.
+    //
+    // @returns true if successfully enabled
+    bool enable();
+
+    // Disable the sensor, turning off the IR LEDs
+    void disable();
+
+    // Takes a single reading
+    void sample();
+
+    // Returns the next reading taken after the last one returned, waiting
+    // for it if needed
+    //
+    // @param sensorDiff Filled in with the reading of each sensor
+    // @param position Filled in with an estimate of where the line is
+    //
+    // @returns True if sensor results read in
+    //          false otherwise
+    bool readLine(uint16_t (&sensorDiff)[SENSOR_COUNT], uint16_t &position);
+
+    // Starts and stops recording the lightest and darkest readings. Once
+    // stopped, the calibration is stored for next time.
+    bool startCalibration();
+    bool stopCalibration();
+
+  private:
+    // Loads the stored calibration, and starts using it
+    //
+    // @returns true if there was a valid calibration
+    bool loadCalibration();
+
+    // Stores the calibration being used, to be loaded next time
+    //
+    // @returns true if it was stored
+    bool saveCalibration();
+
+    // Turns a discharge time into a value, using the calibration if there is one
+    //
+    // @param sensor The sensor
+    // @param time How long it took to discharge, in us
+    //
+    // @returns The value
+    uint16_t value(size_t sensor, uint32_t time);
+
+    // Works out where the line is from the values of the sensors
+    //
+    // @param values The values of each sensor
+    //
+    // @returns The position of the line
+    uint16_t position(const uint16_t (&values)[SENSOR_COUNT]);
+
+    GPIO *_gpio; //<! The GPIO pins the sensor is connected to
+    std::mutex _mutex; //<! Protects the calibration, and used to wait for readings
+    std::condition_variable _sampled; //<! Signalled each time a reading is taken
+    uint64_t _lastRead; //<! The sequence number of the last reading returned by readLine()
+
+    bool _calibrating; //<! Are the lightest and darkest readings being recorded?
+    bool _calibrated; //<! Is there a calibration to use?
+    uint32_t _minimum[SENSOR_COUNT]; //<! The lightest reading of each sensor, in us
+    uint32_t _maximum[SENSOR_COUNT]; //<! The darkest reading of each sensor, in us
+    uint16_t _lastPosition; //<! Where the line was last seen
+};
+
+}
+
+#endif
@@ -1,25 +1,43 @@
 #include "SensorRTIMU.h"
+#include "SensorScheduler.h"
 #include "RTIMULib.h"
 
+#include <algorithm>
 #include <iostream>
-#include <thread>
 
 namespace PiWars
 {
 
+// The furthest ahead of the latest reading to predict the yaw. Any
+// further and the reading is too stale to trust the gyro rate.
+static const std::chrono::milliseconds maximumPrediction(100);
+
+// How long the fusion takes to settle once the IMU is opened
+static const std::chrono::milliseconds settleTime(2000);
+
+SensorRTIMU &SensorRTIMU::instance() {
+  // The scheduler is used until the IMU is destroyed, so make sure it
+  // outlives it
+  SensorScheduler::instance();
+
+  static SensorRTIMU rtimu;
+
+  return rtimu;
+}
 
 SensorRTIMU::SensorRTIMU()
   : Sensor()
   , _initialised(false)
-  , _pitch(0)
-  , _roll(0)
-  , _yaw(0)
-  , _rtimuReader(nullptr)
-  , _rtimuReaderQuit(false)
+  , _settings(nullptr)
+  , _imu(nullptr)
 {
 }
 
 SensorRTIMU::~SensorRTIMU() {
+  SensorScheduler::instance().remove(this);
+
+  delete _imu;
+  delete _settings;
 }
 
 bool SensorRTIMU::exists() {
@@ -28,12 +46,57 @@ bool SensorRTIMU::exists() {
   return true;
 }
 
+bool SensorRTIMU::open() {
+  if(_imu) {
+    return true;
+  }
+
+  // read in the main settings and create the RTIMU class
+  _settings = new RTIMUSettings("/etc", "RTIMULib");
+  _imu = RTIMU::createIMU(_settings);
+
+  if ((_imu == NULL) || (_imu->IMUType() == RTIMU_TYPE_NULL)) {
+    std::cerr << __func__ << ": IMU not found!" << std::endl;
+
+    delete _imu;
+    delete _settings;
+    _imu = nullptr;
+    _settings = nullptr;
+
+    return false;
+  }
+
+  _imu->IMUInit();
+
+  // Use the recommended values
+  _imu->setSlerpPower(0.02);
+  _imu->setGyroEnable(true);
+  _imu->setAccelEnable(true);
+  _imu->setCompassEnable(true);
+
+  _opened = ReadingSamples::clock::now();
+
+  return true;
+}
+
+void SensorRTIMU::schedule(double rate) {
+  // It's polled half way through each period to keep it apart from the
+  // other sensors. The scheduler's periodic timer doesn't drift however
+  // long each poll takes.
+  SensorScheduler::instance().remove(this);
+  SensorScheduler::instance().add(this, "RTIMU", rate, std::chrono::microseconds((int64_t)(500000.0 / rate)));
+}
+
 bool SensorRTIMU::enable() {
   if(!isEnabled()) {
-    // Create a thread to poll the range sensor, so there is always a valid
-    // range ready to be read.
-    _rtimuReaderQuit = false;
-    _rtimuReader = new std::thread(rtimuReader, std::ref(_rtimuReaderQuit), std::ref(_pitch), std::ref(_roll), std::ref(_yaw));
+    if(!open()) {
+      return false;
+    }
+
+    // Have the IMU polled at the rate it asks for, so there is always
+    // a valid reading ready to be read. It carries on at this rate while
+    // disabled.
+    schedule(1000.0 / std::max(1, _imu->IMUGetPollInterval()));
 
     // Call the base class to perform any
     // generic changes
@@ -46,60 +109,101 @@ bool SensorRTIMU::enable() {
 
 void SensorRTIMU::disable() {
   if(isEnabled()) {
-    // Tell the thread to exit
-    _rtimuReaderQuit = true;
-
-    // and wait for it to do so
-    _rtimuReader->join();
-    _rtimuReader = nullptr;
+    // Keep reading in the values at the same rate, so the fusion stays
+    // settled. The SenseHAT's IMU doesn't queue up its readings, so any
+    // that aren't read in time are lost to the fusion. It's on the
+    // internal bus, so this doesn't hold up the other sensors.
 
     Sensor::disable();
   }
 }
-void SensorRTIMU::fusion(float &pitch, float &roll, float &yaw) {
-  pitch = _pitch;
-  roll = _roll;
-  yaw = _yaw;
-}
 
-void SensorRTIMU::rtimuReader(std::atomic<bool> &quit, std::atomic<float> &pitch, std::atomic<float> &roll, std::atomic<float> &yaw)
-{
-  // read in the main settings and create the RTIMU class
-  RTIMUSettings *settings = new RTIMUSettings("/etc", "RTIMULib");
-  RTIMU *imu = RTIMU::createIMU(settings);
+std::chrono::milliseconds SensorRTIMU::settling() {
+  if(!_imu) {
+    return settleTime;
+  }
 
-  if ((imu == NULL) || (imu->IMUType() == RTIMU_TYPE_NULL)) {
-    std::cerr << __func__ << ": IMU not found!" << std::endl;
+  auto settled = _opened + settleTime;
+  auto now = ReadingSamples::clock::now();
+
+  return (now >= settled) ? std::chrono::milliseconds(0) : std::chrono::duration_cast<std::chrono::milliseconds>(settled - now);
+}
+
+void SensorRTIMU::sample() {
+  // The IMU timestamps its readings using the system clock, so work out
+  // how to turn them into the steady clock the readings are published with
+  auto steadyNow = ReadingSamples::clock::now();
+  auto systemNow = std::chrono::system_clock::now();
+  bool read = false;
+
+  // IMUs that queue up their readings may have taken several since we
+  // last looked, so publish each one rather than just the latest
+  while(_imu->IMURead()) {
+    RTIMU_DATA imuData = _imu->getIMUData();
+
+    if(imuData.fusionPoseValid) {
+      std::chrono::system_clock::time_point taken(std::chrono::microseconds(imuData.timestamp));
+      auto age = std::max(std::chrono::system_clock::duration::zero(), systemNow - taken);
+      Reading reading;
+
+      reading.pitch = imuData.fusionPose.x()* RTMATH_RAD_TO_DEGREE;
+      reading.roll = imuData.fusionPose.y()* RTMATH_RAD_TO_DEGREE;
+      reading.yaw = imuData.fusionPose.z() * RTMATH_RAD_TO_DEGREE;
+
+      reading.gyro.x = imuData.gyro.x() * RTMATH_RAD_TO_DEGREE;
+      reading.gyro.y = imuData.gyro.y() * RTMATH_RAD_TO_DEGREE;
+      reading.gyro.z = imuData.gyro.z() * RTMATH_RAD_TO_DEGREE;
+
+      reading.accel.x = imuData.accel.x();
+      reading.accel.y = imuData.accel.y();
+      reading.accel.z = imuData.accel.z();
+
+      _readings.push(reading, steadyNow - std::chrono::duration_cast<ReadingSamples::clock::duration>(age));
+      read = true;
+    }
+  }
 
-    // Exit out early
-    return;
+  if(read) {
+    changed();
   }
+}
 
-  imu->IMUInit();
+void SensorRTIMU::fusion(float &pitch, float &roll, float &yaw) {
+  ReadingSamples::Sample reading;
 
-  // Use the recommended values
-  imu->setSlerpPower(0.02);
-  imu->setGyroEnable(true);
-  imu->setAccelEnable(true);
-  imu->setCompassEnable(true);
+  // All three come from the same reading
+  if(_readings.latest(reading)) {
+    pitch = reading.value.pitch;
+    roll = reading.value.roll;
+    yaw = reading.value.yaw;
+  }
+  else {
+    pitch = roll = yaw = 0;
+  }
+}
 
-  while(!quit.load()) {
+bool SensorRTIMU::predictYaw(float &yaw, ReadingSamples::clock::time_point now) {
+  ReadingSamples::Sample reading;
 
-    std::this_thread::sleep_for (std::chrono::milliseconds(imu->IMUGetPollInterval()));
+  if(!_readings.latest(reading)) {
+    yaw = 0;
+    return false;
+  }
 
-    if(imu->IMURead()) {
-      RTIMU_DATA imuData = imu->getIMUData();
+  auto ahead = std::min(std::chrono::duration_cast<ReadingSamples::clock::duration>(maximumPrediction),
+                        std::max(ReadingSamples::clock::duration::zero(), now - reading.timestamp));
 
-      if(imuData.fusionPoseValid) {
-        pitch = imuData.fusionPose.x()* RTMATH_RAD_TO_DEGREE;
-        roll = imuData.fusionPose.y()* RTMATH_RAD_TO_DEGREE;
-        yaw = imuData.fusionPose.z() * RTMATH_RAD_TO_DEGREE;
-      }
-    }
+  yaw = reading.value.yaw + (reading.value.gyro.z * std::chrono::duration<float>(ahead).count());
+
+  // Keep it within the same range as the fused yaw
+  if(yaw > 180.0f) {
+    yaw -= 360.0f;
+  }
+  else if(yaw <= -180.0f) {
+    yaw += 360.0f;
   }
 
-  delete imu;
-  delete settings;
+  return true;
 }
 
 void SensorRTIMU::init() {
@@ -1,26 +1,40 @@
 /**
  * This Sensor interfaces with the RTIMU library to read
  * in sensor details from the connected SenseHAT
+ *
+ * Every reading the IMU takes is published, timestamped with when the
+ * IMU took it, along with the gyro rates and acceleration it was fused
+ * from. The latest gyro rate can then be used to predict the heading
+ * between readings.
+ *
+ * There is a single instance, shared by everything using the IMU. Once
+ * opened the IMU is kept open, and is still read at the rate it asks for
+ * while disabled, so the fusion stays settled. Enabling it again then gives a good pose
+ * straight away, rather than waiting for the IMU to start up and settle.
  */
 
 #ifndef _PIWARS_SENSORRTIMU_H
 #define _PIWARS_SENSORRTIMU_H
 
-#include <atomic>
-#include <thread>
+#include <chrono>
 #include <cstdint>
 #include <cstddef>
 
 #include "Sensor.h"
 #include "I2C.h"
 
+// Forward declarations
+class RTIMU;
+class RTIMUSettings;
+
 namespace PiWars {
 
 class SensorRTIMU : public Sensor {
   public:
-    // Initialize the RTIMU ready for use
-    SensorRTIMU();
-    ~SensorRTIMU();
+    // Returns the RTIMU
+    //
+    // @returns The instance
+    static SensorRTIMU &instance();
 
     // Checks if the sensor is present. Some sensors can be dynamically
     // added or removed from the robot, or turned on and off, so arn't
@@ -29,17 +43,38 @@ class SensorRTIMU : public Sensor {
     // @returns true if the sensor exists
     bool exists();
 
-    // Enables the sensor ready for use.
-    // This starts a background thread to constantly read in and update
-    // the sensor results
+    // Enables the sensor ready for use, opening the IMU if it isn't
+    // already. This has the SensorScheduler read in and update the
+    // sensor results at the rate the IMU asks for.
     //
     // @returns true if successfully enabled
     bool enable();
 
-    // Disable the sensor, requesting the background thread
-    // to exit and waiting for it to finish
+    // Disable the sensor. The IMU is kept open, and still read at the
+    // rate it asks for to keep the fusion settled.
     void disable();
 
+    // Reads in every reading the IMU has taken since the last sample
+    void sample();
+
+    // A value along each axis
+    struct Vector {
+      float x; //<! Along the x axis
+      float y; //<! Along the y axis
+      float z; //<! Along the z axis
+    };
+
+    // A single reading of the IMU
+    struct Reading {
+      float pitch; //<! The fused pitch, in degrees
+      float roll; //<! The fused roll, in degrees
+      float yaw; //<! The fused yaw, in degrees
+      Vector gyro; //<! The rate of turn about each axis, in degrees per second
+      Vector accel; //<! The acceleration along each axis, in g
+    };
+
+    typedef SampleRing<Reading> ReadingSamples;
+
     // Returns the current values
     //
     // @param pitch Filled in with the current pitch
@@ -47,17 +82,49 @@ class SensorRTIMU : public Sensor {
     // @param yaw   Filled in with the current yaw
     void fusion(float &pitch, float &roll, float &yaw);
 
+    // Predicts the yaw at a given time, carrying on from the latest
+    // reading at the rate the gyro last measured. This makes up for
+    // the time since the reading was taken.
+    //
+    // @param yaw Filled in with the predicted yaw, in degrees
+    // @param now When to predict the yaw for
+    //
+    // @returns true if there was a reading to predict from
+    bool predictYaw(float &yaw, ReadingSamples::clock::time_point now = ReadingSamples::clock::now());
+
+    // Returns how much longer the fusion needs to settle after the IMU
+    // was opened, before the pose can be relied on
+    //
+    // @returns The time left, zero if it has settled
+    std::chrono::milliseconds settling();
+
+    // Returns the readings, along with when the IMU took them
+    //
+    // @returns The readings
+    const ReadingSamples &readings() { return _readings; }
+
   private:
+    SensorRTIMU();
+    ~SensorRTIMU();
+
+    // Opens the IMU, if it isn't already
+    //
+    // @returns true if the IMU is open
+    bool open();
+
+    // Has the SensorScheduler read the IMU at a new rate
+    //
+    // @param rate How many times a second to read it
+    void schedule(double rate);
+
     void init(); //<! Initialise the range sensor
-    static void rtimuReader(std::atomic<bool> &quit, std::atomic<float> &pitch, std::atomic<float> &roll, std::atomic<float> &yaw); //<! Background thread for polling the sensor
 
     bool _initialised; //<! Indicates if the sensor has been intialised
-    std::atomic<float> _pitch; //<! The last successfully read in pitch.
-    std::atomic<float> _roll; //<! The last successfully read in roll.
-    std::atomic<float> _yaw; //<! The last successfully read in yaw.
+    ReadingSamples _readings; //<! The successfully read in readings
 
-    std::thread *_rtimuReader; //<! Background thread for reading in the values
-    std::atomic<bool> _rtimuReaderQuit; //<! Used to indicate when the thread should exit
+    RTIMUSettings *_settings; //<! The settings the IMU was created with
+    RTIMU *_imu; //<! The IMU being read from
+    ReadingSamples::clock::time_point _opened; //<! When the IMU was opened
 };
 
 }
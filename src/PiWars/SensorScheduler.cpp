@@ -0,0 +1,356 @@
+/**
+ * The SensorScheduler takes the readings of all the enabled sensors from
+ * a single thread, rather than each sensor polling from its own. Each
+ * sensor is given a rate, and a phase so sensors sharing a bus can be
+ * spread out rather than all asking for the bus at once. The sensors'
+ * sample() steps are driven by timerfds, so they run on time without
+ * drifting, and the achieved rate and jitter of each is measured.
+ *
+ * Sensors that signal when a reading is ready can instead be sampled
+ * each time their interrupt fires, so each reading is taken once, as
+ * soon as it's ready.
+ */
+
+#include "SensorScheduler.h"
+#include "Sensor.h"
+#include "GPIO.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+namespace PiWars
+{
+
+static const uint64_t NS_PER_SECOND = 1000000000;
+
+// The maximum number of timers handled in one go
+static const int MAX_EVENTS = 8;
+
+// Returns the time on the monotonic clock the timers use
+static uint64_t monotonicNow() {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return ((uint64_t)now.tv_sec * NS_PER_SECOND) + now.tv_nsec;
+}
+
+SensorScheduler &SensorScheduler::instance() {
+  static SensorScheduler scheduler;
+
+  return scheduler;
+}
+
+SensorScheduler::SensorScheduler()
+  : _epoch(monotonicNow())
+  , _epollFD(epoll_create1(EPOLL_CLOEXEC))
+  , _quitFD(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+  , _schedulerThread(nullptr)
+{
+  struct epoll_event event = {};
+
+  event.events = EPOLLIN;
+  event.data.fd = _quitFD;
+  epoll_ctl(_epollFD, EPOLL_CTL_ADD, _quitFD, &event);
+
+  _schedulerThread = new std::thread(schedulerThread, this);
+}
+
+SensorScheduler::~SensorScheduler() {
+  uint64_t value = 1;
+
+  // Report how well the sensors kept to their schedules, if asked to
+  if(getenv("PIWARS_SENSOR_STATS")) {
+    dump(std::cerr);
+  }
+
+  // Tell the thread to exit
+  write(_quitFD, &value, sizeof(value));
+
+  // and wait for it to do so
+  _schedulerThread->join();
+  delete _schedulerThread;
+  _schedulerThread = nullptr;
+
+  for(auto &entry : _entries) {
+    close(entry.second.fd);
+  }
+
+  close(_quitFD);
+  close(_epollFD);
+}
+
+bool SensorScheduler::add(Sensor *sensor, const std::string &name, double rate, std::chrono::microseconds phase) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  struct itimerspec spec = {};
+  uint64_t now = monotonicNow();
+
+  if(rate <= 0.0 || _entries.count(sensor)) {
+    return false;
+  }
+
+  Entry entry = {};
+
+  entry.sensor = sensor;
+  entry.name = name;
+  entry.rate = rate;
+  entry.period = (uint64_t)(NS_PER_SECOND / rate);
+
+  // Start at the next period boundary after now, so sensors with the same
+  // rate keep their phases apart
+  entry.due = _epoch + (std::chrono::duration_cast<std::chrono::nanoseconds>(phase).count() % entry.period);
+  if(entry.due <= now) {
+    entry.due += (((now - entry.due) / entry.period) + 1) * entry.period;
+  }
+
+  spec.it_value.tv_sec = entry.due / NS_PER_SECOND;
+  spec.it_value.tv_nsec = entry.due % NS_PER_SECOND;
+  spec.it_interval.tv_sec = entry.period / NS_PER_SECOND;
+  spec.it_interval.tv_nsec = entry.period % NS_PER_SECOND;
+
+  return start(entry, spec, TFD_TIMER_ABSTIME);
+}
+
+bool SensorScheduler::add(Sensor *sensor, const std::string &name, GPIOInterrupt &interrupt, double rate, std::chrono::microseconds timeout) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  struct epoll_event event = {};
+  struct itimerspec spec = {};
+
+  if(rate <= 0.0 || timeout.count() <= 0 || _entries.count(sensor)) {
+    return false;
+  }
+
+  Entry entry = {};
+
+  entry.sensor = sensor;
+  entry.name = name;
+  entry.rate = rate;
+  entry.period = (uint64_t)(NS_PER_SECOND / rate);
+  entry.interrupt = &interrupt;
+  entry.timeout = std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count();
+
+  // The timer only expires if the interrupt stops firing
+  spec.it_value.tv_sec = entry.timeout / NS_PER_SECOND;
+  spec.it_value.tv_nsec = entry.timeout % NS_PER_SECOND;
+  spec.it_interval = spec.it_value;
+
+  event.events = EPOLLIN;
+  event.data.fd = interrupt.getFD();
+
+  if(0 != epoll_ctl(_epollFD, EPOLL_CTL_ADD, interrupt.getFD(), &event)) {
+    std::cerr << __func__ << ": Failed to wait for the interrupt for " << name << std::endl;
+    return false;
+  }
+
+  if(!start(entry, spec, 0)) {
+    epoll_ctl(_epollFD, EPOLL_CTL_DEL, interrupt.getFD(), nullptr);
+    return false;
+  }
+
+  return true;
+}
+
+bool SensorScheduler::start(Entry &entry, const struct itimerspec &spec, int flags) {
+  struct epoll_event event = {};
+
+  entry.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+  if(-1 == entry.fd) {
+    std::cerr << __func__ << ": Failed to create timer for " << entry.name << std::endl;
+    return false;
+  }
+
+  event.events = EPOLLIN;
+  event.data.fd = entry.fd;
+
+  if(0 != timerfd_settime(entry.fd, flags, &spec, nullptr) ||
+     0 != epoll_ctl(_epollFD, EPOLL_CTL_ADD, entry.fd, &event)) {
+    std::cerr << __func__ << ": Failed to start timer for " << entry.name << std::endl;
+    close(entry.fd);
+    return false;
+  }
+
+  _entries[entry.sensor] = entry;
+
+  return true;
+}
+
+void SensorScheduler::remove(Sensor *sensor) {
+  // Waits for any sample in progress, as the lock is held while sampling
+  std::unique_lock<std::mutex> lock(_mutex);
+  auto found = _entries.find(sensor);
+
+  if(found != _entries.end()) {
+    if(found->second.interrupt) {
+      epoll_ctl(_epollFD, EPOLL_CTL_DEL, found->second.interrupt->getFD(), nullptr);
+    }
+    epoll_ctl(_epollFD, EPOLL_CTL_DEL, found->second.fd, nullptr);
+    close(found->second.fd);
+    _entries.erase(found);
+  }
+}
+
+bool SensorScheduler::stats(Sensor *sensor, SensorScheduleStats &stats) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  auto found = _entries.find(sensor);
+
+  if(found == _entries.end()) {
+    return false;
+  }
+
+  SensorScheduler::stats(found->second, stats);
+  return true;
+}
+
+void SensorScheduler::stats(const Entry &entry, SensorScheduleStats &stats) {
+  stats.rate = entry.rate;
+  stats.samples = entry.samples;
+  stats.missed = entry.missed;
+  stats.achievedRate = 0.0;
+  stats.meanLateness = 0.0;
+  stats.jitter = 0.0;
+  stats.maxLateness = entry.maxLateness;
+
+  if(entry.samples > 1 && entry.last > entry.first) {
+    stats.achievedRate = (entry.samples - 1) / ((double)(entry.last - entry.first) / NS_PER_SECOND);
+  }
+
+  if(entry.samples) {
+    stats.meanLateness = entry.latenessTotal / entry.samples;
+    stats.jitter = std::sqrt(std::max(0.0, (entry.latenessSquares / entry.samples) - (stats.meanLateness * stats.meanLateness)));
+  }
+}
+
+void SensorScheduler::dump(std::ostream &out) {
+  std::unique_lock<std::mutex> lock(_mutex);
+
+  if(_entries.empty()) {
+    return;
+  }
+
+  out << "Sensor schedule (rates in Hz, lateness in us)" << std::endl;
+  out << "  sensor            rate  achieved   samples  missed  mean late  jitter  max late" << std::endl;
+
+  for(auto &entry : _entries) {
+    SensorScheduleStats stats;
+
+    SensorScheduler::stats(entry.second, stats);
+
+    out << "  " << std::left << std::setw(14) << entry.second.name << std::right
+        << std::fixed << std::setprecision(1)
+        << std::setw(8) << stats.rate
+        << std::setw(10) << stats.achievedRate
+        << std::setw(10) << stats.samples
+        << std::setw(8) << stats.missed
+        << std::setw(11) << stats.meanLateness
+        << std::setw(8) << stats.jitter
+        << std::setw(10) << stats.maxLateness
+        << std::endl;
+  }
+}
+
+void SensorScheduler::timerExpired(Entry &entry) {
+  uint64_t expirations = 0;
+
+  if(sizeof(expirations) != read(entry.fd, &expirations, sizeof(expirations)) || 0 == expirations) {
+    return;
+  }
+
+  uint64_t now = monotonicNow();
+
+  // The interrupt hasn't fired, so sample anyway in case it was missed
+  if(entry.interrupt) {
+    entry.missed += expirations;
+    record(entry, now, 0.0);
+  }
+  else {
+    // If we've fallen behind only take the latest sample
+    uint64_t scheduled = entry.due + ((expirations - 1) * entry.period);
+
+    entry.missed += expirations - 1;
+    entry.due = scheduled + entry.period;
+
+    record(entry, now, (now > scheduled) ? (double)(now - scheduled) / 1000 : 0.0);
+  }
+
+  entry.sensor->sample();
+}
+
+void SensorScheduler::interruptFired(Entry &entry) {
+  struct itimerspec spec = {};
+  GPIOInterrupt::clock::time_point fired;
+  uint64_t count = entry.interrupt->acknowledge(fired);
+
+  if(0 == count) {
+    return;
+  }
+
+  // Any interrupts that fired while we were busy only give one sample
+  GPIOInterrupt::clock::duration lateness = GPIOInterrupt::clock::now() - fired;
+
+  entry.missed += count - 1;
+  record(entry, monotonicNow(), std::max(0.0, std::chrono::duration<double, std::micro>(lateness).count()));
+
+  // Restart the timeout
+  spec.it_value.tv_sec = entry.timeout / NS_PER_SECOND;
+  spec.it_value.tv_nsec = entry.timeout % NS_PER_SECOND;
+  spec.it_interval = spec.it_value;
+  timerfd_settime(entry.fd, 0, &spec, nullptr);
+
+  entry.sensor->sample();
+}
+
+void SensorScheduler::record(Entry &entry, uint64_t now, double lateness) {
+  if(0 == entry.samples) {
+    entry.first = now;
+  }
+  entry.last = now;
+  entry.samples++;
+  entry.latenessTotal += lateness;
+  entry.latenessSquares += lateness * lateness;
+  if(lateness > entry.maxLateness) {
+    entry.maxLateness = lateness;
+  }
+}
+
+void SensorScheduler::schedulerThread(SensorScheduler *scheduler) {
+  struct epoll_event events[MAX_EVENTS];
+
+  while(true) {
+    int count = epoll_wait(scheduler->_epollFD, events, MAX_EVENTS, -1);
+
+    for(int i = 0; i < count; i++) {
+      // Time to exit?
+      if(events[i].data.fd == scheduler->_quitFD) {
+        return;
+      }
+
+      std::unique_lock<std::mutex> lock(scheduler->_mutex);
+
+      // The sensor may have been removed since the event
+      for(auto &found : scheduler->_entries) {
+        Entry &entry = found.second;
+
+        if(entry.fd == events[i].data.fd) {
+          timerExpired(entry);
+          break;
+        }
+
+        if(entry.interrupt && entry.interrupt->getFD() == events[i].data.fd) {
+          interruptFired(entry);
+          break;
+        }
+      }
+    }
+  }
+}
+
+}
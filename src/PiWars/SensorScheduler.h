@@ -0,0 +1,149 @@
+/**
+ * The SensorScheduler takes the readings of all the enabled sensors from
+ * a single thread, rather than each sensor polling from its own. Each
+ * sensor is given a rate, and a phase so sensors sharing a bus can be
+ * spread out rather than all asking for the bus at once. The sensors'
+ * sample() steps are driven by timerfds, so they run on time without
+ * drifting, and the achieved rate and jitter of each is measured.
+ *
+ * Sensors that signal when a reading is ready can instead be sampled
+ * each time their interrupt fires, so each reading is taken once, as
+ * soon as it's ready.
+ */
+
+#ifndef _PIWARS_SENSORSCHEDULER_H
+#define _PIWARS_SENSORSCHEDULER_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <time.h>
+
+namespace PiWars {
+
+  // Forward declarations
+  class GPIOInterrupt;
+  class Sensor;
+
+  // How well a sensor has kept to its schedule
+  struct SensorScheduleStats {
+    double rate; //<! The rate the sensor was asked to sample at, in Hz
+    double achievedRate; //<! The rate it actually sampled at, in Hz
+    uint64_t samples; //<! Number of times it was sampled
+    uint64_t missed; //<! Number of samples missed because the thread was busy, or the interrupt didn't fire
+    double meanLateness; //<! Mean time between when a sample was due (or ready) and taken, in us
+    double jitter; //<! Standard deviation of the lateness, in us
+    double maxLateness; //<! The latest a sample was taken, in us
+  };
+
+  class SensorScheduler {
+    public:
+      // Returns the scheduler shared by all the sensors
+      //
+      // @returns The scheduler
+      static SensorScheduler &instance();
+
+      // Starts sampling a sensor
+      //
+      // @param sensor The sensor, whose sample() will be called
+      // @param name The name of the sensor, for reporting
+      // @param rate How many times a second to sample the sensor
+      // @param phase How far into each period to sample it. Periods are
+      //              aligned across all sensors, so sensors sharing a bus
+      //              can be given different phases to keep them apart.
+      //
+      // @returns true if the sensor is being sampled
+      bool add(Sensor *sensor, const std::string &name, double rate, std::chrono::microseconds phase = std::chrono::microseconds(0));
+
+      // Starts sampling a sensor each time its interrupt fires. If it
+      // hasn't fired for a while the sensor is sampled anyway, in case an
+      // interrupt was missed.
+      //
+      // @param sensor The sensor, whose sample() will be called
+      // @param name The name of the sensor, for reporting
+      // @param interrupt Fires when the sensor has a reading ready. It must
+      //                  remain valid until the sensor is removed.
+      // @param rate How many times a second the interrupt should fire
+      // @param timeout How long to wait for the interrupt before sampling anyway
+      //
+      // @returns true if the sensor is being sampled
+      bool add(Sensor *sensor, const std::string &name, GPIOInterrupt &interrupt, double rate, std::chrono::microseconds timeout);
+
+      // Stops sampling a sensor, waiting for any sample in progress
+      //
+      // @param sensor The sensor
+      void remove(Sensor *sensor);
+
+      // Returns how well a sensor has kept to its schedule
+      //
+      // @param sensor The sensor
+      // @param stats Filled in with the statistics
+      //
+      // @returns true if the sensor is being sampled
+      bool stats(Sensor *sensor, SensorScheduleStats &stats);
+
+      // Writes a summary of how well every sensor is keeping to its schedule
+      //
+      // @param out Where to write the summary
+      void dump(std::ostream &out);
+
+    private:
+      // A sensor being sampled
+      struct Entry {
+        Sensor *sensor; //<! The sensor
+        std::string name; //<! The name of the sensor
+        int fd; //<! The timerfd driving it (or timing out its interrupt)
+        GPIOInterrupt *interrupt; //<! Fires when a reading is ready, or nullptr if sampled on the timer
+        uint64_t timeout; //<! Nanoseconds to wait for the interrupt
+        double rate; //<! The rate it should be sampled at
+        uint64_t period; //<! Nanoseconds between samples
+        uint64_t due; //<! When the next sample is due, on the monotonic clock in ns
+        uint64_t first; //<! When the first sample was taken
+        uint64_t last; //<! When the latest sample was taken
+        uint64_t samples; //<! Number of samples taken
+        uint64_t missed; //<! Number of samples missed
+        double latenessTotal; //<! Sum of the lateness of every sample, in us
+        double latenessSquares; //<! Sum of the squares of the lateness, in us
+        double maxLateness; //<! The latest a sample was taken, in us
+      };
+
+      SensorScheduler();
+      ~SensorScheduler();
+
+      // Fills in the statistics of an entry
+      //
+      // @param entry The entry
+      // @param stats Filled in with the statistics
+      static void stats(const Entry &entry, SensorScheduleStats &stats);
+
+      // Creates the timerfd for an entry and starts waiting for it
+      //
+      // @param entry The entry, with everything but the fd filled in
+      // @param spec When the timer should expire
+      // @param flags The timerfd_settime flags
+      //
+      // @returns true if the timer was started
+      bool start(Entry &entry, const struct itimerspec &spec, int flags);
+
+      static void timerExpired(Entry &entry); //<! Samples a sensor whose timer has expired
+      static void interruptFired(Entry &entry); //<! Samples a sensor whose interrupt has fired
+      static void record(Entry &entry, uint64_t now, double lateness); //<! Records a sample being taken
+
+      static void schedulerThread(SensorScheduler *scheduler); //<! Samples the sensors as they become due
+
+      std::map<Sensor *, Entry> _entries; //<! The sensors being sampled
+      uint64_t _epoch; //<! The periods of all the sensors are aligned to this
+      int _epollFD; //<! Waits for any of the timers to expire
+      int _quitFD; //<! eventfd used to tell the thread to exit
+      std::thread *_schedulerThread; //<! Samples the sensors
+      std::mutex _mutex; //<! Protects the entries, held while sampling
+  };
+
+}
+
+#endif
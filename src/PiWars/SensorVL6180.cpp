@@ -5,6 +5,7 @@
  */
 
 #include "SensorVL6180.h"
+#include "SensorScheduler.h"
 
 #include <iostream>
 #include <thread>
@@ -12,11 +13,100 @@
 namespace PiWars
 {
 
+// The settings the VL6180 needs to be configured with after a reset
+static constexpr I2CRegisterValue vl6180Settings[] = {
+  // Settings taken from Section 9 of the datasheet
+
+  // Mandatory : private registers
+  { 0x0207, 0x01 },
+  { 0x0208, 0x01 },
+  { 0x0096, 0x00 },
+  { 0x0097, 0xfd },
+  { 0x00e3, 0x00 },
+  { 0x00e4, 0x04 },
+  { 0x00e5, 0x02 },
+  { 0x00e6, 0x01 },
+  { 0x00e7, 0x03 },
+  { 0x00f5, 0x02 },
+  { 0x00d9, 0x05 },
+  { 0x00db, 0xce },
+  { 0x00dc, 0x03 },
+  { 0x00dd, 0xf8 },
+  { 0x009f, 0x00 },
+  { 0x00a3, 0x3c },
+  { 0x00b7, 0x00 },
+  { 0x00bb, 0x3c },
+  { 0x00b2, 0x09 },
+  { 0x00ca, 0x09 },
+  { 0x0198, 0x01 },
+  { 0x01b0, 0x17 },
+  { 0x01ad, 0x00 },
+  { 0x00ff, 0x05 },
+  { 0x0100, 0x05 },
+  { 0x0199, 0x05 },
+  { 0x01a6, 0x1b },
+  { 0x01ac, 0x3e },
+  { 0x01a7, 0x1f },
+  { 0x0030, 0x00 },
+
+  // Recommended : Public registers - See data sheet for more detail
+  { 0x0011, 0x10 }, // Enables polling for New Sample ready
+                    // when measurement completes
+  { 0x010a, 0x30 }, // Set the averaging sample period
+                    // (compromise between lower noise and
+                    // increased execution time)
+  { 0x003f, 0x46 }, // Sets the light and dark gain (upper
+                    // nibble). Dark gain should not be
+                    // changed.
+  { 0x0031, 0xFF }, // sets the # of range measurements after
+                    // which auto calibration of system is
+                    // performed
+  { 0x0040, 0x63 }, // Set ALS integration time to 100ms
+  { 0x002e, 0x01 }, // perform a single temperature calibration
+                    // of the ranging sensor
+
+  // Optional: Public registers - See data sheet for more detail
+  { 0x001b, 0x09 }, // Set default ranging inter-measurement
+                    // period to 100ms
+  { 0x003e, 0x31 }, // Set default ALS inter-measurement period
+                    // to 500ms
+  { 0x0014, 0x24 }, // Configures interrupt on New Sample
+                    // Ready threshold event
+};
+
+
+// How often a range is measured when ranging continuously, as set by the
+// inter-measurement period (0x001b) above
+static const std::chrono::milliseconds vl6180RangingPeriod(100);
+
+// The IDENTIFICATION__MODEL_ID register, as its 16 bit index
+static const char vl6180ModelIdRegister[] = { 0x00, 0x00 };
+
+// If GPIO1 hasn't signalled a new range for this long, check anyway
+// in case the interrupt was missed
+static const std::chrono::milliseconds vl6180InterruptTimeout(3 * vl6180RangingPeriod);
+
+SensorVL6180::SensorVL6180()
+  : Sensor()
+  , I2CExternal(0x29)
+  , _initialised(false)
+  , _registers(this)
+  , _interrupt(INTERRUPT_PIN, GPIOEdge::FALLING)
+{
+  // The proximity control loop relies on the range being up to date
+  setPriority(I2CPriority::CONTROL);
+
+  // The VL6180 supports fast mode, so let the clock find how fast the
+  // bus will go
+  setAdaptiveClock(STANDARD_MODE_BAUD, FAST_MODE_BAUD);
 
-SensorVL6180::SensorVL6180() : Sensor(), I2CExternal(0x29), _initialised(false), _range(255), _rangeReader(nullptr), _rangeReaderQuit(false) {
+  // Check the sensor is there by reading its model ID, which leaves the
+  // ranging alone
+  setProbe(vl6180ModelIdRegister, sizeof(vl6180ModelIdRegister), true);
 }
 
 SensorVL6180::~SensorVL6180() {
+  disable();
 }
 
 bool SensorVL6180::exists() {
@@ -25,16 +115,25 @@ bool SensorVL6180::exists() {
 
 bool SensorVL6180::enable() {
   if(!isEnabled()) {
-    // Set the 'cached' range to max
-    _range = 255;
+    // Set the 'cached' range to max, until a new one is read in
+    _ranges.push(255);
 
     // Initialise the sensor
     init();
 
-    // Create a thread to poll the range sensor, so there is always a valid
-    // range ready to be read.
-    _rangeReaderQuit = false;
-    _rangeReader = new std::thread(rangeReader, std::ref(_rangeReaderQuit), std::ref(_range));
+    // GPIO1 is configured to go low when a new range is ready, so
+    // start listening for it before any ranges are measured
+    _interrupt.start();
+
+    // Clear any stale result, so the first range pulls GPIO1 low, and
+    // start ranging continuously
+    _registers.queueStrobe(0x015, 0x07);
+    _registers.queueStrobe(0x018, 0x03);
+    _registers.flush();
+
+    // Have the scheduler read each range as it becomes ready, so there is
+    // always a valid range ready to be read.
+    SensorScheduler::instance().add(this, "VL6180", _interrupt, 1000.0 / vl6180RangingPeriod.count(), vl6180InterruptTimeout);
 
     // Call the base class to perform any
     // generic changes
@@ -47,142 +146,55 @@ bool SensorVL6180::enable() {
 
 void SensorVL6180::disable() {
   if(isEnabled()) {
-    // Tell the thread to exit
-    _rangeReaderQuit = true;
+    // Stop reading in the range
+    SensorScheduler::instance().remove(this);
+    _interrupt.stop();
 
-    // and wait for it to do so
-    _rangeReader->join();
-    _rangeReader = nullptr;
+    // Writing the start bit again stops continuous ranging
+    _registers.queueStrobe(0x018, 0x01);
+    _registers.flush();
 
     Sensor::disable();
   }
 }
 
-void SensorVL6180::rangeReader(std::atomic<bool> &quit, std::atomic<uint8_t> &range) {
-  I2CExternal rangeSensor(0x29);
+uint8_t SensorVL6180::range() {
+  RangeSamples::Sample range;
 
-  while(!quit.load()) {
-    uint32_t attempts = 0;
-    char status;
-    char range_status;
-
-    // Request a range to be sampled
-    writeByte(&rangeSensor, 0x018,0x01);
-
-    // check the status
-    status = readByte(&rangeSensor, 0x04f);
-    range_status = status & 0x07;
-
-    // wait for new measurement ready status, giving up after
-    // 10 attempts to avoid an infinite loop if the Sensor
-    // glitches
-    while (range_status != 0x04 && attempts++ < 10) {
-      status = readByte(&rangeSensor, 0x04f);
-      range_status = status & 0x07;
-      std::this_thread::sleep_for (std::chrono::microseconds(1000));
-    }
+  return _ranges.latest(range) ? range.value : 255;
+}
 
-    // Read in the actual range
-    range = readByte(&rangeSensor, 0x062);
+void SensorVL6180::sample() {
+  uint8_t status = 0, rangeValue = 0;
 
-    // Tell the sensor we are done
-    writeByte(&rangeSensor, 0x015,0x07);
+  // Read the status and range, and clear the interrupt ready for the next
+  // range, all in one transaction
+  _registers.queueRead(0x04f, status);
+  _registers.queueRead(0x062, rangeValue);
+  _registers.queueStrobe(0x015, 0x07);
 
-    std::this_thread::sleep_for (std::chrono::microseconds(1000));
+  if(_registers.flush() && (status & 0x07) == 0x04) {
+    _ranges.push(rangeValue);
+    changed();
   }
 }
 
 void SensorVL6180::init() {
-  char reset;
-  reset = readByte(this, 0x016);
-
-  //if (reset == 1)
   // Currently we reinitalise the sensor every time, as it doesn't
-  // always respond correctly
-  {
-
-    // Settings taken from Section 9 of the datasheet
-
-    // Mandatory : private registers
-    writeByte(this, 0x0207, 0x01);
-    writeByte(this, 0x0208, 0x01);
-    writeByte(this, 0x0096, 0x00);
-    writeByte(this, 0x0097, 0xfd);
-    writeByte(this, 0x00e3, 0x00);
-    writeByte(this, 0x00e4, 0x04);
-    writeByte(this, 0x00e5, 0x02);
-    writeByte(this, 0x00e6, 0x01);
-    writeByte(this, 0x00e7, 0x03);
-    writeByte(this, 0x00f5, 0x02);
-    writeByte(this, 0x00d9, 0x05);
-    writeByte(this, 0x00db, 0xce);
-    writeByte(this, 0x00dc, 0x03);
-    writeByte(this, 0x00dd, 0xf8);
-    writeByte(this, 0x009f, 0x00);
-    writeByte(this, 0x00a3, 0x3c);
-    writeByte(this, 0x00b7, 0x00);
-    writeByte(this, 0x00bb, 0x3c);
-    writeByte(this, 0x00b2, 0x09);
-    writeByte(this, 0x00ca, 0x09);
-    writeByte(this, 0x0198, 0x01);
-    writeByte(this, 0x01b0, 0x17);
-    writeByte(this, 0x01ad, 0x00);
-    writeByte(this, 0x00ff, 0x05);
-    writeByte(this, 0x0100, 0x05);
-    writeByte(this, 0x0199, 0x05);
-    writeByte(this, 0x01a6, 0x1b);
-    writeByte(this, 0x01ac, 0x3e);
-    writeByte(this, 0x01a7, 0x1f);
-    writeByte(this, 0x0030, 0x00);
-
-    // Recommended : Public registers - See data sheet for more detail
-    writeByte(this, 0x0011, 0x10); // Enables polling for New Sample ready
-                             // when measurement completes
-    writeByte(this, 0x010a, 0x30); // Set the averaging sample period
-                             // (compromise between lower noise and
-                             // increased execution time)
-    writeByte(this, 0x003f, 0x46); // Sets the light and dark gain (upper
-                             // nibble). Dark gain should not be
-                             // changed.
-    writeByte(this, 0x0031, 0xFF); // sets the # of range measurements after
-                             // which auto calibration of system is
-                             // performed
-    writeByte(this, 0x0040, 0x63); // Set ALS integration time to 100ms
-    writeByte(this, 0x002e, 0x01); // perform a single temperature calibration
-                             // of the ranging sensor
-
-    // Optional: Public registers - See data sheet for more detail
-    writeByte(this, 0x001b, 0x09); // Set default ranging inter-measurement
-                             // period to 100ms
-    writeByte(this, 0x003e, 0x31); // Set default ALS inter-measurement period
-                             // to 500ms
-    writeByte(this, 0x0014, 0x24); // Configures interrupt on New Sample
-                             // Ready threshold event
-
-    writeByte(this, 0x016, 0x00); //change fresh out of set status to 0
-  }
-}
-
-void SensorVL6180::writeByte(I2C *i2c, uint16_t reg, char data) {
-  char data_write[3];
+  // always respond correctly, so none of the cached register values
+  // can be trusted
+  _registers.invalidate();
 
-  data_write[0] = (reg >> 8) & 0xFF;; // MSB of register address
-  data_write[1] = reg & 0xFF; // LSB of register address
-  data_write[2] = data & 0xFF;
-  i2c->writeBytes(data_write, 3);
+  // Send all of the settings
+  _registers.queueWrite(vl6180Settings, sizeof(vl6180Settings) / sizeof(vl6180Settings[0]));
 
-}
-
-char SensorVL6180::readByte(I2C *i2c, uint16_t reg) {
-  char data_write[2];
-  char data_read[1];
-  data_write[0] = (reg >> 8) & 0xFF; // MSB of register address
-  data_write[1] = reg & 0xFF; // LSB of register address
-  i2c->writeBytes(data_write, 2);
-  i2c->readBytes(data_read, 1);
-
-  return data_read[0];
+  //change fresh out of set status to 0
+  _registers.queueStrobe(0x016, 0x00);
 
+  // and send them all to the sensor in one go
+  if(!_registers.flush()) {
+    std::cerr << __func__ << ": Failed to initialise VL6180" << std::endl;
+  }
 }
 
 }
@@ -7,18 +7,20 @@
 #ifndef _PIWARS_SENSORVL6180_H
 #define _PIWARS_SENSORVL6180_H
 
-#include <atomic>
-#include <thread>
 #include <cstdint>
 #include <cstddef>
 
 #include "Sensor.h"
+#include "GPIO.h"
 #include "I2C.h"
+#include "I2CRegisterMap.h"
 
 namespace PiWars {
 
 class SensorVL6180 : public Sensor, public I2CExternal {
   public:
+    static const unsigned INTERRUPT_PIN = 4; //!< The GPIO pin the sensor's GPIO1 interrupt line is connected to
+
     // Initialize the VL6180 ready for use
     SensorVL6180();
     ~SensorVL6180();
@@ -30,31 +32,38 @@ class SensorVL6180 : public Sensor, public I2CExternal {
     // @returns true if the sensor exists
     bool exists();
 
-    // Enables the sensor ready for use, starting a background thread
-    // to process and read in results
+    // Enables the sensor ready for use, ranging continuously, and has the
+    // SensorScheduler read in each result as GPIO1 signals it's ready
     // @returns true if successfully enabled
     bool enable();
 
-    // Disable the sensor, shutting down the background thread
+    // Disable the sensor, stopping it ranging
     void disable();
 
+    // Reads in the range just measured, and clears the interrupt ready
+    // for the next one
+    void sample();
+
+    typedef SampleRing<uint8_t> RangeSamples;
+
     // Returns the current range in mm
     //
     // @returns The range in mm.  Note: A range of 255 indicates the range wasn't
     // read successfully for some reason
-    uint8_t range() { return _range.load(); }
+    uint8_t range();
+
+    // Returns the ranges read in, in mm, along with when they were read
+    //
+    // @returns The ranges
+    const RangeSamples &ranges() { return _ranges; }
 
   private:
     void init(); //<! Initialise the range sensor
-    static void writeByte(I2C *i2c, uint16_t reg, char data); //<! The VL6180 has 16 bit registers, so we need a special write call
-    static char readByte(I2C *i2c, uint16_t reg); //<! The VL6180 has 16 bit registers, so we need a special read call
-    static void rangeReader(std::atomic<bool> &quit, std::atomic<uint8_t> &range); //<! Background thread for polling the sensor
 
     bool _initialised; //<! Indicates if the sensor has been intialised
-    std::atomic<uint8_t> _range; //<! The last successfully read in range.
-
-    std::thread *_rangeReader; //<! Background thread for reading in the range
-    std::atomic<bool> _rangeReaderQuit; //<! Used to indicate when the thread should exit
+    I2CRegisterMap _registers; //<! The VL6180 has 16 bit registers, so all access goes through here
+    RangeSamples _ranges; //<! The successfully read in ranges
+    GPIOInterrupt _interrupt; //<! Fires when GPIO1 signals a new range is ready
 };
 
 }
@@ -0,0 +1,379 @@
+/**
+ * Models of the I2C devices that make up the robot, for use with the
+ * I2CSimulator. Each model responds to the same I2C protocol as the
+ * real device (or the Arduino firmware driving it).
+ */
+
+#include "SimulatedDevices.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+namespace PiWars
+{
+
+// How long the VL6180 takes to measure a range
+static const std::chrono::microseconds vl6180MeasurementTime(10000);
+
+// Copies the response to the last command out to the master, padding
+// with 0xFF as the Arduino does once there is nothing left to send
+static void sendResponse(std::vector<char> &response, char *buffer, size_t length) {
+  for(size_t i = 0; i < length; i++) {
+    buffer[i] = (i < response.size()) ? response[i] : (char)0xFF;
+  }
+
+  // The response is only sent once
+  response.clear();
+}
+
+// How quickly the encoders count with the motors at full power
+static const double encoderFullSpeed = 11200.0;
+
+// Adds a 32 bit value to a response
+static void pushLong(std::vector<char> &response, uint32_t value) {
+  response.push_back((value >> 24) & 0xFF);
+  response.push_back((value >> 16) & 0xFF);
+  response.push_back((value >> 8) & 0xFF);
+  response.push_back(value & 0xFF);
+}
+
+SimulatedMotorDriver::SimulatedMotorDriver()
+  : _left(0)
+  , _right(0)
+  , _commands(0)
+  , _started(clock::now())
+  , _updated(_started)
+{
+  for(int i = 0; i < 2; i++) {
+    _counts[i] = 0.0;
+    _speeds[i] = 0.0;
+  }
+}
+
+void SimulatedMotorDriver::update() {
+  clock::time_point now = clock::now();
+  double elapsed = std::chrono::duration<double>(now - _updated).count();
+
+  // The wheels change speed straight away, with no inertia
+  _counts[0] += _speeds[0] * elapsed;
+  _counts[1] += _speeds[1] * elapsed;
+  _updated = now;
+}
+
+bool SimulatedMotorDriver::write(const char *bytes, size_t length) {
+  // A ping is ignored, leaving any response still to be read
+  if(1 == length && 0x10 == bytes[0]) {
+    return true;
+  }
+
+  // The Arduino acknowledges everything, but only acts on
+  // commands it recognises
+  _commands++;
+  _response.assign(1, bytes[0]);
+
+  // Catch the encoders up before the power changes
+  update();
+
+  if(0x13 == bytes[0] && 1 == length) {
+    // Read the encoders
+    pushLong(_response, (uint32_t)(int32_t)_counts[0]);
+    pushLong(_response, (uint32_t)(int32_t)_counts[1]);
+    pushLong(_response, std::chrono::duration_cast<std::chrono::microseconds>(_updated - _started).count());
+  }
+  else if(0x11 == bytes[0] && 1 == length) {
+    _left = 0;
+    _right = 0;
+    _speeds[0] = _speeds[1] = 0.0;
+  }
+  else if(0x12 == bytes[0] && 5 == length) {
+    int16_t left = (int16_t)(((uint8_t)bytes[1] << 8) | (uint8_t)bytes[2]);
+    int16_t right = (int16_t)(((uint8_t)bytes[3] << 8) | (uint8_t)bytes[4]);
+
+    if(left >= -100 && left <= 100 && right >= -100 && right <= 100) {
+      // The wheels turn in proportion to the power
+      _left = left;
+      _right = right;
+      _speeds[0] = (left / 100.0) * encoderFullSpeed;
+      _speeds[1] = (right / 100.0) * encoderFullSpeed;
+    }
+  }
+  else if(0x14 == bytes[0] && 5 == length) {
+    int16_t left = (int16_t)(((uint8_t)bytes[1] << 8) | (uint8_t)bytes[2]);
+    int16_t right = (int16_t)(((uint8_t)bytes[3] << 8) | (uint8_t)bytes[4]);
+
+    // The control loop holds the wheels at exactly the velocity asked
+    // for, which takes the power it would on a level floor
+    _speeds[0] = std::max(-encoderFullSpeed, std::min(encoderFullSpeed, (double)left));
+    _speeds[1] = std::max(-encoderFullSpeed, std::min(encoderFullSpeed, (double)right));
+    _left = std::lround((_speeds[0] * 100.0) / encoderFullSpeed);
+    _right = std::lround((_speeds[1] * 100.0) / encoderFullSpeed);
+  }
+  else {
+    _response.clear();
+  }
+
+  return true;
+}
+
+bool SimulatedMotorDriver::read(char *buffer, size_t length) {
+  sendResponse(_response, buffer, length);
+  return true;
+}
+
+// How long the LineFollower Arduino takes to take a reading
+static const std::chrono::microseconds lineReadingTime(3000);
+
+SimulatedLineFollower::SimulatedLineFollower()
+  : _line(3500)
+  , _started(std::chrono::steady_clock::now())
+  , _calibrated(false)
+{
+}
+
+bool SimulatedLineFollower::write(const char *bytes, size_t length) {
+  // A ping is ignored, leaving any response still to be read
+  if(1 == length && 0x10 == bytes[0]) {
+    return true;
+  }
+
+  _response.clear();
+
+  if(2 == length && 0x14 == bytes[0] && bytes[1] < 2) {
+    // Read back a chunk of the calibration
+    _response.push_back(bytes[0]);
+    _response.push_back(bytes[1]);
+    _response.push_back(_calibrated);
+
+    for(int i = 0; i < 8; i++) {
+      uint16_t value = _calibrated ? _calibration[(int)bytes[1]][i] : 0;
+
+      _response.push_back((value >> 8) & 0xFF);
+      _response.push_back(value & 0xFF);
+    }
+
+    return true;
+  }
+
+  if(18 == length && 0x15 == bytes[0] && bytes[1] < 2) {
+    // Write a chunk of the calibration. Unlike the Arduino, each chunk
+    // is used straight away
+    for(int i = 0; i < 8; i++) {
+      _calibration[(int)bytes[1]][i] = ((uint8_t)bytes[2 + (i * 2)] << 8) | (uint8_t)bytes[3 + (i * 2)];
+    }
+    _calibrated = true;
+
+    _response.push_back(bytes[0]);
+    _response.push_back(bytes[1]);
+
+    return true;
+  }
+
+  if(1 != length) {
+    return true;
+  }
+
+  if(0x11 == bytes[0]) {
+    // Calibration start
+    _calibrated = false;
+    _response.push_back(bytes[0]);
+  }
+  else if(0x12 == bytes[0]) {
+    // Calibration stop, as if swept across a white surface and a
+    // black line
+    for(int i = 0; i < 8; i++) {
+      _calibration[0][i] = 150 + (i * 10);
+      _calibration[1][i] = 2500;
+    }
+    _calibrated = true;
+    _response.push_back(bytes[0]);
+  }
+  else if(0x13 == bytes[0]) {
+    uint16_t line = _line;
+
+    // The Arduino is constantly taking readings, counting each one
+    uint16_t counter = (std::chrono::steady_clock::now() - _started) / lineReadingTime;
+
+    _response.push_back(bytes[0]);
+    _response.push_back((counter >> 8) & 0xFF);
+    _response.push_back(counter & 0xFF);
+
+    // Each sensor sees less of the line the further away it is, reading
+    // 1000 when directly above it
+    for(int i = 0; i < 8; i++) {
+      int distance = std::abs((int)line - (i * 1000));
+      uint16_t value = (distance >= 1200) ? 0 : 1000 - ((distance * 1000) / 1200);
+
+      _response.push_back((value >> 8) & 0xFF);
+      _response.push_back(value & 0xFF);
+    }
+
+    _response.push_back((line >> 8) & 0xFF);
+    _response.push_back(line & 0xFF);
+  }
+
+  return true;
+}
+
+bool SimulatedLineFollower::read(char *buffer, size_t length) {
+  sendResponse(_response, buffer, length);
+  return true;
+}
+
+SimulatedVL6180::SimulatedVL6180(GPIOSimulator *gpio, unsigned interruptPin)
+  : _gpio(gpio)
+  , _interruptPin(interruptPin)
+  , _interruptThread(nullptr)
+  , _quit(false)
+  , _range(255)
+  , _registers(0x1000, 0)
+  , _index(0)
+  , _ranging(false)
+  , _continuous(false)
+{
+  // Identify as a VL6180, fresh out of reset
+  _registers[0x000] = 0xB4;
+  _registers[0x016] = 0x01;
+
+  // Without GPIO1 measurements are only completed when the master
+  // checks for them
+  if(_gpio) {
+    _interruptThread = new std::thread(interruptThread, this);
+  }
+}
+
+SimulatedVL6180::~SimulatedVL6180() {
+  if(_interruptThread) {
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _quit = true;
+    }
+    _changed.notify_one();
+
+    _interruptThread->join();
+    delete _interruptThread;
+    _interruptThread = nullptr;
+  }
+}
+
+bool SimulatedVL6180::write(const char *bytes, size_t length) {
+  // The first two bytes select the register. The device still
+  // acknowledges anything shorter, but ignores it
+  if(length < 2) {
+    return true;
+  }
+
+  std::unique_lock<std::mutex> lock(_mutex);
+
+  update();
+
+  _index = (((uint8_t)bytes[0] << 8) | (uint8_t)bytes[1]) & 0xFFF;
+
+  // and anything else is written to consecutive registers
+  for(size_t i = 2; i < length; i++) {
+    writeRegister(_index, bytes[i]);
+    _index = (_index + 1) & 0xFFF;
+  }
+
+  updateInterrupt();
+  _changed.notify_one();
+
+  return true;
+}
+
+bool SimulatedVL6180::read(char *buffer, size_t length) {
+  std::unique_lock<std::mutex> lock(_mutex);
+
+  update();
+  updateInterrupt();
+
+  for(size_t i = 0; i < length; i++) {
+    buffer[i] = _registers[_index];
+    _index = (_index + 1) & 0xFFF;
+  }
+
+  return true;
+}
+
+void SimulatedVL6180::update() {
+  clock::time_point now = clock::now();
+
+  if(_ranging && now >= _measured) {
+    // Store the result and flag a new sample is ready
+    _registers[0x062] = _range;
+    _registers[0x04f] = (_registers[0x04f] & ~0x07) | 0x04;
+
+    // In continuous mode the next measurement starts after the
+    // inter-measurement period, in units of 10ms
+    if(_continuous) {
+      _measured += std::chrono::milliseconds(10 * (_registers[0x01b] + 1));
+    }
+    else {
+      _ranging = false;
+    }
+  }
+}
+
+void SimulatedVL6180::writeRegister(uint16_t reg, uint8_t value) {
+  switch(reg) {
+    // SYSRANGE__START
+    case 0x018:
+      if(value & 0x01) {
+        // Writing the start bit while measuring continuously stops it
+        if(_continuous && _ranging) {
+          _continuous = false;
+          _ranging = false;
+        }
+        else {
+          _continuous = (value & 0x02);
+          _ranging = true;
+          _measured = clock::now() + vl6180MeasurementTime;
+        }
+      }
+      break;
+
+    // SYSTEM__INTERRUPT_CLEAR
+    case 0x015:
+      if(value & 0x01) {
+        _registers[0x04f] &= ~0x07;
+      }
+      break;
+
+    default:
+      _registers[reg] = value;
+      break;
+  }
+}
+
+void SimulatedVL6180::updateInterrupt() {
+  if(!_gpio) {
+    return;
+  }
+
+  // GPIO1 only signals the new sample ready interrupt if configured
+  // as an interrupt output (SYSTEM__MODE_GPIO1) and for that
+  // interrupt (SYSTEM__INTERRUPT_CONFIG_GPIO)
+  bool output = (0x08 == ((_registers[0x011] >> 1) & 0x0F));
+  bool asserted = output && (0x04 == (_registers[0x014] & 0x07)) && (0x04 == (_registers[0x04f] & 0x07));
+  bool activeHigh = (_registers[0x011] & 0x20);
+
+  _gpio->set(_interruptPin, asserted ? activeHigh : !activeHigh);
+}
+
+void SimulatedVL6180::interruptThread(SimulatedVL6180 *sensor) {
+  std::unique_lock<std::mutex> lock(sensor->_mutex);
+
+  while(!sensor->_quit) {
+    if(sensor->_ranging) {
+      sensor->_changed.wait_until(lock, sensor->_measured);
+    }
+    else {
+      sensor->_changed.wait(lock);
+    }
+
+    sensor->update();
+    sensor->updateInterrupt();
+  }
+}
+
+}
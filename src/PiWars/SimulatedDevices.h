@@ -0,0 +1,129 @@
+/**
+ * Models of the I2C devices that make up the robot, for use with the
+ * I2CSimulator. Each model responds to the same I2C protocol as the
+ * real device (or the Arduino firmware driving it).
+ */
+
+#ifndef _PIWARS_SIMULATEDDEVICES_H
+#define _PIWARS_SIMULATEDDEVICES_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "GPIOSimulator.h"
+#include "I2CSimulator.h"
+
+namespace PiWars {
+
+  // Simulates the MotorDriver Arduino (usually at 0x07)
+  class SimulatedMotorDriver : public I2CSimulatedDevice {
+    public:
+      SimulatedMotorDriver();
+
+      // Implementation of the I2CSimulatedDevice APIs
+      bool write(const char *bytes, size_t length);
+      bool read(char *buffer, size_t length);
+
+      // Returns the power the motors were last set to
+      //
+      // @param left Filled in with the left motor's power from -100 to 100
+      // @param right Filled in with the right motor's power from -100 to 100
+      void getPower(int16_t &left, int16_t &right) { left = _left; right = _right; }
+
+      // Returns how many commands have been received
+      //
+      // @returns the number of commands
+      uint32_t commands() { return _commands; }
+
+    private:
+      typedef std::chrono::steady_clock clock;
+
+      void update(); //<! Turns the encoders by however far the motors have gone since the last update
+
+      std::atomic<int16_t> _left; //<! Power of the left motor
+      std::atomic<int16_t> _right; //<! Power of the right motor
+      std::atomic<uint32_t> _commands; //<! Number of commands received
+      std::vector<char> _response; //<! The response to the last command
+
+      clock::time_point _started; //<! When the Arduino started, for the encoder timestamps
+      clock::time_point _updated; //<! When the encoders were last updated
+      double _counts[2]; //<! The count of each encoder
+      double _speeds[2]; //<! How fast each encoder is counting, per second
+  };
+
+  // Simulates the LineFollower Arduino and its QTR-8RC sensor
+  // (usually at 0x08)
+  class SimulatedLineFollower : public I2CSimulatedDevice {
+    public:
+      SimulatedLineFollower();
+
+      // Implementation of the I2CSimulatedDevice APIs
+      bool write(const char *bytes, size_t length);
+      bool read(char *buffer, size_t length);
+
+      // Sets where the line is under the sensor
+      //
+      // @param position Position of the line from 0 (under the first
+      //                 sensor) to 7000 (under the last sensor)
+      void setLine(uint16_t position) { _line = position; }
+
+    private:
+      std::atomic<uint16_t> _line; //<! Position of the line
+      std::chrono::steady_clock::time_point _started; //<! When the Arduino started taking readings
+      bool _calibrated; //<! Has the Arduino been calibrated?
+      uint16_t _calibration[2][8]; //<! The lightest and darkest reading of each sensor
+      std::vector<char> _response; //<! The response to the last command
+  };
+
+  // Simulates the VL6180 range sensor (usually at 0x29)
+  class SimulatedVL6180 : public I2CSimulatedDevice {
+    public:
+      // Creates the sensor, optionally with its GPIO1 interrupt line
+      // connected to a simulated GPIO pin
+      //
+      // @param gpio The simulated GPIO pins, or nullptr if not connected
+      // @param interruptPin The pin GPIO1 is connected to
+      SimulatedVL6180(GPIOSimulator *gpio = nullptr, unsigned interruptPin = 0);
+      ~SimulatedVL6180();
+
+      // Implementation of the I2CSimulatedDevice APIs
+      bool write(const char *bytes, size_t length);
+      bool read(char *buffer, size_t length);
+
+      // Sets the range the sensor will measure
+      //
+      // @param range The range in mm
+      void setRange(uint8_t range) { _range = range; }
+
+    private:
+      typedef std::chrono::steady_clock clock;
+
+      void update(); //<! Completes any measurement that is due
+      void writeRegister(uint16_t reg, uint8_t value); //<! Writes a register, performing any actions
+      void updateInterrupt(); //<! Drives GPIO1 to match the interrupt status
+      static void interruptThread(SimulatedVL6180 *sensor); //<! Completes measurements as they're due, so GPIO1 fires on time
+
+      GPIOSimulator *_gpio; //<! The GPIO pins GPIO1 is connected to, if any
+      unsigned _interruptPin; //<! The pin GPIO1 is connected to
+      std::thread *_interruptThread; //<! Completes measurements when GPIO1 is connected
+      bool _quit; //<! Used to indicate when the thread should exit
+      std::mutex _mutex; //<! Protects the registers and measurement state
+      std::condition_variable _changed; //<! Signalled when a measurement is started or stopped
+
+      std::atomic<uint8_t> _range; //<! The range to measure
+      std::vector<uint8_t> _registers; //<! The register file
+      uint16_t _index; //<! The register being accessed
+      bool _ranging; //<! Is a measurement in progress?
+      bool _continuous; //<! Are we measuring continuously?
+      clock::time_point _measured; //<! When the current measurement completes
+  };
+
+}
+
+#endif
@@ -2,20 +2,30 @@
  * The ThoughtProcess class represents a specific control mode for the
  * robot. Be it the code to allow the robot to be manually driven around,
  * or the code to complete a challenge.
+ *
+ * Rather than polling their sensors, ThoughtProcesses can wait for them
+ * to signal a new sample, so they react as soon as the data arrives while
+ * still being woken straight away when told to stop.
  */
 
 #ifndef _PIWARS_THOUGHT_PROCESS_H
 #define _PIWARS_THOUGHT_PROCESS_H
 
 #include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <cstddef>
+#include <initializer_list>
+#include <map>
+#include <poll.h>
 #include <unistd.h>
 #include <sys/eventfd.h>
 #include <memory>
 #include <string>
 #include <vector>
 
+#include "Sensor.h"
+
 namespace PiWars {
 
 // Forward declared classes
@@ -33,6 +43,12 @@ class ThoughtProcess {
     // @param robot The PiWars robot this ThoughtProcess
     //              is part of
     ThoughtProcess(PiWars *robot) : _robot(robot) {
+      _stopFD = eventfd(0, EFD_NONBLOCK);
+      _waitFD = eventfd(0, EFD_NONBLOCK);
+    }
+    virtual ~ThoughtProcess() {
+      close(_stopFD);
+      close(_waitFD);
     }
 
     // Returns the name of the ThoughtProcess
@@ -50,12 +66,87 @@ class ThoughtProcess {
     // Run the main 'ThoughtProcess' loop
     virtual void run(std::atomic<bool> &running) = 0;
 
+    // Wakes the ThoughtProcess if it's waiting, as it's being told to
+    // stop. It isn't put back to sleep until clearStop() is called.
+    void stop() {
+      uint64_t value = 1;
+      write(_stopFD, &value, sizeof(value));
+    }
+
+    // Clears a previous stop(), ready for the ThoughtProcess to be run again
+    void clearStop() {
+      uint64_t value;
+      read(_stopFD, &value, sizeof(value));
+    }
+
   protected:
     // return the cached Robot object
     PiWars *robot() { return _robot; }
 
+    // Returns the FD signalled when the ThoughtProcess should stop, for
+    // processes that wait on other things
+    //
+    // @returns The file descriptor
+    int getStopFD() { return _stopFD; }
+
+    // Waits for any of the sensors to signal a new sample. Returns straight
+    // away if any have done so since this ThoughtProcess last waited on
+    // them. Every waiter has its own eventfd, so other threads waiting on
+    // the same sensors are still woken.
+    //
+    // @param sensors The sensors to wait for
+    // @param timeout The longest to wait, or -1 to wait forever
+    //
+    // @returns false if the ThoughtProcess has been told to stop
+    bool waitFor(std::initializer_list<Sensor *> sensors, std::chrono::milliseconds timeout = std::chrono::milliseconds(-1)) {
+      struct pollfd fds[2];
+      bool stopped;
+
+      // Start listening before checking for new samples, so none are
+      // missed in between
+      for(auto sensor : sensors) {
+        sensor->addWaiter(_waitFD);
+
+        if(sensor->sequence() != _seen[sensor]) {
+          timeout = std::chrono::milliseconds(0);
+        }
+      }
+
+      fds[0].fd = _stopFD;
+      fds[0].events = POLLIN;
+      fds[0].revents = 0;
+      fds[1].fd = _waitFD;
+      fds[1].events = POLLIN;
+      fds[1].revents = 0;
+
+      stopped = (poll(fds, 2, timeout.count()) > 0) && (fds[0].revents & POLLIN);
+
+      for(auto sensor : sensors) {
+        sensor->removeWaiter(_waitFD);
+        _seen[sensor] = sensor->sequence();
+      }
+
+      // Clear the samples, ready for the next wait
+      uint64_t value;
+      read(_waitFD, &value, sizeof(value));
+
+      return !stopped;
+    }
+
+    // Sleeps, unless the ThoughtProcess is told to stop
+    //
+    // @param duration How long to sleep for
+    //
+    // @returns false if the ThoughtProcess has been told to stop
+    bool sleepFor(std::chrono::milliseconds duration) {
+      return waitFor({}, duration);
+    }
+
   private:
     PiWars *_robot; //<! The PiWars robot the ThoughtProcesses run on
+    int _stopFD; //<! eventfd signalled when the ThoughtProcess should stop
+    int _waitFD; //<! eventfd signalled by the sensors being waited for
+    std::map<Sensor *, uint64_t> _seen; //<! The sequence of each sensor when last waited for
 };
 
 }
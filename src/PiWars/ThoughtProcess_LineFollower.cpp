@@ -4,20 +4,34 @@
  * http://piwars.org/2015-competition/challenges/line-follower/
  */
 
+#include <algorithm>
 #include <cstdint>
 #include <cstddef>
 #include <unistd.h>
 
 #include "ThoughtProcess.h"
 #include "ThoughtProcess_LineFollower.h"
-#include "SensorQTR8RC.h"
+#include "SensorLine.h"
 #include "PiWars.h"
 #include "Powertrain.h"
 #include <iostream>
 
 namespace PiWars {
 
-ThoughtProcess_LineFollower::ThoughtProcess_LineFollower(PiWars *robot) : ThoughtProcess(robot), _qtr8rc(new SensorQTR8RC()) {
+// The power of each motor while the line is straight ahead
+static const float BASE_POWER = 0.25;
+
+// The most power either motor is given while turning
+static const float MAX_POWER = 0.35;
+
+// How much to turn for how far the line is off centre
+static const float STEER_PROPORTIONAL = 0.15;
+
+// How much to turn for how quickly the line is moving off centre,
+// turning earlier for a bend and damping any weaving
+static const float STEER_DERIVATIVE = 0.01;
+
+ThoughtProcess_LineFollower::ThoughtProcess_LineFollower(PiWars *robot) : ThoughtProcess(robot), _qtr8rc(SensorLine::create()) {
 }
 
 ThoughtProcess_LineFollower::~ThoughtProcess_LineFollower() {
@@ -41,83 +55,46 @@ bool ThoughtProcess_LineFollower::available() {
 }
 
 bool ThoughtProcess_LineFollower::prepare() {
+  _estimator.reset();
+
   return _qtr8rc->enable();
 }
 
 void ThoughtProcess_LineFollower::run(std::atomic<bool> &running) {
-  float lastPowerLeft = -1.0, lastPowerRight = -1.0;
-  uint16_t position = 0;
-
   while(running.load()) {
     uint16_t sensorDiff[8] = {0};
+    SensorLine::LineSamples::Sample line;
     float powerLeft, powerRight;
-    uint16_t temp;
+    uint16_t position;
     
     // Read in the sensor details
-    if(_qtr8rc->readLine(sensorDiff, temp)) {
-      uint16_t newPosition = 0;
-      
-      // Very simple implemenation
-
-      for(size_t i = 0; i < 8; i++) {
-        if(sensorDiff[i] >= 500) {
-          newPosition |= (1 << i);
-        }
-      }
+    if(_qtr8rc->readLine(sensorDiff, position) && _qtr8rc->lines().latest(line)) {
+      // and ask for the next ones straight away, so the Arduino takes
+      // the reading while we work out what to do with this one
+      _qtr8rc->requestLine();
 
-      if(newPosition) {
-        position = newPosition;
-      }
-      
-      // IMPROVE: Need a more complete algorithm here
-      if(position <= 8) {
-        // Need to turn sharp left
-        powerLeft =  0.0;
-        powerRight = 0.35;
-      }
-      else if(position < 24) {
-        // Need to turn left
-        powerLeft =  0.20;
-        powerRight = 0.35;
-      }
-      else if(position <= 48) {
-        // Continue forwards
-        powerLeft = powerRight = 0.25;
-      }
-      else if(position < 128) {
-        // Turn right
-        powerLeft = 0.35;
-        powerRight = 0.20;
+      const LineEstimator::Estimate &estimate = _estimator.update(line);
+
+      if(estimate.lost) {
+        // Turn sharply back towards where the line was last seen
+        powerLeft = (estimate.position < 0.0f) ? 0.0 : MAX_POWER;
+        powerRight = (estimate.position < 0.0f) ? MAX_POWER : 0.0;
       }
       else {
-        // Turn sharp right
-        powerLeft = 0.35;
-        powerRight = 0.00;
-      }
-
-      //std::cout << "Sensor result ";
+        // Steer towards the line, in proportion to how far off centre it
+        // is and how quickly it's moving away
+        float steer = (STEER_PROPORTIONAL * estimate.position) + (STEER_DERIVATIVE * estimate.velocity);
 
-
-      //std::cout << " = " << position ;
-
-      //std::cout << std::endl;
+        powerLeft = std::max(0.0f, std::min(MAX_POWER, BASE_POWER + steer));
+        powerRight = std::max(0.0f, std::min(MAX_POWER, BASE_POWER - steer));
+      }
 
       // Set the motors
-      if(lastPowerLeft != powerLeft || lastPowerRight != powerRight) {
-
-        robot()->powertrain()->setPower(powerLeft, powerRight);
-
-        lastPowerLeft = powerLeft;
-        lastPowerRight = powerRight;
-      }
+      robot()->powertrain()->setPower(powerLeft, powerRight);
     }
     else {
       std::cerr << __func__ << ": Failed to read in sensor details" << std::endl;
     }
-    
-    // Let the robot actually move
-    //std::this_thread::sleep_for (std::chrono::milliseconds(10));
-    
   }
 
   // Ensure the motors are stopped
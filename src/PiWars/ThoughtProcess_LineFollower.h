@@ -8,11 +8,12 @@
 #define _PIWARS_THOUGHT_PROCESS_LINE_FOLLOWER_H
 
 #include "ThoughtProcess.h"
+#include "LineEstimator.h"
 
 namespace PiWars {
 
 // Forward declare the classes we'll be using
-class SensorQTR8RC;
+class SensorLine;
 
 class ThoughtProcess_LineFollower : public ThoughtProcess {
   public:
@@ -26,7 +27,8 @@ class ThoughtProcess_LineFollower : public ThoughtProcess {
     void run(std::atomic<bool> &running);
 
   private:
-    SensorQTR8RC *_qtr8rc; //<! We use the QTR8RC for sensing the line
+    SensorLine *_qtr8rc; //<! We use the QTR8RC for sensing the line
+    LineEstimator _estimator; //<! Works out where the line is from the QTR8RC's readings
 };
 
 }
@@ -87,7 +87,12 @@ void ThoughtProcess_Manual::run(std::atomic<bool> &running) {
   fds[0].events = POLLIN;
   fds[0].revents = 0;
 
-  while(int result = poll(fds, 1, -1) && running.load()) {
+  // and so we're woken when told to stop
+  fds[1].fd = getStopFD();
+  fds[1].events = POLLIN;
+  fds[1].revents = 0;
+
+  while(int result = poll(fds, 2, -1) && running.load()) {
     // Something went wrong (FD got closed, device was removed)
     // so we simply exit out
     if(-1 == result) {
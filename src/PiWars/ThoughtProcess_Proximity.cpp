@@ -46,46 +46,38 @@ bool ThoughtProcess_Proximity::prepare() {
 }
 
 void ThoughtProcess_Proximity::run(std::atomic<bool> &running) {
-  float lastPower = -1.0;
-
   while(running.load()) {
     // Read in the current range
     uint8_t range = _vl6180->range();
-    float power = 0.0;
-    uint32_t sleepTime = 100;
+    float speed = 0.0;
 
     std::cout << "Range = "<< (int) range << std::endl;
 
     // Time to stop? (It takes some distance to stop)
     if(range <= 70) {
       // Stop!
-      power = 0.0;
+      speed = 0.0;
 
       // and we've completed
       running = false;
     }
     else if(range < 200) {
       // getting closer, start to slow down
-      power = 0.15;
-      sleepTime = 1; 
+      speed = 0.25;
     }
     // Long way to go yet!
     else {
-      // Proceed forwards at half speed
-      power = 0.40;
-      sleepTime = 5;
+      // Proceed forwards at a fair pace (m/s)
+      speed = 0.65;
     }
 
-    // Set the motors
-    if(lastPower != power) {
-      // Componsate for drift
-      float rightPower = power * 0.95;
-      robot()->powertrain()->setPower(power, rightPower);
-      lastPower = power;
-    }
+    // Set the motors, which hold both wheels at the same speed
+    robot()->powertrain()->setVelocity(speed, speed);
 
-    // Let the robot actually move
-    std::this_thread::sleep_for (std::chrono::milliseconds(sleepTime));
+    // Let the robot actually move, until the next range is read
+    if(!waitFor({ _vl6180 }, std::chrono::milliseconds(200))) {
+      break;
+    }
   }
 
   // Stop the robot, hopefully close to the wall!
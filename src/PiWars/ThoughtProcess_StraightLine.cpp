@@ -22,15 +22,11 @@
 namespace PiWars {
 
 
-ThoughtProcess_StraightLine::ThoughtProcess_StraightLine(PiWars *robot) : ThoughtProcess(robot), _rtimu(new SensorRTIMU()) {
+ThoughtProcess_StraightLine::ThoughtProcess_StraightLine(PiWars *robot) : ThoughtProcess(robot), _rtimu(&SensorRTIMU::instance()) {
 }
 
 ThoughtProcess_StraightLine::~ThoughtProcess_StraightLine() {
-  if(_rtimu) {
-    _rtimu->disable();
-    delete _rtimu;
-    _rtimu = nullptr;
-  }
+  // The RTIMU is shared, so is left for anything else using it
 }
 
 const std::string &ThoughtProcess_StraightLine::name() {
@@ -48,14 +44,16 @@ bool ThoughtProcess_StraightLine::prepare() {
 }
 
 void ThoughtProcess_StraightLine::run(std::atomic<bool> &running) {
-  float lastPowerLeft = -1.0, lastPowerRight = -1.0;
   float pitch, roll, yaw;
 
   std::chrono::time_point<std::chrono::system_clock> start, end;
   float heading;
 
-  // Let the sensor settle down
-  std::this_thread::sleep_for (std::chrono::seconds(2));
+  // Let the sensor settle down, if it hasn't already
+  if(!sleepFor(_rtimu->settling())) {
+    _rtimu->disable();
+    return;
+  }
 
   // Get the heading that we want to maintain
   _rtimu->fusion(pitch, roll, yaw);
@@ -63,20 +61,15 @@ void ThoughtProcess_StraightLine::run(std::atomic<bool> &running) {
 
   std::cout << __func__ << "Selected heading " << heading << std::endl;
 
-  // Start the motors off at 50% so we don't pull too much current when we jump to 66%
-  // IMPROVE: Update the PowerTrain, or Arduino code, to handle this ramp up
-  // automatically
-  robot()->powertrain()->setPower(0.50, 0.50);
-
   // Note the start time
   start = std::chrono::system_clock::now();
 
   while(running.load())
   {
-    float currentHeading, offset, powerLeft, powerRight;
+    float currentHeading, offset, speedLeft, speedRight;
 
-    // Get the heading that we want to maintain
-    _rtimu->fusion(pitch, roll, yaw);
+    // Get the heading we're on now, rather than when the IMU last read it
+    _rtimu->predictYaw(yaw);
 
     // Work out our offset versus the heading
     currentHeading = yaw + 180;
@@ -90,30 +83,28 @@ void ThoughtProcess_StraightLine::run(std::atomic<bool> &running) {
     // Very simple checks
     if(offset > 0) {
       // We want to move left slightly
-      powerLeft = 0.55;
-      powerRight = 0.66;
+      speedLeft = 0.9;
+      speedRight = 1.1;
     }
     else if(offset < 0) {
       // Move right
-      powerLeft = 0.66;
-      powerRight = 0.55;
+      speedLeft = 1.1;
+      speedRight = 0.9;
     }
     else {
       // straight on!
-      powerLeft = 0.66;
-      powerRight = 0.66;
+      speedLeft = 1.1;
+      speedRight = 1.1;
     }
 
-    // Set the motors
-    if(lastPowerLeft != powerLeft || lastPowerRight != powerRight) {
-      robot()->powertrain()->setPower(powerLeft, powerRight);
-      //std::cerr << "setting power to " << powerLeft << ":" << powerRight << std::endl;
-      lastPowerLeft = powerLeft;
-      lastPowerRight = powerRight;
-    }
+    // Set the speed of each wheel (m/s), which the motors hold
+    // whatever the battery level, so each run is the same
+    robot()->powertrain()->setVelocity(speedLeft, speedRight);
 
-    // Let the robot actually move
-    std::this_thread::sleep_for (std::chrono::milliseconds(10));
+    // Let the robot actually move, until the heading is updated
+    if(!waitFor({ _rtimu }, std::chrono::milliseconds(100))) {
+      break;
+    }
 
     end = std::chrono::system_clock::now();
     std::chrono::duration<float> duration = end - start;
@@ -5,12 +5,13 @@
  * http://piwars.org/2015-competition/challenges/three-point-turn/
  *
  * Currently we make use of the SenseHAT, via the RTIMU library, to
- * determine our current heading, and dead reckoning to
- * drive round the course.
+ * determine our current heading, and the wheel encoders to measure
+ * how far we've driven round the course.
  */
 
 #include <cstdint>
 #include <cstddef>
+#include <cmath>
 #include <unistd.h>
 
 #include "ThoughtProcess.h"
@@ -22,16 +23,17 @@
 
 namespace PiWars {
 
+// The lengths of each leg of the course, in metres
+static const float START_TO_TURN = 1.8f;
+static const float TURN_FORWARDS = 0.35f;
+static const float TURN_BACKWARDS = 0.7f;
 
-ThoughtProcess_ThreePointTurn::ThoughtProcess_ThreePointTurn(PiWars *robot) : ThoughtProcess(robot), _rtimu(new SensorRTIMU()) {
+
+ThoughtProcess_ThreePointTurn::ThoughtProcess_ThreePointTurn(PiWars *robot) : ThoughtProcess(robot), _rtimu(&SensorRTIMU::instance()) {
 }
 
 ThoughtProcess_ThreePointTurn::~ThoughtProcess_ThreePointTurn() {
-  if(_rtimu) {
-    _rtimu->disable();
-    delete _rtimu;
-    _rtimu = nullptr;
-  }
+  // The RTIMU is shared, so is left for anything else using it
 }
 
 const std::string &ThoughtProcess_ThreePointTurn::name() {
@@ -54,8 +56,11 @@ void ThoughtProcess_ThreePointTurn::run(std::atomic<bool> &running) {
   std::chrono::time_point<std::chrono::system_clock> start, end;
   float heading;
 
-  // Let the sensor settle down
-  std::this_thread::sleep_for (std::chrono::seconds(2));
+  // Let the sensor settle down, if it hasn't already
+  if(!sleepFor(_rtimu->settling())) {
+    _rtimu->disable();
+    return;
+  }
 
   // Get the heading that we want to maintain
   _rtimu->fusion(pitch, roll, yaw);
@@ -63,10 +68,7 @@ void ThoughtProcess_ThreePointTurn::run(std::atomic<bool> &running) {
 
   std::cerr << "Selected heading " << heading << std::endl;
 
-  // Start the motors off at 50% so we don't pull too much current when we jump to 66%
-  robot()->powertrain()->setPower(0.50, 0.50);
-
-  driveForDuration(running, heading, false, 7.5);
+  driveForDistance(running, heading, false, START_TO_TURN, 7.5f);
 
   // Turn left
   heading = heading - 90;
@@ -81,13 +83,13 @@ void ThoughtProcess_ThreePointTurn::run(std::atomic<bool> &running) {
   // Drive forwards again
 
   std::cerr << "forwards" << std::endl;
-  driveForDuration(running, heading, false, 1.4f);
+  driveForDistance(running, heading, false, TURN_FORWARDS, 1.4f);
 
   // Drive backwards
-  driveForDuration(running, heading, true, 3.0f);
+  driveForDistance(running, heading, true, TURN_BACKWARDS, 3.0f);
 
   // Forwards again
-  driveForDuration(running, heading, false, 1.5f);
+  driveForDistance(running, heading, false, TURN_FORWARDS, 1.5f);
 
   // Turn left again
   heading = heading - 90;
@@ -99,7 +101,7 @@ void ThoughtProcess_ThreePointTurn::run(std::atomic<bool> &running) {
   turnLeft(running, heading);
 
   // and finally head home
-  driveForDuration(running, heading, false, 7.5f);
+  driveForDistance(running, heading, false, START_TO_TURN, 7.5f);
 
   // Release the sensor
   _rtimu->disable();
@@ -107,10 +109,12 @@ void ThoughtProcess_ThreePointTurn::run(std::atomic<bool> &running) {
   std::cerr << std::endl << "Done!" << std::endl;
 }
 
-void ThoughtProcess_ThreePointTurn::driveForDuration(std::atomic<bool> &running, const float heading, const bool backwards, const float seconds)
+void ThoughtProcess_ThreePointTurn::driveForDistance(std::atomic<bool> &running, const float heading, const bool backwards, const float metres, const float seconds)
 {
   std::chrono::time_point<std::chrono::system_clock> start, end;
-  float lastPowerLeft = 0.0f, lastPowerRight = 0.0f;
+
+  // Measure the distance from here, if we can
+  bool measuring = robot()->powertrain()->resetOdometry();
 
   // Note the start time
   start = std::chrono::system_clock::now();
@@ -118,10 +122,10 @@ void ThoughtProcess_ThreePointTurn::driveForDuration(std::atomic<bool> &running,
   // Move forwards on the current heading
   while(running.load()) {
     float currentHeading, offset, powerLeft, powerRight;
-    float pitch, roll, yaw;
+    float yaw;
 
-    // Get the heading that we want to maintain
-    _rtimu->fusion(pitch, roll, yaw);
+    // Get the heading we're on now, rather than when the IMU last read it
+    _rtimu->predictYaw(yaw);
 
     // Work out our offset versus the heading
     currentHeading = yaw + 180;
@@ -147,24 +151,21 @@ void ThoughtProcess_ThreePointTurn::driveForDuration(std::atomic<bool> &running,
       powerRight = 0.66;
     }
 
-    // Set the motors
-    if(lastPowerLeft != powerLeft || lastPowerRight != powerRight) {
-      // Are we moving backwards?
-      if(backwards) {
-        float temp = powerLeft;
-
-        powerLeft = -powerRight;
-        powerRight = -temp;
-      }
-
-      robot()->powertrain()->setPower(powerLeft, powerRight);
-      //std::cerr << "setting power to " << powerLeft << ":" << powerRight << std::endl;
-      lastPowerLeft = powerLeft;
-      lastPowerRight = powerRight;
+    // Are we moving backwards?
+    if(backwards) {
+      float temp = powerLeft;
+
+      powerLeft = -powerRight;
+      powerRight = -temp;
     }
 
-    // Let the robot actually move
-    std::this_thread::sleep_for (std::chrono::milliseconds(10));
+    // Set the motors
+    robot()->powertrain()->setPower(powerLeft, powerRight);
+
+    // Let the robot actually move, until the heading is updated
+    if(!waitFor({ _rtimu }, std::chrono::milliseconds(100))) {
+      break;
+    }
 
     end = std::chrono::system_clock::now();
     std::chrono::duration<float> duration = end - start;
@@ -173,6 +174,13 @@ void ThoughtProcess_ThreePointTurn::driveForDuration(std::atomic<bool> &running,
     if(duration.count() >= seconds){
       break;
     }
+
+    // Have we gone far enough?
+    PowertrainOdometry odometry;
+
+    if(measuring && robot()->powertrain()->getOdometry(odometry) && std::fabs(odometry.distance) >= metres) {
+      break;
+    }
   }
 
   // and stop
@@ -185,10 +193,10 @@ void ThoughtProcess_ThreePointTurn::turnLeft(std::atomic<bool> &running, const f
   while(running.load())
   {
     float currentHeading, offset;
-    float pitch, roll, yaw;
+    float yaw;
 
-    // Get the heading that we want to maintain
-    _rtimu->fusion(pitch, roll, yaw);
+    // Get the heading we're on now, rather than when the IMU last read it
+    _rtimu->predictYaw(yaw);
 
     // Work out our offset versus the heading
     currentHeading = yaw + 180;
@@ -207,8 +215,10 @@ void ThoughtProcess_ThreePointTurn::turnLeft(std::atomic<bool> &running, const f
       break;
     }
 
-    // Let the robot actually move
-    std::this_thread::sleep_for (std::chrono::milliseconds(10));
+    // Let the robot actually move, until the heading is updated
+    if(!waitFor({ _rtimu }, std::chrono::milliseconds(100))) {
+      break;
+    }
   }
 
   // Stop
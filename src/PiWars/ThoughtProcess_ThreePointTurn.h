@@ -5,8 +5,8 @@
  * http://piwars.org/2015-competition/challenges/three-point-turn/
  *
  * Currently we make use of the SenseHAT, via the RTIMU library, to
- * determine our current heading, and dead reckoning to
- * drive round the course.
+ * determine our current heading, and the wheel encoders to measure
+ * how far we've driven round the course.
  */
 
 
@@ -32,13 +32,15 @@ class ThoughtProcess_ThreePointTurn : public ThoughtProcess {
 
   private:
     // Drive on the specific heading, in the specified direction for the
-    // specified amount of time.
+    // specified distance. If the encoders can't be read, or the distance
+    // isn't reached in time, it stops after the specified amount of time.
     //
     // @param running If this becomes false then exit early
     // @param heading The heading to maintain from 0 to 360
     // @param backwards If true drive backwards instead of forwards
-    // @param seconds The number of seconds to drive for
-    void driveForDuration(std::atomic<bool> &running, const float heading, const bool backwards, const float seconds);
+    // @param metres The distance to drive
+    // @param seconds The most number of seconds to drive for
+    void driveForDistance(std::atomic<bool> &running, const float heading, const bool backwards, const float metres, const float seconds);
 
     // Turns the robot left until it reaches the specified heading
     //
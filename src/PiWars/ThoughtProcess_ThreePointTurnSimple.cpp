@@ -5,11 +5,12 @@
  * http://piwars.org/2015-competition/challenges/three-point-turn/
  *
  * This is the 'simple' implementation that uses dead-reckoning to
- * complete the course
+ * complete the course, measuring each leg with the wheel encoders
  */
 
 #include <cstdint>
 #include <cstddef>
+#include <cmath>
 #include <unistd.h>
 #include <thread>
 
@@ -21,6 +22,15 @@
 
 namespace PiWars {
 
+// The lengths of each leg of the course, in metres
+static const float START_TO_TURN = 1.8f;
+static const float TURN_FORWARDS = 0.35f;
+static const float TURN_BACKWARDS = 0.7f;
+
+// The turns are timed, which was calibrated with the power applied
+// straight away, so they aren't ramped
+static const PowertrainRamp TURN_RAMP = { 0.0f, 0.0f, 0.0f, 0.0f };
+
 
 ThoughtProcess_ThreePointTurnSimple::ThoughtProcess_ThreePointTurnSimple(PiWars *robot) : ThoughtProcess(robot) {
 }
@@ -46,65 +56,57 @@ void ThoughtProcess_ThreePointTurnSimple::run(std::atomic<bool> &running) {
   std::chrono::time_point<std::chrono::system_clock> start, end;
 
   // Drive forwards
-  driveForDuration(running, false, 7.5);
+  driveForDistance(running, false, START_TO_TURN, 7.5f);
 
   // Turn left
   turnLeft(running);
 
   // Drive forwards again
-  driveForDuration(running, false, 1.4f);
+  driveForDistance(running, false, TURN_FORWARDS, 1.4f);
   
   // Drive backwards
-  driveForDuration(running, true, 3.0f);
+  driveForDistance(running, true, TURN_BACKWARDS, 3.0f);
   
   // Forwards again
-  driveForDuration(running, false, 1.5f);
+  driveForDistance(running, false, TURN_FORWARDS, 1.5f);
 
   // Turn left again
   turnLeft(running);
   
   // and finally head home
-  driveForDuration(running, false, 7.5f);
+  driveForDistance(running, false, START_TO_TURN, 7.5f);
 }
 
-void ThoughtProcess_ThreePointTurnSimple::driveForDuration(std::atomic<bool> &running, const bool backwards, const float seconds)
+void ThoughtProcess_ThreePointTurnSimple::driveForDistance(std::atomic<bool> &running, const bool backwards, const float metres, const float seconds)
 {
   std::chrono::time_point<std::chrono::system_clock> start, end;
-  float lastPowerLeft = 0.0f, lastPowerRight = 0.0f;
+
+  // Measure the distance from here, if we can
+  bool measuring = robot()->powertrain()->resetOdometry();
 
   // Note the start time
   start = std::chrono::system_clock::now();
 
   // Move forwards on the current heading
   while(running.load()) {
-    float powerLeft, powerRight;
-
-    // Drive at half speed
-    powerLeft = 0.50;
-    powerRight = 0.50;
-
-    // Set the motors
-    //if(lastPowerLeft != powerLeft || lastPowerRight != powerRight) 
-    {
-      // Are we moving backwards?
-      if(backwards) {
-        float temp = powerLeft;
-
-        powerLeft = -powerRight;
-        powerRight = -temp;
-      }
-
-      // The robot has a slight drift, so correct here
-      powerRight = powerLeft * 0.95;
-      
-      if(robot()->powertrain()->setPower(powerLeft, powerRight)) {
-        lastPowerLeft = powerLeft;
-        lastPowerRight = powerRight;
-      }
+    float speed;
+
+    // Drive at about half speed (m/s)
+    speed = 0.8;
+
+    // Are we moving backwards?
+    if(backwards) {
+      speed = -speed;
     }
 
+    // Set the motors, which hold both wheels at the same speed, so
+    // the robot goes straight and covers the same distance each time
+    robot()->powertrain()->setVelocity(speed, speed);
+
     // Let the robot actually move
-    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    if(!sleepFor(std::chrono::milliseconds(10))) {
+      break;
+    }
 
     end = std::chrono::system_clock::now();
     std::chrono::duration<float> duration = end - start;
@@ -112,6 +114,13 @@ void ThoughtProcess_ThreePointTurnSimple::driveForDuration(std::atomic<bool> &ru
     if(duration.count() >= seconds){
       break;
     }
+
+    // Have we gone far enough?
+    PowertrainOdometry odometry;
+
+    if(measuring && robot()->powertrain()->getOdometry(odometry) && std::fabs(odometry.distance) >= metres) {
+      break;
+    }
   }
 
   // and stop
@@ -120,6 +129,9 @@ void ThoughtProcess_ThreePointTurnSimple::driveForDuration(std::atomic<bool> &ru
 
 void ThoughtProcess_ThreePointTurnSimple::turnLeft(std::atomic<bool> &running) {
   std::chrono::time_point<std::chrono::system_clock> start, end;
+  PowertrainRamp ramp = robot()->powertrain()->ramp();
+
+  robot()->powertrain()->setRamp(TURN_RAMP);
 
   // Note the start time
   start = std::chrono::system_clock::now();
@@ -132,7 +144,9 @@ void ThoughtProcess_ThreePointTurnSimple::turnLeft(std::atomic<bool> &running) {
     robot()->powertrain()->setPower(-0.50, 0.50);
 
     // Let the robot actually move
-    std::this_thread::sleep_for (std::chrono::milliseconds(10));
+    if(!sleepFor(std::chrono::milliseconds(10))) {
+      break;
+    }
     
     end = std::chrono::system_clock::now();
     std::chrono::duration<float> duration = end - start;
@@ -143,8 +157,9 @@ void ThoughtProcess_ThreePointTurnSimple::turnLeft(std::atomic<bool> &running) {
     }
   }
 
-  // Stop
+  // Stop, and put the ramp back for the drive legs
   robot()->powertrain()->stop();
+  robot()->powertrain()->setRamp(ramp);
 }
 
 }
@@ -5,7 +5,7 @@
  * http://piwars.org/2015-competition/challenges/three-point-turn/
  *
  * This is the 'simple' implementation that uses dead-reckoning to
- * complete the course
+ * complete the course, measuring each leg with the wheel encoders
  */
 
 
@@ -30,15 +30,19 @@ class ThoughtProcess_ThreePointTurnSimple : public ThoughtProcess {
     void run(std::atomic<bool> &running);
 
   private:
-    // Drive on the specific heading, in the specified direction for the
-    // specified amount of time.
+    // Drive straight, in the specified direction, until the encoders say
+    // the robot has travelled the specified distance. Gives up after the
+    // specified amount of time, which is also how long it drives for if
+    // the encoders can't be read.
     //
     // @param running If this becomes false then exit early
     // @param backwards If true drive backwards instead of forwards
-    // @param seconds The number of seconds to drive for
-    void driveForDuration(std::atomic<bool> &running, const bool backwards, const float seconds);
+    // @param metres How far to drive
+    // @param seconds The longest to drive for
+    void driveForDistance(std::atomic<bool> &running, const bool backwards, const float metres, const float seconds);
 
-    // Turns the robot left 90 degrees
+    // Turns the robot left 90 degrees, by turning at a set power for a
+    // set time, without ramping the power
     //
     // @param running If this becomes false then exit early
     void turnLeft(std::atomic<bool> &running);